@@ -0,0 +1,40 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "auth-common.h"
+
+#if defined(BUILTIN_LDAP) || defined(PLUGIN_BUILD)
+
+#include "array.h"
+#include "aqueue.h"
+#include "db-ldap.h"
+
+struct ldap_connection *
+db_ldap_get_request_conn(struct ldap_connection *conn,
+			 enum ldap_request_type type)
+{
+	struct ldap_connection *const *connp, *best;
+	bool auth_bind_only;
+
+	if (conn->primary != NULL)
+		conn = conn->primary;
+	if (!array_is_created(&conn->extra_conns))
+		return conn;
+
+	/* auth binds go to their own connections if there are any, so they
+	   don't have to wait for the lookups to finish (and vice versa) */
+	auth_bind_only = type == LDAP_REQUEST_TYPE_BIND &&
+		conn->set.auth_bind_connections > 0;
+	best = auth_bind_only ? NULL : conn;
+	array_foreach(&conn->extra_conns, connp) {
+		if ((*connp)->auth_bind_only != auth_bind_only)
+			continue;
+		if (best == NULL ||
+		    aqueue_count((*connp)->request_queue) <
+		    aqueue_count(best->request_queue))
+			best = *connp;
+	}
+	i_assert(best != NULL);
+	return best;
+}
+
+#endif
@@ -120,6 +120,8 @@ static struct setting_def setting_defs[] = {
 	DEF_STR(default_pass_scheme),
 	DEF_BOOL(userdb_warning_disable),
 	DEF_BOOL(blocking),
+	DEF_INT(connections),
+	DEF_INT(auth_bind_connections),
 
 	{ 0, NULL, 0 }
 };
@@ -156,7 +158,9 @@ static struct ldap_settings default_ldap_settings = {
 	.iterate_filter = "(objectClass=posixAccount)",
 	.default_pass_scheme = "crypt",
 	.userdb_warning_disable = FALSE,
-	.blocking = FALSE
+	.blocking = FALSE,
+	.connections = 1,
+	.auth_bind_connections = 0
 };
 
 static struct ldap_connection *ldap_connections = NULL;
@@ -451,6 +455,8 @@ void db_ldap_request(struct ldap_connection *conn,
 
 	request->msgid = -1;
 	request->create_time = ioloop_time;
+	request->create_timeval = ioloop_timeval;
+	conn = db_ldap_get_request_conn(conn, request->type);
 
 	if (!db_ldap_check_limits(conn, request)) {
 		request->callback(conn, request, NULL);
@@ -724,6 +730,20 @@ static int db_ldap_search_next_subsearch(struct ldap_connection *conn,
 	return 0;
 }
 
+static void db_ldap_conn_stats_add(struct ldap_connection *conn,
+				   const struct ldap_request *request)
+{
+	long long usecs;
+
+	usecs = timeval_diff_usecs(&ioloop_timeval, &request->create_timeval);
+	if (usecs < 0)
+		usecs = 0;
+	conn->stats_request_count++;
+	conn->stats_total_usecs += usecs;
+	if (conn->stats_max_usecs < (unsigned long long)usecs)
+		conn->stats_max_usecs = usecs;
+}
+
 static bool
 db_ldap_handle_request_result(struct ldap_connection *conn,
 			      struct ldap_request *request, unsigned int idx,
@@ -814,6 +834,7 @@ db_ldap_handle_request_result(struct ldap_connection *conn,
 	if (final_result) {
 		conn->pending_count--;
 		aqueue_delete(conn->request_queue, idx);
+		db_ldap_conn_stats_add(conn, request);
 	}
 
 	T_BEGIN {
@@ -1240,12 +1261,19 @@ static void db_ldap_connect_callback(struct ldap_connection *conn)
 
 void db_ldap_connect_delayed(struct ldap_connection *conn)
 {
+	struct ldap_connection *const *connp;
+
 	if (conn->delayed_connect)
 		return;
 	conn->delayed_connect = TRUE;
 
 	i_assert(conn->to == NULL);
 	conn->to = timeout_add_short(0, db_ldap_connect_callback, conn);
+
+	if (array_is_created(&conn->extra_conns)) {
+		array_foreach(&conn->extra_conns, connp)
+			db_ldap_connect_delayed(*connp);
+	}
 }
 
 void db_ldap_enable_input(struct ldap_connection *conn, bool enable)
@@ -1771,6 +1799,86 @@ static const char *parse_setting(const char *key, const char *value,
 				       &conn->set, key, value);
 }
 
+static struct ldap_connection *db_ldap_conn_alloc(void)
+{
+	struct ldap_connection *conn;
+	pool_t pool;
+
+	pool = pool_alloconly_create("ldap_connection", 1024);
+	conn = p_new(pool, struct ldap_connection, 1);
+	conn->pool = pool;
+	conn->refcount = 1;
+
+	conn->conn_state = LDAP_CONN_STATE_DISCONNECTED;
+	conn->default_bind_msgid = -1;
+	conn->fd = -1;
+
+	i_array_init(&conn->request_array, 512);
+	conn->request_queue = aqueue_init(&conn->request_array.arr);
+	return conn;
+}
+
+static void
+db_ldap_add_extra_conn(struct ldap_connection *primary, bool auth_bind_only)
+{
+	struct ldap_connection *conn;
+
+	conn = db_ldap_conn_alloc();
+	conn->primary = primary;
+	conn->auth_bind_only = auth_bind_only;
+	conn->userdb_used = primary->userdb_used;
+	conn->config_path = primary->config_path;
+	conn->set = primary->set;
+	db_ldap_init_ld(conn);
+	array_append(&primary->extra_conns, &conn, 1);
+}
+
+static void db_ldap_init_extra_conns(struct ldap_connection *conn)
+{
+	unsigned int i, count;
+
+	count = conn->set.connections - 1 + conn->set.auth_bind_connections;
+	if (count == 0)
+		return;
+
+	i_array_init(&conn->extra_conns, count);
+	for (i = 1; i < conn->set.connections; i++)
+		db_ldap_add_extra_conn(conn, FALSE);
+	for (i = 0; i < conn->set.auth_bind_connections; i++)
+		db_ldap_add_extra_conn(conn, TRUE);
+}
+
+static void db_ldap_conn_log_stats(struct ldap_connection *conn,
+				   unsigned int conn_idx)
+{
+	unsigned long long avg_usecs;
+
+	if (conn->stats_request_count == 0)
+		return;
+
+	avg_usecs = conn->stats_total_usecs / conn->stats_request_count;
+	i_info("LDAP %s: Connection %u%s: %u requests, "
+	       "latency avg %llu.%03llu ms, max %llu.%03llu ms",
+	       conn->config_path, conn_idx,
+	       conn->auth_bind_only ? " (auth binds)" : "",
+	       conn->stats_request_count,
+	       avg_usecs / 1000, avg_usecs % 1000,
+	       conn->stats_max_usecs / 1000, conn->stats_max_usecs % 1000);
+}
+
+static void db_ldap_conn_free(struct ldap_connection *conn)
+{
+	db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE, "Shutting down");
+	i_assert(conn->pending_count == 0);
+	db_ldap_conn_close(conn);
+	i_assert(conn->to == NULL);
+
+	array_free(&conn->request_array);
+	aqueue_deinit(&conn->request_queue);
+
+	pool_unref(&conn->pool);
+}
+
 static struct ldap_connection *ldap_conn_find(const char *config_path)
 {
 	struct ldap_connection *conn;
@@ -1787,7 +1895,6 @@ struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 {
 	struct ldap_connection *conn;
 	const char *str, *error;
-	pool_t pool;
 
 	/* see if it already exists */
 	conn = ldap_conn_find(config_path);
@@ -1801,16 +1908,9 @@ struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 	if (*config_path == '\0')
 		i_fatal("LDAP: Configuration file path not given");
 
-	pool = pool_alloconly_create("ldap_connection", 1024);
-	conn = p_new(pool, struct ldap_connection, 1);
-	conn->pool = pool;
-	conn->refcount = 1;
-
+	conn = db_ldap_conn_alloc();
 	conn->userdb_used = userdb;
-	conn->conn_state = LDAP_CONN_STATE_DISCONNECTED;
-	conn->default_bind_msgid = -1;
-	conn->fd = -1;
-	conn->config_path = p_strdup(pool, config_path);
+	conn->config_path = p_strdup(conn->pool, config_path);
 	conn->set = default_ldap_settings;
 	if (!settings_read_nosection(config_path, parse_setting, conn, &error))
 		i_fatal("ldap %s: %s", config_path, error);
@@ -1863,14 +1963,19 @@ struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 		i_fatal("LDAP %s: Unknown deref option '%s'", config_path, conn->set.deref);
 	if (scope2str(conn->set.scope, &conn->set.ldap_scope) < 0)
 		i_fatal("LDAP %s: Unknown scope option '%s'", config_path, conn->set.scope);
-
-	i_array_init(&conn->request_array, 512);
-	conn->request_queue = aqueue_init(&conn->request_array.arr);
+	if (conn->set.connections == 0)
+		i_fatal("LDAP %s: connections must be at least 1", config_path);
+	if (!conn->set.auth_bind && conn->set.auth_bind_connections > 0) {
+		i_warning("LDAP %s: auth_bind_connections is ignored with "
+			  "auth_bind=no", config_path);
+		conn->set.auth_bind_connections = 0;
+	}
 
 	conn->next = ldap_connections;
         ldap_connections = conn;
 
 	db_ldap_init_ld(conn);
+	db_ldap_init_extra_conns(conn);
 	return conn;
 }
 
@@ -1891,15 +1996,18 @@ void db_ldap_unref(struct ldap_connection **_conn)
 		}
 	}
 
-	db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE, "Shutting down");
-	i_assert(conn->pending_count == 0);
-	db_ldap_conn_close(conn);
-	i_assert(conn->to == NULL);
-
-	array_free(&conn->request_array);
-	aqueue_deinit(&conn->request_queue);
+	if (array_is_created(&conn->extra_conns)) {
+		struct ldap_connection **connp;
+		unsigned int i = 1;
 
-	pool_unref(&conn->pool);
+		array_foreach_modifiable(&conn->extra_conns, connp) {
+			db_ldap_conn_log_stats(*connp, i++);
+			db_ldap_conn_free(*connp);
+		}
+		array_free(&conn->extra_conns);
+		db_ldap_conn_log_stats(conn, 0);
+	}
+	db_ldap_conn_free(conn);
 }
 
 #ifndef BUILTIN_LDAP
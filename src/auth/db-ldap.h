@@ -68,6 +68,9 @@ struct ldap_settings {
 	bool userdb_warning_disable; /* deprecated for now at least */
 	bool blocking;
 
+	unsigned int connections;
+	unsigned int auth_bind_connections;
+
 	/* ... */
 	int ldap_deref, ldap_scope, ldap_tls_require_cert_parsed;
 	uid_t uid;
@@ -103,6 +106,8 @@ struct ldap_request {
 	int msgid;
 	/* timestamp when request was created */
 	time_t create_time;
+	/* same with more precision, for the latency statistics */
+	struct timeval create_timeval;
 
 	bool failed;
 
@@ -179,11 +184,29 @@ struct ldap_connection {
 	ARRAY_TYPE(ldap_field) pass_attr_map, user_attr_map, iterate_attr_map;
 	bool userdb_used;
 	bool delayed_connect;
+
+	/* With connections>1 or auth_bind_connections>0 the connection
+	   returned by db_ldap_init() owns the additional connections to the
+	   same server. Requests are sent via the connection that has the
+	   fewest requests in its queue. */
+	struct ldap_connection *primary;
+	ARRAY(struct ldap_connection *) extra_conns;
+	/* This connection is used only for auth binds */
+	bool auth_bind_only;
+
+	/* Number of finished requests and their latencies */
+	unsigned int stats_request_count;
+	unsigned long long stats_total_usecs, stats_max_usecs;
 };
 
 /* Send/queue request */
 void db_ldap_request(struct ldap_connection *conn,
 		     struct ldap_request *request);
+/* Returns the connection where db_ldap_request() would now send a request
+   of the given type. */
+struct ldap_connection *
+db_ldap_get_request_conn(struct ldap_connection *conn,
+			 enum ldap_request_type type);
 
 void db_ldap_set_attrs(struct ldap_connection *conn, const char *attrlist,
 		       char ***attr_names_r, ARRAY_TYPE(ldap_field) *attr_map,
@@ -12,9 +12,14 @@
 #include "istream.h"
 #include "hash.h"
 #include "str.h"
+#include "bits.h"
 #include "eacces-error.h"
+#include "mmap-util.h"
+#include "safe-mkstemp.h"
+#include "write-full.h"
 #include "ioloop.h"
 
+#include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
@@ -23,26 +28,44 @@
 #define PARSE_TIME_STARTUP_WARN_SECS 60
 #define PARSE_TIME_RELOAD_WARN_SECS 10
 
+#define PASSWD_FILE_INDEX_VERSION 1
+
+/* The index is a hash table of the user lines' offsets in the passwd-file,
+   stored in native byte order. It's written next to the passwd-file and
+   shared by all auth processes, so after the passwd-file changes only the
+   first process needs to scan it. */
+struct passwd_file_index_header {
+	uint32_t version;
+	/* always a power of 2 */
+	uint32_t slot_count;
+	uint32_t user_count;
+	uint32_t unused;
+
+	/* the passwd-file this index was built from */
+	uint64_t file_size;
+	uint64_t file_mtime;
+	uint64_t file_ino;
+};
+
+struct passwd_file_index_slot {
+	uint32_t hash;
+	/* offset+1 of the user's line, 0 = empty slot */
+	uint32_t offset;
+};
+
 static struct db_passwd_file *passwd_files;
 
-static void ATTR_NULL(3)
-passwd_file_add(struct passwd_file *pw, const char *username,
-		const char *pass, const char *const *args)
+static struct passwd_user * ATTR_NULL(4)
+passwd_file_parse_user(struct passwd_file *pw, pool_t pool,
+		       const char *username, const char *pass,
+		       const char *const *args)
 {
 	/* args = uid, gid, user info, home dir, shell, extra_fields */
 	struct passwd_user *pu;
 	const char *extra_fields = NULL;
-	char *user;
 	size_t len;
 
-	if (hash_table_lookup(pw->users, username) != NULL) {
-		i_error("passwd-file %s: User %s exists more than once",
-			pw->path, username);
-		return;
-	}
-
-	pu = p_new(pw->pool, struct passwd_user, 1);
-	user = p_strdup(pw->pool, username);
+	pu = p_new(pool, struct passwd_user, 1);
 
 	len = pass == NULL ? 0 : strlen(pass);
 	if (len > 4 && pass[0] != '{' && pass[0] != '$' &&
@@ -54,23 +77,23 @@ passwd_file_add(struct passwd_file *pw, const char *username,
 
 		pass = t_strndup(pass, len-4);
 		if (num == 34) {
-			pu->password = p_strconcat(pw->pool, "{PLAIN-MD5}",
+			pu->password = p_strconcat(pool, "{PLAIN-MD5}",
 						   pass, NULL);
 		} else if (num == 56) {
-			pu->password = p_strconcat(pw->pool, "{DIGEST-MD5}",
+			pu->password = p_strconcat(pool, "{DIGEST-MD5}",
 						   pass, NULL);
 			if (strlen(pu->password) != 32 + 12) {
 				i_error("passwd-file %s: User %s "
 					"has invalid password",
 					pw->path, username);
-				return;
+				return NULL;
 			}
 		} else {
-			pu->password = p_strconcat(pw->pool, "{CRYPT}",
+			pu->password = p_strconcat(pool, "{CRYPT}",
 						   pass, NULL);
 		}
 	} else {
-		pu->password = p_strdup(pw->pool, pass);
+		pu->password = p_strdup(pool, pass);
 	}
 
 	pu->uid = (uid_t)-1;
@@ -85,7 +108,7 @@ passwd_file_add(struct passwd_file *pw, const char *username,
 		if (pu->uid == 0 || pu->uid == (uid_t)-1) {
 			i_error("passwd-file %s: User %s has invalid UID '%s'",
 				pw->path, username, *args);
-			return;
+			return NULL;
 		}
 		args++;
 	}
@@ -105,7 +128,7 @@ passwd_file_add(struct passwd_file *pw, const char *username,
 		if (pu->gid == 0 || pu->gid == (gid_t)-1) {
 			i_error("passwd-file %s: User %s has invalid GID '%s'",
 				pw->path, username, *args);
-			return;
+			return NULL;
 		}
 		args++;
 	}
@@ -117,7 +140,7 @@ passwd_file_add(struct passwd_file *pw, const char *username,
 	/* home */
 	if (*args != NULL) {
 		if (pw->db->userdb)
-			pu->home = p_strdup_empty(pw->pool, *args);
+			pu->home = p_strdup_empty(pool, *args);
 		args++;
 	}
 
@@ -142,10 +165,45 @@ passwd_file_add(struct passwd_file *pw, const char *username,
 
         if (extra_fields != NULL) {
                 pu->extra_fields =
-                        p_strsplit_spaces(pw->pool, extra_fields, " ");
+                        p_strsplit_spaces(pool, extra_fields, " ");
         }
+	return pu;
+}
+
+static struct passwd_user *
+passwd_file_parse_line(struct passwd_file *pw, pool_t pool, const char *line,
+		       const char **username_r)
+{
+	const char *no_args = NULL;
+	const char *const *args = t_strsplit(line, ":");
+
+	*username_r = args[0];
+	if (args[1] != NULL) {
+		/* at least username+password */
+		return passwd_file_parse_user(pw, pool, args[0],
+					      args[1], args+2);
+	} else {
+		/* only username */
+		return passwd_file_parse_user(pw, pool, args[0],
+					      NULL, &no_args);
+	}
+}
+
+static void passwd_file_add(struct passwd_file *pw, const char *line)
+{
+	struct passwd_user *pu;
+	const char *username;
+
+	username = t_strcut(line, ':');
+	if (hash_table_lookup(pw->users, username) != NULL) {
+		i_error("passwd-file %s: User %s exists more than once",
+			pw->path, username);
+		return;
+	}
 
-	hash_table_insert(pw->users, user, pu);
+	pu = passwd_file_parse_line(pw, pw->pool, line, &username);
+	if (pu != NULL)
+		hash_table_insert(pw->users, p_strdup(pw->pool, username), pu);
 }
 
 static struct passwd_file *
@@ -163,15 +221,329 @@ passwd_file_new(struct db_passwd_file *db, const char *expanded_path)
 	return pw;
 }
 
-static int passwd_file_open(struct passwd_file *pw, bool startup,
-			    const char **error_r)
+static const char *passwd_file_index_path(struct passwd_file *pw)
+{
+	return t_strconcat(pw->path, PASSWD_FILE_INDEX_SUFFIX, NULL);
+}
+
+static size_t
+passwd_file_line_username_len(const unsigned char *line, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (line[i] == ':' || line[i] == '\n')
+			break;
+	}
+	/* a CRLF line with only the username. the non-indexed parser's
+	   i_stream_read_next_line() drops the CR too. */
+	if (i > 0 && line[i-1] == '\r' && (i == size || line[i] == '\n'))
+		i--;
+	return i;
+}
+
+/* Returns the slot containing username, or the empty slot where it would be
+   inserted. */
+static unsigned int
+passwd_file_index_find(const struct passwd_file_index_slot *slots,
+		       unsigned int slot_count, const unsigned char *data,
+		       size_t data_size, const unsigned char *username,
+		       size_t username_len, uint32_t hash, bool *found_r)
+{
+	unsigned int idx, mask = slot_count - 1;
+	size_t offset;
+
+	*found_r = FALSE;
+	for (idx = hash & mask; slots[idx].offset != 0; idx = (idx + 1) & mask) {
+		if (slots[idx].hash != hash)
+			continue;
+		/* the index may be from a broken file, check the offset */
+		offset = slots[idx].offset - 1;
+		if (offset >= data_size || data_size - offset < username_len)
+			continue;
+		if (memcmp(data + offset, username, username_len) == 0 &&
+		    passwd_file_line_username_len(data + offset,
+			data_size - offset) == username_len) {
+			*found_r = TRUE;
+			break;
+		}
+	}
+	return idx;
+}
+
+static int
+passwd_file_index_build(struct passwd_file *pw, const struct stat *st,
+			const unsigned char *data, size_t data_size,
+			const char **error_r)
+{
+	struct passwd_file_index_header *hdr;
+	struct passwd_file_index_slot *slots;
+	const unsigned char *line, *end, *p;
+	unsigned int idx, slot_count, line_count = 0;
+	size_t username_len;
+	uint32_t hash;
+	bool found;
+
+	end = data + data_size;
+	for (p = data; p < end; p++) {
+		if (*p == '\n')
+			line_count++;
+	}
+
+	/* use anonymous mmap() for this, so the memory is really given back
+	   when the index is freed */
+	slot_count = nearest_power(I_MAX(line_count + 1, 8) * 2);
+	pw->index_anon_size = sizeof(*hdr) + slot_count * sizeof(*slots);
+	pw->index_anon_base = mmap_anon(pw->index_anon_size);
+	if (pw->index_anon_base == MAP_FAILED) {
+		pw->index_anon_base = NULL;
+		*error_r = t_strdup_printf("mmap_anon(%"PRIuSIZE_T") failed: %m",
+					   pw->index_anon_size);
+		return -1;
+	}
+	hdr = pw->index_anon_base;
+	hdr->version = PASSWD_FILE_INDEX_VERSION;
+	hdr->slot_count = slot_count;
+	hdr->file_size = st->st_size;
+	hdr->file_mtime = st->st_mtime;
+	hdr->file_ino = st->st_ino;
+	slots = (void *)(hdr + 1);
+
+	for (line = data; line < end; line = p + 1) {
+		p = memchr(line, '\n', end - line);
+		if (p == NULL)
+			p = end;
+		if (p == line || *line == ':' || *line == '#')
+			continue; /* no username or comment */
+
+		username_len = passwd_file_line_username_len(line, p - line);
+		if (username_len == 0)
+			continue; /* empty CRLF line */
+		hash = mem_hash(line, username_len);
+		idx = passwd_file_index_find(slots, hdr->slot_count,
+					     data, data_size,
+					     line, username_len, hash, &found);
+		if (found) {
+			i_error("passwd-file %s: User %s exists more than once",
+				pw->path, t_strndup(line, username_len));
+			continue;
+		}
+		slots[idx].hash = hash;
+		slots[idx].offset = (line - data) + 1;
+		hdr->user_count++;
+	}
+	pw->index_hdr = hdr;
+	pw->index_slots = slots;
+	return 0;
+}
+
+static void passwd_file_index_free_anon(struct passwd_file *pw)
+{
+	if (munmap_anon(pw->index_anon_base, pw->index_anon_size) < 0)
+		i_error("passwd-file %s: munmap_anon() failed: %m", pw->path);
+	pw->index_anon_base = NULL;
+}
+
+static bool
+passwd_file_index_open(struct passwd_file *pw, const struct stat *st)
+{
+	const char *index_path = passwd_file_index_path(pw);
+	const struct passwd_file_index_header *hdr;
+	void *base;
+	size_t size;
+	int fd;
+
+	fd = open(index_path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			i_error("open(%s) failed: %m", index_path);
+		return FALSE;
+	}
+	base = mmap_ro_file(fd, &size);
+	if (base == MAP_FAILED) {
+		i_error("mmap(%s) failed: %m", index_path);
+		base = NULL;
+	}
+	if (close(fd) < 0)
+		i_error("close(%s) failed: %m", index_path);
+	if (base == NULL)
+		return FALSE;
+
+	hdr = base;
+	if (size < sizeof(*hdr) ||
+	    hdr->version != PASSWD_FILE_INDEX_VERSION ||
+	    hdr->file_size != (uint64_t)st->st_size ||
+	    hdr->file_mtime != (uint64_t)st->st_mtime ||
+	    hdr->file_ino != (uint64_t)st->st_ino ||
+	    hdr->slot_count == 0 ||
+	    (hdr->slot_count & (hdr->slot_count - 1)) != 0 ||
+	    (size - sizeof(*hdr)) / sizeof(*pw->index_slots) !=
+	    hdr->slot_count) {
+		/* outdated or broken, rebuild */
+		if (munmap(base, size) < 0)
+			i_error("munmap(%s) failed: %m", index_path);
+		return FALSE;
+	}
+	pw->index_mmap_base = base;
+	pw->index_mmap_size = size;
+	pw->index_hdr = hdr;
+	pw->index_slots = (const void *)(hdr + 1);
+	return TRUE;
+}
+
+static int
+passwd_file_index_write(struct passwd_file *pw, const struct stat *st,
+			const char **error_r)
+{
+	const char *index_path = passwd_file_index_path(pw);
+	string_t *temp_path;
+	int fd;
+
+	temp_path = t_str_new(256);
+	str_append(temp_path, index_path);
+	str_append_c(temp_path, '.');
+	fd = safe_mkstemp_hostpid(temp_path, st->st_mode & 0666,
+				  (uid_t)-1, (gid_t)-1);
+	if (fd == -1) {
+		if (errno == EACCES) {
+			*error_r = eacces_error_get_creating("open",
+							     str_c(temp_path));
+		} else {
+			*error_r = t_strdup_printf("safe_mkstemp(%s) failed: %m",
+						   str_c(temp_path));
+		}
+		return -1;
+	}
+	if (write_full(fd, pw->index_anon_base, pw->index_anon_size) < 0) {
+		*error_r = t_strdup_printf("write(%s) failed: %m",
+					   str_c(temp_path));
+		i_close_fd(&fd);
+		i_unlink(str_c(temp_path));
+		return -1;
+	}
+	if (close(fd) < 0) {
+		*error_r = t_strdup_printf("close(%s) failed: %m",
+					   str_c(temp_path));
+		i_unlink(str_c(temp_path));
+		return -1;
+	}
+	/* other auth processes may be writing the same index at the same
+	   time, but that doesn't matter since the contents are the same */
+	if (rename(str_c(temp_path), index_path) < 0) {
+		*error_r = t_strdup_printf("rename(%s, %s) failed: %m",
+					   str_c(temp_path), index_path);
+		i_unlink(str_c(temp_path));
+		return -1;
+	}
+	return 0;
+}
+
+/* Read the whole passwd-file into anonymous memory. The file isn't mmap()ed,
+   because it could then be truncated under us, causing SIGBUS. */
+static int
+passwd_file_read_all(struct passwd_file *pw, const struct stat *st,
+		     void **data_r, size_t *size_r, size_t *alloc_size_r,
+		     const char **error_r)
+{
+	unsigned char *data;
+	size_t size = 0, alloc_size = I_MAX(st->st_size, 1);
+	ssize_t ret;
+
+	data = mmap_anon(alloc_size);
+	if (data == MAP_FAILED) {
+		*error_r = t_strdup_printf("mmap_anon(%"PRIuSIZE_T") failed: %m",
+					   alloc_size);
+		return -1;
+	}
+	/* if the file shrank meanwhile, index only what we got. the changed
+	   mtime/size causes the index to be rebuilt on the next sync. */
+	while (size < (size_t)st->st_size) {
+		ret = pread(pw->fd, data + size, st->st_size - size, size);
+		if (ret < 0) {
+			*error_r = t_strdup_printf("pread(%s) failed: %m",
+						   pw->path);
+			(void)munmap_anon(data, alloc_size);
+			return -1;
+		}
+		if (ret == 0)
+			break;
+		size += ret;
+	}
+	*data_r = data;
+	*size_r = size;
+	*alloc_size_r = alloc_size;
+	return 0;
+}
+
+static int passwd_file_open_index(struct passwd_file *pw, const struct stat *st,
+				  const char **error_r)
+{
+	const char *error;
+	void *data;
+	size_t data_size, alloc_size;
+	int ret;
+
+	if ((uoff_t)st->st_size >= (uint32_t)-1) {
+		*error_r = t_strdup_printf(
+			"passwd-file %s: File too large for index", pw->path);
+		return -1;
+	}
+	pw->lookup_pool = pool_alloconly_create("passwd_file lookup", 1024);
+
+	if (passwd_file_index_open(pw, st))
+		return 0;
+
+	if (passwd_file_read_all(pw, st, &data, &data_size, &alloc_size,
+				 error_r) < 0)
+		return -1;
+	ret = passwd_file_index_build(pw, st, data, data_size, error_r);
+	if (munmap_anon(data, alloc_size) < 0)
+		i_error("passwd-file %s: munmap_anon() failed: %m", pw->path);
+	if (ret < 0)
+		return -1;
+	if (passwd_file_index_write(pw, st, &error) < 0) {
+		/* the directory is often writable only by root. keep
+		   using a private in-memory index, and complain only once. */
+		if (!pw->index_write_failed) {
+			i_warning("passwd-file %s: Couldn't write index, "
+				  "keeping it only in memory: %s",
+				  pw->path, error);
+			pw->index_write_failed = TRUE;
+		}
+	} else if (passwd_file_index_open(pw, st)) {
+		/* switched to the shared mmap */
+		passwd_file_index_free_anon(pw);
+	}
+	return 0;
+}
+
+static void passwd_file_read(struct passwd_file *pw)
 {
-	const char *no_args = NULL;
 	struct istream *input;
 	const char *line;
+
+	pw->pool = pool_alloconly_create(MEMPOOL_GROWING"passwd_file", 10240);
+	hash_table_create(&pw->users, pw->pool, 0, str_hash, strcmp);
+
+	input = i_stream_create_fd(pw->fd, (size_t)-1, FALSE);
+	i_stream_set_return_partial_line(input, TRUE);
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		if (*line == '\0' || *line == ':' || *line == '#')
+			continue; /* no username or comment */
+
+		T_BEGIN {
+			passwd_file_add(pw, line);
+		} T_END;
+	}
+	i_stream_destroy(&input);
+}
+
+static int passwd_file_open(struct passwd_file *pw, bool startup,
+			    const char **error_r)
+{
 	struct stat st;
 	time_t start_time, end_time;
-	unsigned int time_secs;
+	unsigned int time_secs, user_count;
 	int fd;
 
 	fd = open(pw->path, O_RDONLY);
@@ -196,42 +568,34 @@ static int passwd_file_open(struct passwd_file *pw, bool startup,
 	pw->stamp = st.st_mtime;
 	pw->size = st.st_size;
 
-	pw->pool = pool_alloconly_create(MEMPOOL_GROWING"passwd_file", 10240);
-	hash_table_create(&pw->users, pw->pool, 0, str_hash, strcmp);
-
 	start_time = time(NULL);
-	input = i_stream_create_fd(pw->fd, (size_t)-1, FALSE);
-	i_stream_set_return_partial_line(input, TRUE);
-	while ((line = i_stream_read_next_line(input)) != NULL) {
-		if (*line == '\0' || *line == ':' || *line == '#')
-			continue; /* no username or comment */
-
-		T_BEGIN {
-			const char *const *args = t_strsplit(line, ":");
-			if (args[1] != NULL) {
-				/* at least username+password */
-				passwd_file_add(pw, args[0], args[1], args+2);
-			} else {
-				/* only username */
-				passwd_file_add(pw, args[0], NULL, &no_args);
-			}
-		} T_END;
+	if (!pw->db->use_index) {
+		passwd_file_read(pw);
+		user_count = hash_table_count(pw->users);
+	} else {
+		if (passwd_file_open_index(pw, &st, error_r) < 0)
+			return -1;
+		user_count = pw->index_hdr->user_count;
 	}
-	i_stream_destroy(&input);
 	end_time = time(NULL);
 	time_secs = end_time - start_time;
 
 	if ((time_secs > PARSE_TIME_STARTUP_WARN_SECS && startup) ||
 	    (time_secs > PARSE_TIME_RELOAD_WARN_SECS && !startup)) {
 		i_warning("passwd-file %s: Reading %u users took %u secs",
-			  pw->path, hash_table_count(pw->users), time_secs);
+			  pw->path, user_count, time_secs);
 	} else if (pw->db->debug) {
 		i_debug("passwd-file %s: Read %u users in %u secs",
-			pw->path, hash_table_count(pw->users), time_secs);
+			pw->path, user_count, time_secs);
 	}
 	return 0;
 }
 
+static bool passwd_file_is_open(struct passwd_file *pw)
+{
+	return hash_table_is_created(pw->users) || pw->index_hdr != NULL;
+}
+
 static void passwd_file_close(struct passwd_file *pw)
 {
 	if (pw->fd != -1) {
@@ -244,6 +608,108 @@ static void passwd_file_close(struct passwd_file *pw)
 		hash_table_destroy(&pw->users);
 	if (pw->pool != NULL)
 		pool_unref(&pw->pool);
+
+	if (pw->index_mmap_base != NULL) {
+		if (munmap(pw->index_mmap_base, pw->index_mmap_size) < 0) {
+			i_error("passwd-file %s: munmap(index) failed: %m",
+				pw->path);
+		}
+		pw->index_mmap_base = NULL;
+	}
+	if (pw->index_anon_base != NULL)
+		passwd_file_index_free_anon(pw);
+	pw->index_hdr = NULL;
+	pw->index_slots = NULL;
+	if (pw->lookup_pool != NULL)
+		pool_unref(&pw->lookup_pool);
+}
+
+/* Read the line starting at offset. The file may have been modified after
+   the index was built, so the caller must verify the contents. */
+static int
+passwd_file_pread_line(struct passwd_file *pw, uoff_t offset, string_t *line)
+{
+	unsigned char buf[1024];
+	const unsigned char *p;
+	ssize_t ret;
+
+	str_truncate(line, 0);
+	for (;;) {
+		ret = pread(pw->fd, buf, sizeof(buf), offset);
+		if (ret < 0) {
+			i_error("passwd-file %s: pread() failed: %m", pw->path);
+			return -1;
+		}
+		if (ret == 0)
+			break;
+		p = memchr(buf, '\n', ret);
+		if (p != NULL) {
+			buffer_append(line, buf, p - buf);
+			break;
+		}
+		buffer_append(line, buf, ret);
+		offset += ret;
+	}
+	if (str_len(line) > 0 && str_data(line)[str_len(line)-1] == '\r')
+		str_truncate(line, str_len(line)-1);
+	return 0;
+}
+
+/* Returns 1 and the user if found, 0 if not found and -1 if the index is
+   corrupted. */
+static int
+passwd_file_index_lookup(struct passwd_file *pw, const char *username,
+			 struct passwd_user **pu_r)
+{
+	const struct passwd_file_index_slot *slots = pw->index_slots;
+	const char *line_username;
+	size_t username_len = strlen(username);
+	unsigned int i, idx, slot_count = pw->index_hdr->slot_count;
+	uint32_t hash = mem_hash(username, username_len);
+	string_t *line;
+
+	*pu_r = NULL;
+	line = t_str_new(256);
+	idx = hash & (slot_count - 1);
+	for (i = 0; i < slot_count; i++, idx = (idx + 1) & (slot_count - 1)) {
+		if (slots[idx].offset == 0)
+			return 0;
+		if (slots[idx].hash != hash)
+			continue;
+		if (passwd_file_pread_line(pw, slots[idx].offset - 1, line) < 0)
+			return 0;
+		if (str_len(line) >= username_len &&
+		    memcmp(str_data(line), username, username_len) == 0 &&
+		    passwd_file_line_username_len(str_data(line),
+			str_len(line)) == username_len) {
+			p_clear(pw->lookup_pool);
+			*pu_r = passwd_file_parse_line(pw, pw->lookup_pool,
+						       str_c(line),
+						       &line_username);
+			return *pu_r == NULL ? 0 : 1;
+		}
+	}
+	/* the index that we build always has empty slots */
+	return -1;
+}
+
+static int
+passwd_file_index_rebuild(struct auth_request *request, struct passwd_file *pw)
+{
+	const char *index_path = passwd_file_index_path(pw);
+	const char *error;
+
+	auth_request_log_error(request, AUTH_SUBSYS_DB,
+		"Index %s is corrupted (no empty slots), rebuilding it",
+		index_path);
+	/* passwd_file_open() would just map the same file again */
+	i_unlink_if_exists(index_path);
+	passwd_file_close(pw);
+	if (passwd_file_open(pw, FALSE, &error) < 0) {
+		auth_request_log_error(request, AUTH_SUBSYS_DB, "%s", error);
+		return -1;
+	}
+	return 0;
 }
 
 static void passwd_file_free(struct passwd_file *pw)
@@ -263,7 +729,7 @@ static int passwd_file_sync(struct auth_request *request,
 	const char *error;
 
 	if (pw->last_sync_time == ioloop_time)
-		return hash_table_is_created(pw->users) ? 0 : -1;
+		return passwd_file_is_open(pw) ? 0 : -1;
 	pw->last_sync_time = ioloop_time;
 
 	if (stat(pw->path, &st) < 0) {
@@ -282,7 +748,8 @@ static int passwd_file_sync(struct auth_request *request,
 		return -1;
 	}
 
-	if (st.st_mtime != pw->stamp || st.st_size != pw->size) {
+	if (st.st_mtime != pw->stamp || st.st_size != pw->size ||
+	    !passwd_file_is_open(pw)) {
 		passwd_file_close(pw);
 		if (passwd_file_open(pw, FALSE, &error) < 0) {
 			auth_request_log_error(request, AUTH_SUBSYS_DB,
@@ -316,7 +783,7 @@ static void db_passwd_file_set_userdb(struct db_passwd_file *db)
 }
 
 struct db_passwd_file *
-db_passwd_file_init(const char *path, bool userdb, bool debug)
+db_passwd_file_init(const char *path, bool userdb, bool use_index, bool debug)
 {
 	struct db_passwd_file *db;
 	const char *p;
@@ -327,6 +794,8 @@ db_passwd_file_init(const char *path, bool userdb, bool debug)
 		db->refcount++;
 		if (userdb)
 			db_passwd_file_set_userdb(db);
+		if (use_index)
+			db->use_index = TRUE;
 		return db;
 	}
 
@@ -334,6 +803,7 @@ db_passwd_file_init(const char *path, bool userdb, bool debug)
 	db->refcount = 1;
 	if (userdb)
 		db_passwd_file_set_userdb(db);
+	db->use_index = use_index;
 	db->debug = debug;
 
 	for (p = path; *p != '\0'; p++) {
@@ -462,7 +932,13 @@ db_passwd_file_lookup(struct db_passwd_file *db, struct auth_request *request,
 			       "lookup: user=%s file=%s",
 			       str_c(username), pw->path);
 
-	pu = hash_table_lookup(pw->users, str_c(username));
+	if (pw->index_hdr == NULL)
+		pu = hash_table_lookup(pw->users, str_c(username));
+	else if (passwd_file_index_lookup(pw, str_c(username), &pu) < 0) {
+		if (passwd_file_index_rebuild(request, pw) < 0 ||
+		    passwd_file_index_lookup(pw, str_c(username), &pu) < 0)
+			pu = NULL;
+	}
 	if (pu == NULL)
                 auth_request_log_unknown_user(request, AUTH_SUBSYS_DB);
 	return pu;
@@ -5,6 +5,7 @@
 
 #define PASSWD_FILE_DEFAULT_USERNAME_FORMAT "%u"
 #define PASSWD_FILE_DEFAULT_SCHEME "CRYPT"
+#define PASSWD_FILE_INDEX_SUFFIX ".index"
 
 struct passwd_user {
 	uid_t uid;
@@ -27,6 +28,20 @@ struct passwd_file {
 	int fd;
 
 	HASH_TABLE(char *, struct passwd_user *) users;
+
+	/* with index=yes users are looked up via the index and their lines
+	   are read from fd instead of being parsed into the users hash */
+	const struct passwd_file_index_header *index_hdr;
+	const struct passwd_file_index_slot *index_slots;
+	void *index_mmap_base;
+	size_t index_mmap_size;
+	/* index that couldn't be written to disk */
+	void *index_anon_base;
+	size_t index_anon_size;
+	/* the returned passwd_user is allocated from here */
+	pool_t lookup_pool;
+
+	unsigned int index_write_failed:1;
 };
 
 struct db_passwd_file {
@@ -40,16 +55,18 @@ struct db_passwd_file {
 
 	unsigned int vars:1;
 	unsigned int userdb:1;
+	unsigned int use_index:1;
 	unsigned int userdb_warn_missing:1;
 	unsigned int debug:1;
 };
 
+/* With index=yes the returned user is valid only until the next lookup. */
 struct passwd_user *
 db_passwd_file_lookup(struct db_passwd_file *db, struct auth_request *request,
 		      const char *username_format);
 
 struct db_passwd_file *
-db_passwd_file_init(const char *path, bool userdb, bool debug);
+db_passwd_file_init(const char *path, bool userdb, bool use_index, bool debug);
 void db_passwd_file_parse(struct db_passwd_file *db);
 void db_passwd_file_unref(struct db_passwd_file **db);
 
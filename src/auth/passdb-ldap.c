@@ -379,10 +379,15 @@ ldap_verify_plain(struct auth_request *request,
 		(struct ldap_passdb_module *)_module;
 	struct ldap_connection *conn = module->conn;
 	struct passdb_ldap_request *ldap_request;
+	enum ldap_request_type type;
 
 	/* reconnect if needed. this is also done by db_ldap_search(), but
-	   with auth binds we'll have to do it ourself */
-	if (db_ldap_connect(conn)< 0) {
+	   with auth binds we'll have to do it ourself. connect the
+	   connection that gets the first request, which may be one of the
+	   auth bind connections. */
+	type = conn->set.auth_bind && conn->set.auth_bind_userdn != NULL ?
+		LDAP_REQUEST_TYPE_BIND : LDAP_REQUEST_TYPE_SEARCH;
+	if (db_ldap_connect(db_ldap_get_request_conn(conn, type)) < 0) {
 		callback(PASSDB_RESULT_INTERNAL_FAILURE, request);
 		return;
 	}
@@ -114,6 +114,7 @@ passwd_file_preinit(pool_t pool, const char *args)
 	const char *scheme = PASSWD_FILE_DEFAULT_SCHEME;
 	const char *format = PASSWD_FILE_DEFAULT_USERNAME_FORMAT;
 	const char *key, *value;
+	bool use_index = FALSE;
 
 	while (*args != '\0') {
 		if (*args == '/')
@@ -139,6 +140,8 @@ passwd_file_preinit(pool_t pool, const char *args)
 			scheme = p_strdup(pool, value);
 		else if (strcmp(key, "username_format") == 0)
 			format = p_strdup(pool, value);
+		else if (strcmp(key, "index") == 0)
+			use_index = strcmp(value, "yes") == 0;
 		else
 			i_fatal("passdb passwd-file: Unknown setting: %s", key);
 	}
@@ -147,7 +150,7 @@ passwd_file_preinit(pool_t pool, const char *args)
 		i_fatal("passdb passwd-file: Missing args");
 
 	module = p_new(pool, struct passwd_file_passdb_module, 1);
-	module->pwf = db_passwd_file_init(args, FALSE,
+	module->pwf = db_passwd_file_init(args, FALSE, use_index,
 					  global_auth_settings->debug);
 	module->username_format = format;
 	module->module.default_pass_scheme = scheme;
@@ -0,0 +1,125 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "aqueue.h"
+#include "db-ldap.h"
+#include "test-common.h"
+
+#define TEST_LOOKUP_CONN_COUNT 3
+#define TEST_AUTH_BIND_CONN_COUNT 2
+
+static struct ldap_connection test_conns[TEST_LOOKUP_CONN_COUNT +
+					 TEST_AUTH_BIND_CONN_COUNT];
+static struct ldap_request test_request;
+
+static void test_conns_init(unsigned int auth_bind_count)
+{
+	struct ldap_connection *conn, *primary = &test_conns[0];
+	unsigned int i;
+
+	memset(test_conns, 0, sizeof(test_conns));
+	primary->set.connections = TEST_LOOKUP_CONN_COUNT;
+	primary->set.auth_bind_connections = auth_bind_count;
+	i_array_init(&primary->extra_conns, N_ELEMENTS(test_conns));
+	for (i = 0; i < TEST_LOOKUP_CONN_COUNT + auth_bind_count; i++) {
+		conn = &test_conns[i];
+		i_array_init(&conn->request_array, 8);
+		conn->request_queue = aqueue_init(&conn->request_array.arr);
+		if (i == 0)
+			continue;
+
+		conn->set = primary->set;
+		conn->primary = primary;
+		conn->auth_bind_only = i >= TEST_LOOKUP_CONN_COUNT;
+		array_append(&primary->extra_conns, &conn, 1);
+	}
+}
+
+static void test_conns_deinit(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(test_conns); i++) {
+		if (test_conns[i].request_queue == NULL)
+			continue;
+		aqueue_deinit(&test_conns[i].request_queue);
+		array_free(&test_conns[i].request_array);
+	}
+	array_free(&test_conns[0].extra_conns);
+}
+
+static void test_conn_add_requests(unsigned int idx, unsigned int count)
+{
+	struct ldap_request *request = &test_request;
+
+	for (; count > 0; count--)
+		aqueue_append(test_conns[idx].request_queue, &request);
+}
+
+static unsigned int
+test_get_request_conn(unsigned int idx, enum ldap_request_type type)
+{
+	struct ldap_connection *conn;
+
+	conn = db_ldap_get_request_conn(&test_conns[idx], type);
+	return conn - test_conns;
+}
+
+static void test_db_ldap_request_conn_auth_bind(void)
+{
+	unsigned int i;
+
+	test_begin("db ldap request conn with auth bind connections");
+	test_conns_init(TEST_AUTH_BIND_CONN_COUNT);
+
+	/* idle connections: the primary connection is preferred */
+	test_assert(test_get_request_conn(0, LDAP_REQUEST_TYPE_SEARCH) == 0);
+	test_assert(test_get_request_conn(0, LDAP_REQUEST_TYPE_BIND) ==
+		    TEST_LOOKUP_CONN_COUNT);
+
+	/* binds never go to the lookup connections, and searches never go
+	   to the auth bind connections, no matter how busy they are */
+	test_conn_add_requests(0, 5);
+	test_conn_add_requests(1, 3);
+	test_conn_add_requests(2, 4);
+	test_conn_add_requests(3, 10);
+	test_conn_add_requests(4, 9);
+	for (i = 0; i < N_ELEMENTS(test_conns); i++) {
+		test_assert_idx(test_get_request_conn(i, LDAP_REQUEST_TYPE_SEARCH) == 1, i);
+		test_assert_idx(test_get_request_conn(i, LDAP_REQUEST_TYPE_BIND) == 4, i);
+	}
+
+	test_conns_deinit();
+	test_end();
+}
+
+static void test_db_ldap_request_conn_shared(void)
+{
+	unsigned int i;
+
+	test_begin("db ldap request conn without auth bind connections");
+	test_conns_init(0);
+
+	/* binds and searches share the same connections */
+	test_conn_add_requests(0, 2);
+	test_conn_add_requests(1, 1);
+	test_conn_add_requests(2, 3);
+	for (i = 0; i < TEST_LOOKUP_CONN_COUNT; i++) {
+		test_assert_idx(test_get_request_conn(i, LDAP_REQUEST_TYPE_SEARCH) == 1, i);
+		test_assert_idx(test_get_request_conn(i, LDAP_REQUEST_TYPE_BIND) == 1, i);
+	}
+
+	test_conns_deinit();
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_db_ldap_request_conn_auth_bind,
+		test_db_ldap_request_conn_shared,
+		NULL
+	};
+	return test_run(test_functions);
+}
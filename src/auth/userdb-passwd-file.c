@@ -169,16 +169,32 @@ passwd_file_preinit(pool_t pool, const char *args)
 	struct passwd_file_userdb_module *module;
 	const char *format = PASSWD_FILE_DEFAULT_USERNAME_FORMAT;
 	const char *p;
-
-	if (strncmp(args, "username_format=", 16) == 0) {
-		args += 16;
-		p = strchr(args, ' ');
-		if (p == NULL) {
-			format = p_strdup(pool, args);
-			args = "";
+	bool use_index = FALSE;
+
+	for (;;) {
+		if (strncmp(args, "username_format=", 16) == 0) {
+			args += 16;
+			p = strchr(args, ' ');
+			if (p == NULL) {
+				format = p_strdup(pool, args);
+				args = "";
+			} else {
+				format = p_strdup_until(pool, args, p);
+				args = p + 1;
+			}
+		} else if (strncmp(args, "index=", 6) == 0) {
+			args += 6;
+			p = strchr(args, ' ');
+			if (p == NULL) {
+				use_index = strcmp(args, "yes") == 0;
+				args = "";
+			} else {
+				use_index = strcmp(t_strdup_until(args, p),
+						   "yes") == 0;
+				args = p + 1;
+			}
 		} else {
-			format = p_strdup_until(pool, args, p);
-			args = p + 1;
+			break;
 		}
 	}
 
@@ -186,7 +202,7 @@ passwd_file_preinit(pool_t pool, const char *args)
 		i_fatal("userdb passwd-file: Missing args");
 
 	module = p_new(pool, struct passwd_file_userdb_module, 1);
-	module->pwf = db_passwd_file_init(args, TRUE,
+	module->pwf = db_passwd_file_init(args, TRUE, use_index,
 					  global_auth_settings->debug);
 	module->username_format = format;
 	return &module->module;
@@ -2,70 +2,348 @@
 
 #include "lib.h"
 #include "ioloop.h"
+#include "llist.h"
+#include "hash.h"
+#include "str.h"
 #include "istream.h"
 #include "ostream.h"
+#include "time-util.h"
+#include "process-title.h"
+#include "thread-pool.h"
 #include "restrict-access.h"
 #include "master-service.h"
+#include "master-service-settings.h"
 
 #include <unistd.h>
+#include <netdb.h>
+#ifdef HAVE_MALLOC_H
+#  include <malloc.h>
+#endif
+
+/* Lookups are resolved in parallel threads, but the replies are still sent
+   in the order the requests arrived, because that's what the protocol
+   requires. */
+struct dns_request {
+	struct dns_request *prev, *next;
+	/* NULL if the client was already destroyed */
+	struct dns_client *client;
+
+	/* the request line, also used as the cache key */
+	char *line;
+	/* reply to send, NULL while the lookup is still running */
+	char *reply;
+	struct timeval start_time;
+
+	/* accessed by the worker thread: */
+	bool ptr_lookup;
+	char *host;
+	struct addrinfo *ai;
+	char name[NI_MAXHOST];
+	int ret;
+};
 
 struct dns_client {
 	int fd;
 	struct istream *input;
 	struct ostream *output;
 	struct io *io;
+
+	struct dns_request *requests_head, *requests_tail;
+	unsigned int requests_count;
+};
+
+struct dns_cache_entry {
+	/* sorted by insertion time */
+	struct dns_cache_entry *prev, *next;
+
+	char *line;
+	char *reply;
+	time_t expire_time;
 };
 
 #define MAX_INBUF_SIZE 1024
 #define MAX_OUTBUF_SIZE (1024*64)
 #define INPUT_TIMEOUT_MSECS (1000*10)
 
+/* Max number of lookups done in parallel */
+#define DNS_MAX_THREADS 8
+/* Stop reading input when this many requests are unanswered */
+#define DNS_CLIENT_MAX_PENDING_REQUESTS 64
+
+/* getaddrinfo() doesn't tell us the TTLs, so use fixed ones that are small
+   enough not to hide DNS changes for long. Only successful lookups and
+   "host not found" errors are cached. */
+#define DNS_CACHE_POSITIVE_TTL_SECS 60
+#define DNS_CACHE_NEGATIVE_TTL_SECS 10
+#define DNS_CACHE_MAX_ENTRIES 1024
+
 static struct dns_client *dns_client = NULL;
+static struct thread_pool *dns_threads;
+static bool verbose_proctitle = FALSE;
+
+static HASH_TABLE(char *, struct dns_cache_entry *) dns_cache;
+static struct dns_cache_entry *dns_cache_head, *dns_cache_tail;
+static unsigned int dns_cache_count;
+
+static unsigned int stats_lookups, stats_cache_hits;
+static unsigned long long stats_lookup_msecs;
 
 static void dns_client_destroy(struct dns_client **client);
+static void dns_client_input(struct dns_client *client);
 
-static int dns_client_input_line(struct dns_client *client, const char *line)
+static void dns_refresh_proctitle(void)
 {
-	struct ip_addr *ips, ip;
-	const char *name;
-	unsigned int i, ips_count;
-	int ret;
+	unsigned int resolved;
 
-	if (strncmp(line, "IP\t", 3) == 0) {
-		ret = net_gethostbyname(line + 3, &ips, &ips_count);
-		if (ret == 0 && ips_count == 0) {
-			/* shouldn't happen, but fix it anyway.. */
-			ret = EAI_NONAME;
+	if (!verbose_proctitle)
+		return;
+
+	resolved = stats_lookups - stats_cache_hits;
+	process_title_set(t_strdup_printf(
+		"[%u lookups, %u%% cache hits, %llu ms avg, %u running]",
+		stats_lookups,
+		stats_lookups == 0 ? 0 : stats_cache_hits * 100 / stats_lookups,
+		resolved == 0 ? 0ULL : stats_lookup_msecs / resolved,
+		thread_pool_get_pending_count(dns_threads)));
+}
+
+static void dns_cache_entry_free(struct dns_cache_entry *entry)
+{
+	hash_table_remove(dns_cache, entry->line);
+	DLLIST2_REMOVE(&dns_cache_head, &dns_cache_tail, entry);
+	dns_cache_count--;
+
+	i_free(entry->line);
+	i_free(entry->reply);
+	i_free(entry);
+}
+
+static const char *dns_cache_lookup(const char *line)
+{
+	struct dns_cache_entry *entry;
+
+	entry = hash_table_lookup(dns_cache, line);
+	if (entry == NULL)
+		return NULL;
+	if (entry->expire_time <= ioloop_time) {
+		dns_cache_entry_free(entry);
+		return NULL;
+	}
+	return entry->reply;
+}
+
+static void dns_cache_add(const char *line, const char *reply, int ret)
+{
+	struct dns_cache_entry *entry;
+	unsigned int ttl_secs;
+
+	if (ret == 0)
+		ttl_secs = DNS_CACHE_POSITIVE_TTL_SECS;
+	else if (ret == EAI_NONAME)
+		ttl_secs = DNS_CACHE_NEGATIVE_TTL_SECS;
+	else {
+		/* temporary failure */
+		return;
+	}
+
+	entry = hash_table_lookup(dns_cache, line);
+	if (entry != NULL) {
+		/* parallel lookups for the same name */
+		dns_cache_entry_free(entry);
+	} else if (dns_cache_count >= DNS_CACHE_MAX_ENTRIES) {
+		dns_cache_entry_free(dns_cache_head);
+	}
+
+	entry = i_new(struct dns_cache_entry, 1);
+	entry->line = i_strdup(line);
+	entry->reply = i_strdup(reply);
+	entry->expire_time = ioloop_time + ttl_secs;
+	hash_table_insert(dns_cache, entry->line, entry);
+	DLLIST2_APPEND(&dns_cache_head, &dns_cache_tail, entry);
+	dns_cache_count++;
+}
+
+static void dns_cache_deinit(void)
+{
+	while (dns_cache_head != NULL)
+		dns_cache_entry_free(dns_cache_head);
+	hash_table_destroy(&dns_cache);
+}
+
+static void dns_request_free(struct dns_request *request)
+{
+	if (request->ai != NULL)
+		freeaddrinfo(request->ai);
+	i_free(request->line);
+	i_free(request->reply);
+	i_free(request->host);
+	i_free(request);
+}
+
+static void dns_request_lookup(struct dns_request *request)
+{
+	struct addrinfo hints;
+
+	/* NOTE: this is called in a worker thread */
+	memset(&hints, 0, sizeof(hints));
+	if (request->ptr_lookup) {
+		/* host is a valid IP address, so this doesn't block */
+		hints.ai_flags = AI_NUMERICHOST;
+		request->ret = getaddrinfo(request->host, NULL,
+					   &hints, &request->ai);
+		if (request->ret == 0) {
+			request->ret = getnameinfo(request->ai->ai_addr,
+				request->ai->ai_addrlen,
+				request->name, sizeof(request->name),
+				NULL, 0, NI_NAMEREQD);
 		}
-		if (ret != 0) {
-			o_stream_nsend_str(client->output,
-				t_strdup_printf("%d\n", ret));
-		} else {
-			o_stream_nsend_str(client->output,
-				t_strdup_printf("0 %u\n", ips_count));
-			for (i = 0; i < ips_count; i++) {
-				o_stream_nsend_str(client->output, t_strconcat(
-					net_ip2addr(&ips[i]), "\n", NULL));
-			}
+	} else {
+		hints.ai_socktype = SOCK_STREAM;
+		request->ret = getaddrinfo(request->host, NULL,
+					   &hints, &request->ai);
+	}
+}
+
+static const char *dns_request_get_reply(struct dns_request *request)
+{
+	struct addrinfo *ai;
+	string_t *str;
+	char addr[NI_MAXHOST];
+	unsigned int count = 0;
+
+	if (request->ret == 0 && request->ptr_lookup)
+		return t_strdup_printf("0 %s\n", request->name);
+	if (request->ret != 0)
+		return t_strdup_printf("%d\n", request->ret);
+
+	str = t_str_new(128);
+	for (ai = request->ai; ai != NULL; ai = ai->ai_next) {
+		if (getnameinfo(ai->ai_addr, ai->ai_addrlen,
+				addr, sizeof(addr), NULL, 0,
+				NI_NUMERICHOST) != 0)
+			continue;
+		str_printfa(str, "%s\n", addr);
+		count++;
+	}
+	if (count == 0) {
+		/* shouldn't happen, but fix it anyway.. */
+		request->ret = EAI_NONAME;
+		return t_strdup_printf("%d\n", request->ret);
+	}
+	str_insert(str, 0, t_strdup_printf("0 %u\n", count));
+	return str_c(str);
+}
+
+static void dns_client_send_replies(struct dns_client *client)
+{
+	struct dns_request *request;
+	bool paused;
+
+	paused = client->io == NULL;
+	o_stream_cork(client->output);
+	while ((request = client->requests_head) != NULL &&
+	       request->reply != NULL) {
+		o_stream_nsend_str(client->output, request->reply);
+		DLLIST2_REMOVE(&client->requests_head, &client->requests_tail,
+			       request);
+		client->requests_count--;
+		dns_request_free(request);
+	}
+	o_stream_uncork(client->output);
+
+	if (client->output->overflow) {
+		dns_client_destroy(&client);
+		return;
+	}
+	if (paused &&
+	    client->requests_count < DNS_CLIENT_MAX_PENDING_REQUESTS) {
+		/* continue reading the already buffered input */
+		client->io = io_add(client->fd, IO_READ,
+				    dns_client_input, client);
+		io_set_pending(client->io);
+	}
+}
+
+static void dns_request_done(struct dns_request *request)
+{
+	struct timeval now;
+	const char *reply;
+
+	if (gettimeofday(&now, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	stats_lookup_msecs += timeval_diff_msecs(&now, &request->start_time);
+
+	T_BEGIN {
+		reply = dns_request_get_reply(request);
+		dns_cache_add(request->line, reply, request->ret);
+		request->reply = i_strdup(reply);
+	} T_END;
+	dns_refresh_proctitle();
+
+	if (request->client == NULL) {
+		/* client already disconnected */
+		dns_request_free(request);
+	} else {
+		dns_client_send_replies(request->client);
+	}
+}
+
+static bool
+dns_client_request_init(struct dns_request *request, const char *line)
+{
+	struct ip_addr ip;
+	const char *reply;
+
+	request->line = i_strdup(line);
+	if (strncmp(line, "IP\t", 3) == 0) {
+		/* support [ipv6] style addresses here so they work
+		   globally */
+		if (line[3] == '[' && net_addr2ip(line + 3, &ip) == 0) {
+			request->reply = i_strdup_printf("0 1\n%s\n",
+							 net_ip2addr(&ip));
+			return TRUE;
 		}
+		request->host = i_strdup(line + 3);
 	} else if (strncmp(line, "NAME\t", 5) == 0) {
-		if (net_addr2ip(line+5, &ip) < 0)
-			o_stream_nsend_str(client->output, "-1\n");
-		else if ((ret = net_gethostbyaddr(&ip, &name)) != 0) {
-			o_stream_nsend_str(client->output,
-				t_strdup_printf("%d\n", ret));
-		} else {
-			o_stream_nsend_str(client->output,
-				t_strdup_printf("0 %s\n", name));
+		if (net_addr2ip(line+5, &ip) < 0) {
+			request->reply = i_strdup("-1\n");
+			return TRUE;
 		}
-	} else if (strcmp(line, "QUIT") == 0) {
-		return -1;
+		request->ptr_lookup = TRUE;
+		request->host = i_strdup(net_ip2addr(&ip));
 	} else {
-		o_stream_nsend_str(client->output, "Unknown command\n");
+		request->reply = i_strdup("Unknown command\n");
+		return TRUE;
 	}
 
-	if (client->output->overflow)
+	stats_lookups++;
+	if ((reply = dns_cache_lookup(line)) != NULL) {
+		stats_cache_hits++;
+		request->reply = i_strdup(reply);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+static int dns_client_input_line(struct dns_client *client, const char *line)
+{
+	struct dns_request *request;
+
+	if (strcmp(line, "QUIT") == 0)
 		return -1;
+
+	request = i_new(struct dns_request, 1);
+	request->client = client;
+	DLLIST2_APPEND(&client->requests_head, &client->requests_tail,
+		       request);
+	client->requests_count++;
+
+	if (!dns_client_request_init(request, line)) {
+		if (gettimeofday(&request->start_time, NULL) < 0)
+			i_fatal("gettimeofday() failed: %m");
+		thread_pool_add_job(dns_threads, dns_request_lookup,
+				    dns_request_done, request);
+	}
 	return 0;
 }
 
@@ -74,17 +352,25 @@ static void dns_client_input(struct dns_client *client)
 	const char *line;
 	int ret = 0;
 
-	o_stream_cork(client->output);
-	while ((line = i_stream_read_next_line(client->input)) != NULL) {
+	while (client->requests_count < DNS_CLIENT_MAX_PENDING_REQUESTS) {
+		if ((line = i_stream_read_next_line(client->input)) == NULL)
+			break;
 		if (dns_client_input_line(client, line) < 0) {
 			ret = -1;
 			break;
 		}
 	}
-	o_stream_uncork(client->output);
 
-	if (client->input->eof || client->input->stream_errno != 0 || ret < 0)
+	if (client->input->eof || client->input->stream_errno != 0 || ret < 0) {
 		dns_client_destroy(&client);
+		return;
+	}
+	if (client->requests_count >= DNS_CLIENT_MAX_PENDING_REQUESTS) {
+		/* wait for the lookups to finish */
+		io_remove(&client->io);
+	}
+	dns_refresh_proctitle();
+	dns_client_send_replies(client);
 }
 
 static struct dns_client *dns_client_create(int fd)
@@ -103,10 +389,24 @@ static struct dns_client *dns_client_create(int fd)
 static void dns_client_destroy(struct dns_client **_client)
 {
 	struct dns_client *client = *_client;
+	struct dns_request *request;
 
 	*_client = NULL;
 
-	io_remove(&client->io);
+	while ((request = client->requests_head) != NULL) {
+		DLLIST2_REMOVE(&client->requests_head, &client->requests_tail,
+			       request);
+		if (request->reply != NULL)
+			dns_request_free(request);
+		else {
+			/* still running - free it when it finishes */
+			request->client = NULL;
+			request->prev = request->next = NULL;
+		}
+	}
+
+	if (client->io != NULL)
+		io_remove(&client->io);
 	i_stream_destroy(&client->input);
 	o_stream_destroy(&client->output);
 	if (close(client->fd) < 0)
@@ -130,20 +430,39 @@ static void client_connected(struct master_service_connection *conn)
 
 int main(int argc, char *argv[])
 {
+	const char *error;
+
 	master_service = master_service_init("dns-client", 0, &argc, &argv, "");
 	if (master_getopt(master_service) > 0)
 		return FATAL_DEFAULT;
+	if (master_service_settings_read_simple(master_service,
+						NULL, &error) < 0)
+		i_fatal("Error reading configuration: %s", error);
 
 	master_service_init_log(master_service, "dns-client: ");
 	restrict_access_by_env(NULL, FALSE);
 	restrict_access_allow_coredumps(TRUE);
 
+	verbose_proctitle =
+		master_service_settings_get(master_service)->verbose_proctitle;
+	hash_table_create(&dns_cache, default_pool, 0, str_hash, strcmp);
+#ifdef M_ARENA_MAX
+	/* glibc would give each lookup thread its own malloc arena, each of
+	   which reserves 64 MB of address space. The lookups aren't
+	   malloc-heavy, so that would just make us run into vsz_limit. */
+	(void)mallopt(M_ARENA_MAX, 1);
+#endif
+	dns_threads = thread_pool_init(DNS_MAX_THREADS);
+
 	master_service_init_finish(master_service);
 
 	master_service_run(master_service, client_connected);
 	if (dns_client != NULL)
 		dns_client_destroy(&dns_client);
 
+	/* this waits for the running lookups */
+	thread_pool_deinit(&dns_threads);
+	dns_cache_deinit();
 	master_service_deinit(&master_service);
         return 0;
 }
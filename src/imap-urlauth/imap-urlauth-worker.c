@@ -436,8 +436,10 @@ static int client_fetch_url(struct client *client, const char *url,
 		if (ret < 0) {
 			/* fetch failed badly */
 			client_abort(client, "Session aborted: Fatal failure while fetching URL");
+			return 0;
 		}
-		return 0;
+		/* continue with the next pipelined request */
+		return 1;
 	}
 
 	response = t_str_new(256);
@@ -483,14 +485,19 @@ static int client_fetch_url(struct client *client, const char *url,
 	}
 
 	if (client->url != NULL) {
-		/* URL not finished */
+		/* URL not finished. handle the rest of the pipelined
+		   requests after it's sent. */
 		o_stream_set_flush_pending(client->output, TRUE);
+		if (client->io != NULL)
+			io_remove(&client->io);
 		client->waiting_input = TRUE;
 	}
 	o_stream_uncork(client->output);
-	return client->url != NULL ? 0 : 1;
+	return 1;
 }
 
+/* Returns 1 if ok, 0 if the client was destroyed, -1 if the command was
+   invalid. */
 static int
 client_handle_command(struct client *client, const char *cmd,
 		      const char *const *args, const char **error_r)
@@ -704,12 +711,18 @@ static bool client_handle_input(struct client *client)
 			ret = client_handle_command(client, cmd, args, &error);
 
 		if (ret <= 0) {
-			if (ret == 0)
-				break;
+			if (ret == 0) {
+				/* client got destroyed */
+				return FALSE;
+			}
 			i_error("Client input error: %s", error);
 			client_abort(client, "Session aborted: Unexpected input");
 			return FALSE;
 		}
+		if (client->url != NULL) {
+			/* still sending the URL */
+			break;
+		}
 	}
 	return TRUE;
 }
@@ -90,19 +90,12 @@ static int seekable_fd_callback(const char **path_r, void *context)
 
 	path = t_str_new(128);
 	mail_user_set_get_temp_prefix(path, ctx->dest_user->set);
-	fd = safe_mkstemp(path, 0600, (uid_t)-1, (gid_t)-1);
+	fd = safe_mkstemp_anon(path, 0600);
 	if (fd == -1) {
 		i_error("safe_mkstemp(%s) failed: %m", str_c(path));
 		return -1;
 	}
 
-	/* we just want the fd, unlink it */
-	if (i_unlink(str_c(path)) < 0) {
-		/* shouldn't happen.. */
-		i_close_fd(&fd);
-		return -1;
-	}
-
 	*path_r = str_c(path);
 	return fd;
 }
@@ -43,6 +43,8 @@ struct imap_urlauth_request {
 	void *context;
 
 	unsigned int binary_has_nuls;
+	/* URL command has been sent to the service */
+	unsigned int sent:1;
 };
 
 struct imap_urlauth_target {
@@ -64,7 +66,7 @@ struct imap_urlauth_connection {
 	struct ostream *output;
 	struct io *io;
 
-	struct timeout *to_reconnect, *to_idle, *to_response;
+	struct timeout *to_reconnect, *to_idle, *to_response, *to_input;
 	time_t last_reconnect;
 	unsigned int reconnect_attempts;
 	unsigned int idle_timeout_msecs;
@@ -90,6 +92,10 @@ struct imap_urlauth_connection {
 #define IMAP_URLAUTH_HANDSHAKE "VERSION\timap-urlauth\t1\t0\n"
 
 #define IMAP_URLAUTH_MAX_INLINE_LITERAL_SIZE (1024*32)
+/* Maximum number of URL requests sent to the service before their replies
+   have been received. The service handles them in order, so this hides
+   the round trips between the requests. */
+#define IMAP_URLAUTH_MAX_PIPELINED_REQUESTS 8
 
 static void imap_urlauth_connection_disconnect
 	(struct imap_urlauth_connection *conn, const char *reason);
@@ -103,6 +109,7 @@ static void imap_urlauth_connection_timeout_abort
 	(struct imap_urlauth_connection *conn);
 static void imap_urlauth_connection_fail
 	(struct imap_urlauth_connection *conn);
+static void imap_urlauth_input(struct imap_urlauth_connection *conn);
 
 struct imap_urlauth_connection *
 imap_urlauth_connection_init(const char *path, struct mail_user *user,
@@ -206,11 +213,69 @@ imap_urlauth_connection_select_target(struct imap_urlauth_connection *conn)
 	imap_urlauth_start_response_timeout(conn);
 }
 
+static void
+imap_urlauth_connection_send_url(struct imap_urlauth_connection *conn,
+				 struct imap_urlauth_request *urlreq)
+{
+	string_t *cmd;
+
+	if (conn->user->mail_debug)
+		i_debug("imap-urlauth: Fetching URL `%s'", urlreq->url);
+
+	cmd = t_str_new(128);
+	str_append(cmd, "URL\t");
+	str_append_tabescaped(cmd, urlreq->url);
+	if ((urlreq->flags & IMAP_URLAUTH_FETCH_FLAG_BODYPARTSTRUCTURE) != 0)
+		str_append(cmd, "\tbpstruct");
+	if ((urlreq->flags & IMAP_URLAUTH_FETCH_FLAG_BINARY) != 0)
+		str_append(cmd, "\tbinary");
+	else if ((urlreq->flags & IMAP_URLAUTH_FETCH_FLAG_BODY) != 0)
+		str_append(cmd, "\tbody");
+	str_append_c(cmd, '\n');
+
+	urlreq->sent = TRUE;
+	if (o_stream_send(conn->output, str_data(cmd), str_len(cmd)) < 0) {
+		i_warning("Error sending URL request to imap-urlauth server: %m");
+		imap_urlauth_connection_fail(conn);
+	}
+}
+
+static void
+imap_urlauth_connection_pipeline_requests(struct imap_urlauth_connection *conn)
+{
+	struct imap_urlauth_request *urlreq;
+	unsigned int count = 0;
+
+	/* the already sent requests are always at the beginning of the
+	   selected target's queue */
+	urlreq = conn->targets_head->requests_head;
+	for (; urlreq != NULL && urlreq->sent; urlreq = urlreq->next)
+		count++;
+
+	for (; urlreq != NULL; urlreq = urlreq->next) {
+		if (count >= IMAP_URLAUTH_MAX_PIPELINED_REQUESTS)
+			break;
+		imap_urlauth_connection_send_url(conn, urlreq);
+		if (conn->state == IMAP_URLAUTH_STATE_DISCONNECTED)
+			break;
+		count++;
+	}
+}
+
+static void
+imap_urlauth_connection_resume_input(struct imap_urlauth_connection *conn)
+{
+	if (conn->io == NULL)
+		conn->io = io_add(conn->fd, IO_READ, imap_urlauth_input, conn);
+	/* replies for the pipelined requests may already be buffered */
+	if (i_stream_get_data_size(conn->input) > 0 && conn->to_input == NULL)
+		conn->to_input = timeout_add_short(0, imap_urlauth_input, conn);
+}
+
 static void
 imap_urlauth_connection_send_request(struct imap_urlauth_connection *conn)
 {
 	struct imap_urlauth_request *urlreq;
-	string_t *cmd;
 
 	if (conn->targets_head == NULL ||
 	    (conn->targets_head->requests_head == NULL &&
@@ -232,6 +297,13 @@ imap_urlauth_connection_send_request(struct imap_urlauth_connection *conn)
 		return;
 	}
 
+	if (conn->state == IMAP_URLAUTH_STATE_REQUEST_PENDING ||
+	    conn->state == IMAP_URLAUTH_STATE_REQUEST_WAIT) {
+		/* send new requests already while waiting for the replies */
+		imap_urlauth_connection_pipeline_requests(conn);
+		return;
+	}
+
 	if (conn->state != IMAP_URLAUTH_STATE_READY)
 		return;
 
@@ -251,27 +323,13 @@ imap_urlauth_connection_send_request(struct imap_urlauth_connection *conn)
 		return;
 	}	
 
-	if (conn->user->mail_debug)
-		i_debug("imap-urlauth: Fetching URL `%s'", urlreq->url);
-
-	cmd = t_str_new(128);
-	str_append(cmd, "URL\t");
-	str_append_tabescaped(cmd, urlreq->url);
-	if ((urlreq->flags & IMAP_URLAUTH_FETCH_FLAG_BODYPARTSTRUCTURE) != 0)
-		str_append(cmd, "\tbpstruct");
-	if ((urlreq->flags & IMAP_URLAUTH_FETCH_FLAG_BINARY) != 0)
-		str_append(cmd, "\tbinary");
-	else if ((urlreq->flags & IMAP_URLAUTH_FETCH_FLAG_BODY) != 0)
-		str_append(cmd, "\tbody");
-	str_append_c(cmd, '\n');
-
 	conn->state = IMAP_URLAUTH_STATE_REQUEST_PENDING;
-	if (o_stream_send(conn->output, str_data(cmd), str_len(cmd)) < 0) {
-		i_warning("Error sending URL request to imap-urlauth server: %m");
-		imap_urlauth_connection_fail(conn);
-	}
+	imap_urlauth_connection_pipeline_requests(conn);
+	if (conn->state == IMAP_URLAUTH_STATE_DISCONNECTED)
+		return;
 
 	imap_urlauth_start_response_timeout(conn);
+	imap_urlauth_connection_resume_input(conn);
 }
 
 struct imap_urlauth_request *
@@ -320,12 +378,9 @@ static void imap_urlauth_request_free(struct imap_urlauth_request *urlreq)
 static void imap_urlauth_request_drop(struct imap_urlauth_connection *conn,
 				struct imap_urlauth_request *urlreq)
 {
-	if ((conn->state == IMAP_URLAUTH_STATE_REQUEST_PENDING ||
-			conn->state == IMAP_URLAUTH_STATE_REQUEST_WAIT) &&
-	    conn->targets_head != NULL &&
-	    conn->targets_head->requests_head == urlreq) {
-		/* cannot just drop pending request without breaking
-		   protocol state */
+	if (urlreq->sent && conn->state != IMAP_URLAUTH_STATE_DISCONNECTED) {
+		/* cannot just drop a sent request without breaking protocol
+		   state. its reply is skipped when it arrives. */
 		return;
 	}
 	imap_urlauth_request_free(urlreq);
@@ -828,9 +883,19 @@ static int imap_urlauth_input_next(struct imap_urlauth_connection *conn)
 		conn->state = IMAP_URLAUTH_STATE_READY;
 		imap_urlauth_connection_send_request(conn);
 		return 0;
+	case IMAP_URLAUTH_STATE_REQUEST_WAIT:
+		if (conn->targets_head->requests_head->next != NULL &&
+		    conn->targets_head->requests_head->next->sent) {
+			/* reply for a pipelined request. leave it buffered
+			   and stop reading more until the current reply has
+			   been handled. */
+			if (conn->io != NULL)
+				io_remove(&conn->io);
+			return 0;
+		}
+		/* fall through */
 	case IMAP_URLAUTH_STATE_AUTHENTICATED:
 	case IMAP_URLAUTH_STATE_READY:
-	case IMAP_URLAUTH_STATE_REQUEST_WAIT:
 		if ((response = i_stream_next_line(conn->input)) == NULL)
 			return 0;
 
@@ -854,6 +919,8 @@ static void imap_urlauth_input(struct imap_urlauth_connection *conn)
 
 	i_assert(conn->state != IMAP_URLAUTH_STATE_DISCONNECTED);
 
+	if (conn->to_input != NULL)
+		timeout_remove(&conn->to_input);
 	if (conn->input->closed) {
 		/* disconnected */
 		i_error("imap-urlauth: Service disconnected unexpectedly");
@@ -950,8 +1017,18 @@ int imap_urlauth_connection_connect(struct imap_urlauth_connection *conn)
 static void imap_urlauth_connection_disconnect
 (struct imap_urlauth_connection *conn, const char *reason)
 {
+	struct imap_urlauth_target *target;
+	struct imap_urlauth_request *urlreq;
+
 	conn->state = IMAP_URLAUTH_STATE_DISCONNECTED;
 
+	/* the requests need to be sent again after reconnecting */
+	for (target = conn->targets_head; target != NULL; target = target->next) {
+		for (urlreq = target->requests_head; urlreq != NULL;
+		     urlreq = urlreq->next)
+			urlreq->sent = FALSE;
+	}
+
 	if (conn->fd != -1) {
 		if (conn->user->mail_debug) {
 			if (reason == NULL)
@@ -960,7 +1037,8 @@ static void imap_urlauth_connection_disconnect
 				i_debug("imap-urlauth: Disconnected: %s", reason);
 		}
 
-		io_remove(&conn->io);
+		if (conn->io != NULL)
+			io_remove(&conn->io);
 		i_stream_destroy(&conn->input);
 		o_stream_destroy(&conn->output);
 		net_disconnect(conn->fd);
@@ -982,6 +1060,8 @@ static void imap_urlauth_connection_disconnect
 		timeout_remove(&conn->to_reconnect);
 	if (conn->to_idle != NULL)
 		timeout_remove(&conn->to_idle);
+	if (conn->to_input != NULL)
+		timeout_remove(&conn->to_input);
 	imap_urlauth_stop_response_timeout(conn);
 }
 
@@ -0,0 +1,55 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "istream.h"
+#include "imap-parser.h"
+#include "test-bench.h"
+
+struct bench_imap_parser_ctx {
+	const char *line;
+	struct istream *input;
+	struct imap_parser *parser;
+};
+
+static void bench_imap_parser_fetch(struct bench_imap_parser_ctx *ctx,
+				    unsigned int iterations)
+{
+	const struct imap_arg *args;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		i_stream_seek(ctx->input, 0);
+		imap_parser_reset(ctx->parser);
+		if (imap_parser_read_args(ctx->parser, 0, 0, &args) <= 0)
+			i_unreached();
+		test_bench_sink += args[0].type;
+	}
+}
+
+static void bench_imap_parser(void)
+{
+	struct bench_imap_parser_ctx ctx;
+
+	ctx.line = "1:* (UID FLAGS INTERNALDATE RFC822.SIZE "
+		"BODY.PEEK[HEADER.FIELDS (DATE FROM TO CC SUBJECT "
+		"MESSAGE-ID IN-REPLY-TO REFERENCES CONTENT-TYPE)] "
+		"BODYSTRUCTURE) (CHANGEDSINCE 12345 VANISHED)\r\n";
+	ctx.input = i_stream_create_from_data(ctx.line, strlen(ctx.line));
+	ctx.parser = imap_parser_create(ctx.input, NULL, 65536);
+	(void)i_stream_read(ctx.input);
+
+	test_bench("imap_parser_read_args_fetch", bench_imap_parser_fetch,
+		   &ctx);
+
+	imap_parser_unref(&ctx.parser);
+	i_stream_unref(&ctx.input);
+}
+
+int main(void)
+{
+	static void (*bench_functions[])(void) = {
+		bench_imap_parser,
+		NULL
+	};
+	return test_bench_run(bench_functions);
+}
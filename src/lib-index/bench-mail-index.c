@@ -0,0 +1,135 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "hostpid.h"
+#include "unlink-directory.h"
+#include "mail-index.h"
+#include "test-bench.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BENCH_MESSAGE_COUNT 100000
+
+struct bench_mail_index_ctx {
+	struct mail_index *index;
+	struct mail_index_view *view;
+	uint32_t messages_count;
+};
+
+static void bench_mail_index_lookup(struct bench_mail_index_ctx *ctx,
+				    unsigned int iterations)
+{
+	const struct mail_index_record *rec;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		rec = mail_index_lookup(ctx->view,
+					i % ctx->messages_count + 1);
+		test_bench_sink += rec->flags;
+	}
+}
+
+static void bench_mail_index_lookup_seq(struct bench_mail_index_ctx *ctx,
+					unsigned int iterations)
+{
+	unsigned int i;
+	uint32_t seq;
+
+	for (i = 0; i < iterations; i++) {
+		/* UIDs are 1, 3, 5, .. so that half of the lookups miss */
+		if (mail_index_lookup_seq(ctx->view,
+					  i % (ctx->messages_count * 2) + 1,
+					  &seq))
+			test_bench_sink += seq;
+	}
+}
+
+static void
+bench_mail_index_lookup_seq_range(struct bench_mail_index_ctx *ctx,
+				  unsigned int iterations)
+{
+	unsigned int i;
+	uint32_t uid, seq1, seq2;
+
+	for (i = 0; i < iterations; i++) {
+		uid = i % (ctx->messages_count * 2) + 1;
+		mail_index_lookup_seq_range(ctx->view, uid, uid + 200,
+					    &seq1, &seq2);
+		test_bench_sink += seq2 - seq1;
+	}
+}
+
+static void bench_mail_index(void)
+{
+	struct bench_mail_index_ctx ctx;
+	struct ioloop *ioloop;
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *sync_view;
+	struct mail_index_transaction *trans;
+	const char *dir;
+	uint32_t seq, uid, uid_validity;
+
+	/* use real files, so the lookups go through the mmap()ed index like
+	   they do in normal use */
+	dir = t_strdup_printf("/tmp/dovecot-bench-index.%s", my_pid);
+	if (mkdir(dir, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", dir);
+
+	/* the index ID is based on ioloop_time */
+	ioloop = io_loop_create();
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.index = mail_index_alloc(dir, "dovecot.index");
+	if (mail_index_open_or_create(ctx.index,
+				      MAIL_INDEX_OPEN_FLAG_CREATE) < 0) {
+		i_fatal("mail_index_open_or_create() failed: %s",
+			mail_index_get_error_message(ctx.index));
+	}
+
+	if (mail_index_sync_begin(ctx.index, &sync_ctx, &sync_view,
+				  &trans, 0) < 0) {
+		i_fatal("mail_index_sync_begin() failed: %s",
+			mail_index_get_error_message(ctx.index));
+	}
+	uid_validity = ioloop_time;
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uid = 1; uid < BENCH_MESSAGE_COUNT * 2; uid += 2) {
+		mail_index_append(trans, uid, &seq);
+		if (uid % 3 == 0) {
+			mail_index_update_flags(trans, seq, MODIFY_ADD,
+						MAIL_SEEN);
+		}
+	}
+	if (mail_index_sync_commit(&sync_ctx) < 0) {
+		i_fatal("mail_index_sync_commit() failed: %s",
+			mail_index_get_error_message(ctx.index));
+	}
+
+	ctx.view = mail_index_view_open(ctx.index);
+	ctx.messages_count = mail_index_view_get_messages_count(ctx.view);
+	i_assert(ctx.messages_count == BENCH_MESSAGE_COUNT);
+
+	test_bench("mail_index_lookup", bench_mail_index_lookup, &ctx);
+	test_bench("mail_index_lookup_seq", bench_mail_index_lookup_seq, &ctx);
+	test_bench("mail_index_lookup_seq_range",
+		   bench_mail_index_lookup_seq_range, &ctx);
+
+	mail_index_view_close(&ctx.view);
+	mail_index_close(ctx.index);
+	mail_index_free(&ctx.index);
+	if (unlink_directory(dir, UNLINK_DIRECTORY_FLAG_RMDIR) < 0)
+		i_error("unlink_directory(%s) failed: %m", dir);
+	io_loop_destroy(&ioloop);
+}
+
+int main(void)
+{
+	static void (*bench_functions[])(void) = {
+		bench_mail_index,
+		NULL
+	};
+	return test_bench_run(bench_functions);
+}
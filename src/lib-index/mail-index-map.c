@@ -431,10 +431,10 @@ void mail_index_record_map_move_to_private(struct mail_index_map *map)
 		new_map = mail_index_record_map_alloc(map);
 		mail_index_map_copy_records(new_map, map->rec_map,
 					    map->hdr.record_size);
-		mail_index_record_map_unlink(map);
-		map->rec_map = new_map;
 		if (map->rec_map->modseq != NULL)
 			new_map->modseq = mail_index_map_modseq_clone(map->rec_map->modseq);
+		mail_index_record_map_unlink(map);
+		map->rec_map = new_map;
 	} else {
 		new_map = map->rec_map;
 	}
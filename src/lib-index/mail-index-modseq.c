@@ -7,6 +7,9 @@
 #include "mail-index-sync-private.h"
 #include "mail-index-modseq.h"
 
+/* Number of records summarized by each block_highest_modseqs element */
+#define MODSEQ_BLOCK_SIZE 128
+
 ARRAY_DEFINE_TYPE(modseqs, uint64_t);
 
 enum modseq_metadata_idx {
@@ -27,6 +30,13 @@ struct metadata_modseqs {
 struct mail_index_map_modseq {
 	/* indexes use enum modseq_metadata_idx */
 	ARRAY(struct metadata_modseqs) metadata_modseqs;
+
+	/* Highest modseq within each MODSEQ_BLOCK_SIZE records. This is built
+	   lazily for the first block_records_count records and kept up to
+	   date while syncing, so changed-since lookups can skip over blocks
+	   that haven't changed. */
+	ARRAY_TYPE(modseqs) block_highest_modseqs;
+	uint32_t block_records_count;
 };
 
 struct mail_index_modseq_sync {
@@ -151,6 +161,110 @@ mail_index_map_modseq(struct mail_index_view *view)
 	return mmap;
 }
 
+static void
+modseq_blocks_update(struct mail_index_map_modseq *mmap,
+		     uint32_t seq, uint64_t modseq)
+{
+	uint64_t *highestp;
+
+	if (seq > mmap->block_records_count)
+		return;
+
+	highestp = array_idx_modifiable(&mmap->block_highest_modseqs,
+					(seq-1) / MODSEQ_BLOCK_SIZE);
+	if (*highestp < modseq)
+		*highestp = modseq;
+}
+
+static void
+modseq_blocks_truncate(struct mail_index_map_modseq *mmap, uint32_t seq)
+{
+	unsigned int idx = (seq-1) / MODSEQ_BLOCK_SIZE;
+
+	if (mmap->block_records_count < seq)
+		return;
+
+	/* the block containing seq is rebuilt on the next lookup */
+	array_delete(&mmap->block_highest_modseqs, idx,
+		     array_count(&mmap->block_highest_modseqs) - idx);
+	mmap->block_records_count = idx * MODSEQ_BLOCK_SIZE;
+}
+
+static void
+modseq_blocks_build(struct mail_index_map *map,
+		    struct mail_index_map_modseq *mmap,
+		    const struct mail_index_ext *ext)
+{
+	const struct mail_index_record *rec;
+	uint64_t modseq, *highestp;
+	uint32_t seq, records_count = map->rec_map->records_count;
+	unsigned int idx;
+
+	if (mmap->block_records_count >= records_count)
+		return;
+
+	if (!array_is_created(&mmap->block_highest_modseqs)) {
+		i_array_init(&mmap->block_highest_modseqs,
+			     records_count / MODSEQ_BLOCK_SIZE + 16);
+	}
+
+	for (seq = mmap->block_records_count + 1; seq <= records_count; seq++) {
+		rec = MAIL_INDEX_REC_AT_SEQ(map, seq);
+		modseq = *(const uint64_t *)
+			CONST_PTR_OFFSET(rec, ext->record_offset);
+		if (modseq == 0) {
+			/* looked up as the current highest modseq */
+			modseq = (uint64_t)-1;
+		}
+
+		idx = (seq-1) / MODSEQ_BLOCK_SIZE;
+		if (idx == array_count(&mmap->block_highest_modseqs))
+			array_append(&mmap->block_highest_modseqs, &modseq, 1);
+		else {
+			highestp = array_idx_modifiable(&mmap->block_highest_modseqs,
+							idx);
+			if (*highestp < modseq)
+				*highestp = modseq;
+		}
+	}
+	mmap->block_records_count = records_count;
+}
+
+uint32_t mail_index_modseq_next_changed_seq(struct mail_index_view *view,
+					    uint32_t seq, uint64_t min_modseq)
+{
+	struct mail_index_map_modseq *mmap = mail_index_map_modseq(view);
+	const struct mail_index_ext *ext;
+	const uint64_t *highest;
+	unsigned int idx, count;
+	uint32_t ext_map_idx;
+
+	if (mmap == NULL)
+		return seq;
+	if (view->map != view->index->map) {
+		/* the lookups may return records from the newer head map */
+		return seq;
+	}
+	if (!mail_index_map_get_ext_idx(view->map, view->index->modseq_ext_id,
+					&ext_map_idx))
+		return seq;
+	if (seq > view->map->hdr.messages_count)
+		return seq;
+
+	ext = array_idx(&view->map->extensions, ext_map_idx);
+	modseq_blocks_build(view->map, mmap, ext);
+
+	highest = array_get(&mmap->block_highest_modseqs, &count);
+	idx = (seq-1) / MODSEQ_BLOCK_SIZE;
+	if (idx < count && highest[idx] >= min_modseq)
+		return seq;
+	for (idx++; idx < count; idx++) {
+		if (highest[idx] >= min_modseq)
+			break;
+	}
+	return idx * MODSEQ_BLOCK_SIZE + 1;
+}
+
 uint64_t mail_index_modseq_lookup(struct mail_index_view *view, uint32_t seq)
 {
 	struct mail_index_map_modseq *mmap = mail_index_map_modseq(view);
@@ -211,6 +325,7 @@ int mail_index_modseq_set(struct mail_index_view *view,
 		return 0;
 	else {
 		*modseqp = min_modseq;
+		modseq_blocks_update(mmap, seq, min_modseq);
 		return 1;
 	}
 }
@@ -306,8 +421,11 @@ mail_index_modseq_update(struct mail_index_modseq_sync *ctx,
 	for (; seq1 <= seq2; seq1++) {
 		rec = MAIL_INDEX_REC_AT_SEQ(ctx->view->map, seq1);
 		modseqp = PTR_OFFSET(rec, ext->record_offset);
-		if (*modseqp == 0 || (nonzeros && *modseqp < modseq))
+		if (*modseqp == 0 || (nonzeros && *modseqp < modseq)) {
 			*modseqp = modseq;
+			if (ctx->mmap != NULL)
+				modseq_blocks_update(ctx->mmap, seq1, modseq);
+		}
 	}
 }
 
@@ -570,6 +688,7 @@ void mail_index_modseq_expunge(struct mail_index_modseq_sync *ctx,
 		if (array_is_created(&metadata->modseqs))
 			array_delete(&metadata->modseqs, seq1, seq2-seq1);
 	}
+	modseq_blocks_truncate(ctx->mmap, seq1 + 1);
 
 	modseq = mail_transaction_log_view_get_prev_modseq(ctx->log_view);
 	if (ctx->highest_modseq < modseq)
@@ -670,6 +789,13 @@ mail_index_map_modseq_clone(const struct mail_index_map_modseq *mmap)
 					   &src_metadata[i].modseqs);
 		}
 	}
+	if (array_is_created(&mmap->block_highest_modseqs)) {
+		i_array_init(&new_mmap->block_highest_modseqs,
+			     array_count(&mmap->block_highest_modseqs) + 16);
+		array_append_array(&new_mmap->block_highest_modseqs,
+				   &mmap->block_highest_modseqs);
+		new_mmap->block_records_count = mmap->block_records_count;
+	}
 	return new_mmap;
 }
 
@@ -685,6 +811,8 @@ void mail_index_map_modseq_free(struct mail_index_map_modseq **_mmap)
 			array_free(&metadata->modseqs);
 	}
 	array_free(&mmap->metadata_modseqs);
+	if (array_is_created(&mmap->block_highest_modseqs))
+		array_free(&mmap->block_highest_modseqs);
 	i_free(mmap);
 }
 
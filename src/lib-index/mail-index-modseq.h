@@ -37,6 +37,11 @@ uint64_t mail_index_modseq_lookup_flags(struct mail_index_view *view,
 uint64_t mail_index_modseq_lookup_keywords(struct mail_index_view *view,
 					   const struct mail_keywords *keywords,
 					   uint32_t seq);
+/* Returns the first sequence >= seq whose modseq may be >= min_modseq, or
+   a sequence beyond the view's messages count if there are none. This is
+   only a hint: the returned message doesn't necessarily match. */
+uint32_t mail_index_modseq_next_changed_seq(struct mail_index_view *view,
+					    uint32_t seq, uint64_t min_modseq);
 int mail_index_modseq_set(struct mail_index_view *view,
 			  uint32_t seq, uint64_t min_modseq);
 
@@ -0,0 +1,171 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "hostpid.h"
+#include "unlink-directory.h"
+#include "test-common.h"
+#include "mail-index-private.h"
+#include "mail-index-modseq.h"
+
+#include <sys/stat.h>
+
+/* a bit over three blocks of the highest modseq summary */
+#define TEST_MESSAGE_COUNT (3*128 + 10)
+
+static struct mail_index_transaction *
+test_sync_begin(struct mail_index *index, struct mail_index_sync_ctx **ctx_r)
+{
+	struct mail_index_view *sync_view;
+	struct mail_index_transaction *trans;
+
+	if (mail_index_sync_begin(index, ctx_r, &sync_view, &trans, 0) < 0) {
+		i_fatal("mail_index_sync_begin() failed: %s",
+			mail_index_get_error_message(index));
+	}
+	return trans;
+}
+
+static void test_sync_commit(struct mail_index *index,
+			     struct mail_index_sync_ctx **ctx)
+{
+	if (mail_index_sync_commit(ctx) < 0) {
+		i_fatal("mail_index_sync_commit() failed: %s",
+			mail_index_get_error_message(index));
+	}
+}
+
+static uint64_t test_get_highest_modseq(struct mail_index *index)
+{
+	struct mail_index_view *view;
+	uint64_t highest_modseq;
+
+	view = mail_index_view_open(index);
+	highest_modseq = mail_index_modseq_get_highest(view);
+	mail_index_view_close(&view);
+	return highest_modseq;
+}
+
+/* Go through the messages the way a CHANGEDSINCE search does and verify
+   that none of the skipped messages has changed. Returns the number of
+   skipped messages. */
+static unsigned int
+test_check_skips(struct mail_index *index, uint64_t min_modseq)
+{
+	struct mail_index_view *view;
+	uint32_t seq, next_seq, messages_count;
+	unsigned int skipped = 0;
+
+	view = mail_index_view_open(index);
+	messages_count = mail_index_view_get_messages_count(view);
+	seq = 1;
+	while (seq <= messages_count) {
+		next_seq = mail_index_modseq_next_changed_seq(view, seq,
+							      min_modseq);
+		test_assert_idx(next_seq >= seq, seq);
+		if (next_seq <= seq) {
+			seq++;
+			continue;
+		}
+		for (; seq < next_seq && seq <= messages_count; seq++) {
+			test_assert_idx(mail_index_modseq_lookup(view, seq) <
+					min_modseq, seq);
+			skipped++;
+		}
+	}
+	mail_index_view_close(&view);
+	return skipped;
+}
+
+static void test_mail_index_modseq_next_changed_seq(void)
+{
+	struct ioloop *ioloop;
+	struct mail_index *index;
+	struct mail_index_view *old_view;
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_transaction *trans;
+	const char *dir;
+	uint64_t modseq;
+	uint32_t seq, uid, uid_validity;
+
+	test_begin("mail index modseq next changed seq");
+
+	dir = t_strdup_printf("/tmp/test-mail-index-modseq.%s", my_pid);
+	if (mkdir(dir, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", dir);
+	ioloop = io_loop_create();
+	index = mail_index_alloc(dir, "dovecot.index");
+	if (mail_index_open_or_create(index, MAIL_INDEX_OPEN_FLAG_CREATE) < 0) {
+		i_fatal("mail_index_open_or_create() failed: %s",
+			mail_index_get_error_message(index));
+	}
+	mail_index_modseq_enable(index);
+
+	trans = test_sync_begin(index, &sync_ctx);
+	uid_validity = ioloop_time;
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uid = 1; uid <= TEST_MESSAGE_COUNT; uid++)
+		mail_index_append(trans, uid, &seq);
+	test_sync_commit(index, &sync_ctx);
+
+	/* nothing has changed since the appends */
+	modseq = test_get_highest_modseq(index);
+	test_assert(test_check_skips(index, modseq + 1) == TEST_MESSAGE_COUNT);
+	test_assert(test_check_skips(index, modseq) == 0);
+
+	/* a flag update in the second block */
+	trans = test_sync_begin(index, &sync_ctx);
+	mail_index_update_flags(trans, 200, MODIFY_ADD, MAIL_FLAGGED);
+	test_sync_commit(index, &sync_ctx);
+	test_assert(test_check_skips(index, modseq + 1) ==
+		    TEST_MESSAGE_COUNT - 128);
+
+	/* an explicit modseq update in the third block */
+	modseq = test_get_highest_modseq(index) + 100;
+	trans = test_sync_begin(index, &sync_ctx);
+	mail_index_update_modseq(trans, 300, modseq);
+	test_sync_commit(index, &sync_ctx);
+	test_assert(test_check_skips(index, modseq) ==
+		    TEST_MESSAGE_COUNT - 128);
+
+	/* the first message of the second block changes, and then an
+	   expunge moves it to the first block */
+	modseq = test_get_highest_modseq(index);
+	trans = test_sync_begin(index, &sync_ctx);
+	mail_index_update_flags(trans, 129, MODIFY_ADD, MAIL_SEEN);
+	test_sync_commit(index, &sync_ctx);
+	test_assert(test_check_skips(index, modseq + 1) ==
+		    TEST_MESSAGE_COUNT - 128);
+
+	/* the old view keeps the current map in use, so the expunge clones
+	   the map along with its summary before truncating it */
+	old_view = mail_index_view_open(index);
+	trans = test_sync_begin(index, &sync_ctx);
+	mail_index_expunge(trans, 5);
+	test_sync_commit(index, &sync_ctx);
+	test_assert(test_check_skips(index, modseq + 1) ==
+		    TEST_MESSAGE_COUNT - 1 - 128);
+	/* the old view's map isn't the head map, so nothing is skipped */
+	test_assert(old_view->map != index->map);
+	test_assert(mail_index_modseq_next_changed_seq(old_view, 1,
+						       modseq + 1) == 1);
+	mail_index_view_close(&old_view);
+
+	mail_index_close(index);
+	mail_index_free(&index);
+	if (unlink_directory(dir, UNLINK_DIRECTORY_FLAG_RMDIR) < 0)
+		i_error("unlink_directory(%s) failed: %m", dir);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_mail_index_modseq_next_changed_seq,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -7,6 +7,8 @@
 #include "istream.h"
 #include "ostream.h"
 #include "str.h"
+#include "hex-binary.h"
+#include "hash-method.h"
 #include "dns-lookup.h"
 #include "lmtp-client.h"
 
@@ -50,6 +52,9 @@ struct lmtp_client {
 	const char *global_fail_string;
 	string_t *input_multiline;
 	const char **xclient_args;
+	const struct hash_method *data_hash_method;
+	void *data_hash_ctx;
+	const char *data_hash;
 
 	struct dns_lookup *dns_lookup;
 	struct istream *input;
@@ -106,6 +111,7 @@ lmtp_client_init(const struct lmtp_client_settings *set,
 	client->set.proxy_ttl = set->proxy_ttl;
 	client->set.proxy_timeout_secs = set->proxy_timeout_secs;
 	client->set.timeout_secs = set->timeout_secs;
+	client->set.data_hash_method = p_strdup(pool, set->data_hash_method);
 	client->finish_callback = finish_callback;
 	client->finish_context = context;
 	client->fd = -1;
@@ -192,7 +198,8 @@ const char *lmtp_client_state_to_string(struct lmtp_client *client)
 	case LMTP_INPUT_STATE_DATA:
 		if (client->output_finished)
 			return "DATA reply";
-		else if (i_stream_get_size(client->data_input, FALSE, &size) > 0) {
+		else if (client->data_input->blocking &&
+			 i_stream_get_size(client->data_input, FALSE, &size) > 0) {
 			return t_strdup_printf(
 				"DATA (%"PRIuUOFF_T"/%"PRIuUOFF_T")",
 				client->data_input->v_offset, size);
@@ -239,6 +246,49 @@ lmtp_client_fail_full(struct lmtp_client *client, const char *line, bool remote)
 	lmtp_client_unref(&client);
 }
 
+static void
+lmtp_client_data_hash(struct lmtp_client *client,
+		      const void *data, size_t size)
+{
+	if (client->data_hash_method != NULL)
+		client->data_hash_method->loop(client->data_hash_ctx, data, size);
+}
+
+static bool
+lmtp_client_data_hash_verify(struct lmtp_client *client, const char **error_r)
+{
+	const char *p;
+	unsigned char *digest;
+	size_t len;
+
+	if (client->data_hash_method == NULL)
+		return TRUE;
+
+	/* the hash is sent as "250-2.0.0 XHASH=<hex>" line before the final
+	   reply line. if it's missing, the server is e.g. another proxy that
+	   didn't store the mail itself, so there's nothing to verify. */
+	p = strstr(str_c(client->input_multiline), " XHASH=");
+	if (p == NULL)
+		return TRUE;
+	p += 7;
+	len = strcspn(p, "\n");
+
+	if (client->data_hash == NULL) {
+		digest = t_malloc(client->data_hash_method->digest_size);
+		client->data_hash_method->result(client->data_hash_ctx, digest);
+		client->data_hash = p_strdup(client->pool,
+			binary_to_hex(digest, client->data_hash_method->digest_size));
+	}
+	if (strlen(client->data_hash) != len ||
+	    strncasecmp(p, client->data_hash, len) != 0) {
+		*error_r = t_strdup_printf("%s hash mismatch: sent %s, received %s",
+					   client->data_hash_method->name,
+					   client->data_hash, t_strndup(p, len));
+		return FALSE;
+	}
+	return TRUE;
+}
+
 static void
 lmtp_client_fail_remote(struct lmtp_client *client, const char *line)
 {
@@ -291,6 +341,7 @@ lmtp_client_data_next(struct lmtp_client *client, const char *line)
 	struct lmtp_rcpt *rcpt;
 	unsigned int i, count;
 	enum lmtp_client_result result;
+	const char *error;
 
 	rcpt = array_get_modifiable(&client->recipients, &count);
 	for (i = client->rcpt_next_data_idx; i < count; i++) {
@@ -303,6 +354,18 @@ lmtp_client_data_next(struct lmtp_client *client, const char *line)
 		rcpt[i].failed = line[0] != '2';
 		result = rcpt[i].failed ? LMTP_CLIENT_RESULT_REMOTE_ERROR :
 			LMTP_CLIENT_RESULT_OK;
+		if (!rcpt[i].failed &&
+		    !lmtp_client_data_hash_verify(client, &error)) {
+			/* the server has already saved the corrupted mail,
+			   but a retry that delivers a duplicate is better
+			   than accepting it silently. */
+			i_error("lmtp client: %s: DATA to <%s> corrupted in "
+				"transit: %s", client->host,
+				rcpt[i].address, error);
+			line = "451 4.3.0 DATA corrupted in transit";
+			rcpt[i].failed = TRUE;
+			result = LMTP_CLIENT_RESULT_INTERNAL_ERROR;
+		}
 		rcpt[i].data_callback(result, line, rcpt[i].context);
 		if (client->protocol == LMTP_CLIENT_PROTOCOL_LMTP)
 			break;
@@ -349,6 +412,7 @@ static int lmtp_client_send_data(struct lmtp_client *client)
 		if (i > 0) {
 			if (o_stream_send(client->output, data, i) < 0)
 				break;
+			lmtp_client_data_hash(client, data, i);
 			client->output_last = data[i-1];
 			i_stream_skip(client->data_input, i);
 			sent_bytes = TRUE;
@@ -367,6 +431,8 @@ static int lmtp_client_send_data(struct lmtp_client *client)
 		if (add != '\0') {
 			if (o_stream_send(client->output, &add, 1) < 0)
 				break;
+			if (add == '\r')
+				lmtp_client_data_hash(client, &add, 1);
 
 			client->output_last = add;
 		}
@@ -390,6 +456,7 @@ static int lmtp_client_send_data(struct lmtp_client *client)
 	if (client->output_last != '\n') {
 		/* didn't end with CRLF */
 		o_stream_nsend(client->output, "\r\n", 2);
+		lmtp_client_data_hash(client, "\r\n", 2);
 	}
 	o_stream_nsend(client->output, ".\r\n", 3);
 	client->output_finished = TRUE;
@@ -450,6 +517,12 @@ lmtp_client_parse_capabilities(struct lmtp_client *client, const char *lines)
 		if (strncasecmp(line, "XCLIENT ", 8) == 0) {
 			client->xclient_args =
 				(void *)p_strsplit(client->pool, line + 8, " ");
+		} else if (strcasecmp(line, "XHASH") == 0 &&
+			   client->set.data_hash_method != NULL &&
+			   *client->set.data_hash_method != '\0') {
+			client->data_hash_method =
+				hash_method_lookup(client->set.data_hash_method);
+			i_assert(client->data_hash_method != NULL);
 		}
 	}
 }
@@ -538,8 +611,17 @@ static int lmtp_client_input_line(struct lmtp_client *client, const char *line)
 			client->xclient_sent = TRUE;
 			break;
 		}
-		o_stream_nsend_str(client->output, t_strdup_printf(
-			"MAIL FROM:%s\r\n", client->set.mail_from));
+		if (client->data_hash_method == NULL) {
+			o_stream_nsend_str(client->output, t_strdup_printf(
+				"MAIL FROM:%s\r\n", client->set.mail_from));
+		} else {
+			client->data_hash_ctx = p_malloc(client->pool,
+				client->data_hash_method->context_size);
+			client->data_hash_method->init(client->data_hash_ctx);
+			o_stream_nsend_str(client->output, t_strdup_printf(
+				"MAIL FROM:%s XHASH=%s\r\n", client->set.mail_from,
+				client->data_hash_method->name));
+		}
 		client->input_state++;
 		break;
 	case LMTP_INPUT_STATE_MAIL_FROM:
@@ -566,8 +648,11 @@ static int lmtp_client_input_line(struct lmtp_client *client, const char *line)
 		}
 		client->input_state++;
 		client->times.data_started = ioloop_timeval;
-		if (client->data_header != NULL)
+		if (client->data_header != NULL) {
 			o_stream_nsend_str(client->output, client->data_header);
+			lmtp_client_data_hash(client, client->data_header,
+					      strlen(client->data_header));
+		}
 		if (lmtp_client_send_data(client) < 0)
 			return -1;
 		break;
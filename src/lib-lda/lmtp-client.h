@@ -52,6 +52,10 @@ struct lmtp_client_settings {
 	/* Don't wait an answer from destination server longer than this many
 	   seconds (0 = unlimited) */
 	unsigned int timeout_secs;
+	/* If remote server supports XHASH capability, ask it to reply with
+	   the hash of the DATA it received and tempfail the recipients whose
+	   hash doesn't match what was sent (e.g. "sha1", NULL = disabled) */
+	const char *data_hash_method;
 };
 
 /* reply contains the reply coming from remote server, or NULL
@@ -12,6 +12,7 @@
 #include "lda-settings.h"
 #include "mail-storage.h"
 #include "mail-namespace.h"
+#include "mail-copy.h"
 #include "duplicate.h"
 #include "mail-deliver.h"
 
@@ -290,6 +291,30 @@ void mail_deliver_deduplicate_guid_if_needed(struct mail_deliver_session *sessio
 	}
 }
 
+static struct mail *
+mail_deliver_get_copy_src_mail(struct mail_deliver_context *ctx,
+			       struct mailbox *dest_box)
+{
+	struct mail *mail = ctx->copy_src_mail;
+	struct mail_storage *src_storage, *dest_storage;
+
+	if (mail == NULL)
+		return ctx->src_mail;
+
+	/* the source mail belongs to another user. only file-per-message
+	   backends can hard link the mail. otherwise copying would just read
+	   the other user's mail file instead of the source mail that has
+	   already been parsed. */
+	src_storage = mailbox_get_storage(mail->box);
+	dest_storage = mailbox_get_storage(dest_box);
+	if (strcmp(mail_storage_get_name(src_storage),
+		   mail_storage_get_name(dest_storage)) != 0 ||
+	    !mail_storage_is_file_per_msg(dest_storage) ||
+	    !mail_storage_copy_can_use_hardlink(mail->box, dest_box))
+		return ctx->src_mail;
+	return mail;
+}
+
 int mail_deliver_save(struct mail_deliver_context *ctx, const char *mailbox,
 		      enum mail_flags flags, const char *const *keywords,
 		      struct mail_storage **storage_r)
@@ -350,7 +375,8 @@ int mail_deliver_save(struct mail_deliver_context *ctx, const char *mailbox,
 	mailbox_save_set_dest_mail(save_ctx, ctx->dest_mail);
 	mail_deliver_deduplicate_guid_if_needed(ctx->session, save_ctx);
 
-	if (mailbox_save_using_mail(&save_ctx, ctx->src_mail) < 0)
+	if (mailbox_save_using_mail(&save_ctx,
+			mail_deliver_get_copy_src_mail(ctx, box)) < 0)
 		ret = -1;
 	else
 		mail_deliver_log_cache_var_expand_table(ctx);
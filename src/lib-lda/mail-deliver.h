@@ -37,6 +37,11 @@ struct mail_deliver_context {
 	const char *session_id;
 	/* Mail to save */
 	struct mail *src_mail;
+	/* If non-NULL, a previously saved instance of src_mail. It's used as
+	   the copy source whenever the destination storage can link or
+	   refcount it instead of writing the message again. Headers are
+	   still read from src_mail. */
+	struct mail *copy_src_mail;
 	/* Envelope sender, if known. */
 	const char *src_envelope_sender;
 
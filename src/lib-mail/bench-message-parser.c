@@ -0,0 +1,116 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "istream.h"
+#include "message-parser.h"
+#include "test-bench.h"
+
+#define BENCH_BODY_LINES 200
+
+struct bench_message_parser_ctx {
+	string_t *msg;
+	struct istream *input;
+	pool_t pool;
+	struct message_part *parts;
+};
+
+static void
+bench_message_parser_parse(struct bench_message_parser_ctx *ctx,
+			   unsigned int iterations)
+{
+	struct message_parser_ctx *parser;
+	struct message_block block;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < iterations; i++) {
+		p_clear(ctx->pool);
+		i_stream_seek(ctx->input, 0);
+		parser = message_parser_init(ctx->pool, ctx->input, 0, 0);
+		while ((ret = message_parser_parse_next_block(parser,
+								      &block)) > 0)
+			test_bench_sink += block.size;
+		i_assert(ret < 0);
+		if (message_parser_deinit(&parser, &ctx->parts) < 0)
+			i_unreached();
+	}
+}
+
+static void
+bench_message_parser_preparsed(struct bench_message_parser_ctx *ctx,
+			       unsigned int iterations)
+{
+	struct message_parser_ctx *parser;
+	struct message_block block;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < iterations; i++) {
+		i_stream_seek(ctx->input, 0);
+		parser = message_parser_init_from_parts(ctx->parts, ctx->input,
+							0, 0);
+		while ((ret = message_parser_parse_next_block(parser,
+								      &block)) > 0)
+			test_bench_sink += block.size;
+		i_assert(ret < 0);
+		if (message_parser_deinit(&parser, &ctx->parts) < 0)
+			i_unreached();
+	}
+}
+
+static void bench_message_parser(void)
+{
+	struct bench_message_parser_ctx ctx;
+	unsigned int i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.msg = t_str_new(16384);
+	str_append(ctx.msg,
+		"From: Test User <test@example.org>\r\n"
+		"To: Another User <test2@example.org>\r\n"
+		"Subject: Benchmark message\r\n"
+		"Date: Sun, 23 May 2007 04:58:08 +0300\r\n"
+		"Message-Id: <1.2.3.4@example>\r\n"
+		"Mime-Version: 1.0\r\n"
+		"Content-Type: multipart/mixed; boundary=\"bound\"\r\n"
+		"\r\n"
+		"--bound\r\n"
+		"Content-Type: text/plain; charset=utf-8\r\n"
+		"\r\n");
+	for (i = 0; i < BENCH_BODY_LINES; i++) {
+		str_printfa(ctx.msg, "Line %u of the message body, which "
+			    "is long enough to be realistic.\r\n", i);
+	}
+	str_append(ctx.msg,
+		"--bound\r\n"
+		"Content-Type: application/octet-stream\r\n"
+		"Content-Transfer-Encoding: base64\r\n"
+		"\r\n");
+	for (i = 0; i < BENCH_BODY_LINES / 2; i++) {
+		str_append(ctx.msg, "SGVsbG8gd29ybGQhIEhlbGxvIHdvcmxkISBI"
+			   "ZWxsbyB3b3JsZCEgSGVsbG8gd29ybGQhIA==\r\n");
+	}
+	str_append(ctx.msg, "--bound--\r\n");
+
+	ctx.input = i_stream_create_from_data(str_data(ctx.msg),
+					      str_len(ctx.msg));
+	ctx.pool = pool_alloconly_create("message parser bench", 10240);
+
+	test_bench("message_parser_parse", bench_message_parser_parse,
+		   &ctx);
+	test_bench("message_parser_preparsed",
+		   bench_message_parser_preparsed, &ctx);
+
+	pool_unref(&ctx.pool);
+	i_stream_unref(&ctx.input);
+}
+
+int main(void)
+{
+	static void (*bench_functions[])(void) = {
+		bench_message_parser,
+		NULL
+	};
+	return test_bench_run(bench_functions);
+}
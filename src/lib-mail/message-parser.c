@@ -46,6 +46,8 @@ struct message_parser_ctx {
 
 	unsigned int part_seen_content_type:1;
 	unsigned int eof:1;
+	unsigned int preparsed:1;
+	unsigned int have_dot_lines:1;
 };
 
 message_part_header_callback_t *null_message_part_header_callback = NULL;
@@ -94,11 +96,16 @@ static void parse_body_add_block(struct message_parser_ctx *ctx,
 	if (memchr(data, '\0', block->size) != NULL)
 		ctx->part->flags |= MESSAGE_PART_FLAG_HAS_NULS;
 
-	/* count number of lines and missing CRs */
+	/* count number of lines and missing CRs. also check if any of the
+	   lines begin with '.' */
+	if (*data == '.' && ctx->last_chr == '\n')
+		ctx->have_dot_lines = TRUE;
 	if (*data == '\n') {
 		ctx->part->body_size.lines++;
 		if (ctx->last_chr != '\r')
 			missing_cr_count++;
+		if (block->size > 1 && data[1] == '.')
+			ctx->have_dot_lines = TRUE;
 	}
 
 	cur = data + 1;
@@ -108,6 +115,8 @@ static void parse_body_add_block(struct message_parser_ctx *ctx,
 			missing_cr_count++;
 
 		cur = next + 1;
+		if (cur < data + block->size && *cur == '.')
+			ctx->have_dot_lines = TRUE;
 	}
 	ctx->last_chr = data[block->size - 1];
 	ctx->skip += block->size;
@@ -556,6 +565,9 @@ static int parse_next_header(struct message_parser_ctx *ctx,
 	}
 
 	if (hdr != NULL) {
+		if (!hdr->continued && hdr->name_len > 0 &&
+		    hdr->name[0] == '.')
+			ctx->have_dot_lines = TRUE;
 		if (hdr->eoh)
 			;
 		else if (strcasecmp(hdr->name, "Mime-Version") == 0) {
@@ -1022,6 +1034,7 @@ message_parser_init_from_parts(struct message_part *parts,
 	i_assert(parts != NULL);
 
 	ctx = message_parser_init_int(input, hdr_flags, flags);
+	ctx->preparsed = TRUE;
 	ctx->parts = ctx->part = parts;
 	ctx->parse_next_block = preparsed_parse_next_header_init;
 	return ctx;
@@ -1054,6 +1067,16 @@ int message_parser_deinit_from_parts(struct message_parser_ctx **_ctx,
 	return ret;
 }
 
+bool message_parser_get_dot_lines(struct message_parser_ctx *ctx,
+				  bool *have_dot_lines_r)
+{
+	if (ctx->preparsed || !ctx->eof || ctx->input->stream_errno != 0 ||
+	    ctx->broken_reason != NULL)
+		return FALSE;
+	*have_dot_lines_r = ctx->have_dot_lines;
+	return TRUE;
+}
+
 int message_parser_parse_next_block(struct message_parser_ctx *ctx,
 				    struct message_block *block_r)
 {
@@ -65,6 +65,12 @@ int message_parser_deinit_from_parts(struct message_parser_ctx **_ctx,
 				     struct message_part **parts_r,
 				     const char **error_r);
 
+/* Returns TRUE if the whole message was parsed without preparsed parts, so
+   it's known whether any of its lines begin with '.'. This must be called
+   before deinit. */
+bool message_parser_get_dot_lines(struct message_parser_ctx *ctx,
+				  bool *have_dot_lines_r);
+
 /* Read the next block of a message. Returns 1 if block is returned, 0 if
    input stream is non-blocking and more data needs to be read, -1 when all is
    done or error occurred (see stream's error status). */
@@ -223,12 +223,71 @@ static void test_message_parser_no_eoh(void)
 	test_end();
 }
 
+static void test_message_parser_dot_lines(void)
+{
+	static const struct {
+		const char *input;
+		bool have_dot_lines;
+	} tests[] = {
+		{ "a: b\n\nbody\n", FALSE },
+		{ "a: b\n\nfoo.\n\tbar.\n", FALSE },
+		{ ".a: b\n\nbody\n", TRUE },
+		{ "a: b\n\n.\n", TRUE },
+		{ "a: b\r\n\r\nfoo\r\n..bar\r\n", TRUE },
+		{ "Content-Type: multipart/mixed; boundary=\"x\"\n\n"
+		  "--x\n\nfoo\n--x\n\n.bar\n--x--\n", TRUE },
+		{ "Content-Type: multipart/mixed; boundary=\"x\"\n\n"
+		  "--x\n\nfoo\n--x\n\nbar\n--x--\n", FALSE }
+	};
+	struct message_parser_ctx *parser;
+	struct istream *input;
+	struct message_part *parts;
+	struct message_block block;
+	unsigned int i, j, len;
+	bool have_dot_lines;
+	pool_t pool;
+	int ret = 0;
+
+	test_begin("message parser dot lines");
+	pool = pool_alloconly_create("message parser", 10240);
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		/* parse one byte at a time to test block boundaries */
+		input = test_istream_create(tests[i].input);
+		test_istream_set_allow_eof(input, FALSE);
+		len = strlen(tests[i].input);
+
+		parser = message_parser_init(pool, input, 0, 0);
+		for (j = 1; j <= len+1; j++) {
+			test_istream_set_size(input, j);
+			if (j > len)
+				test_istream_set_allow_eof(input, TRUE);
+			while ((ret = message_parser_parse_next_block(parser,
+								      &block)) > 0) ;
+		}
+		test_assert_idx(ret < 0, i);
+		test_assert_idx(message_parser_get_dot_lines(parser, &have_dot_lines) &&
+				have_dot_lines == tests[i].have_dot_lines, i);
+		test_assert_idx(message_parser_deinit(&parser, &parts) == 0, i);
+
+		/* preparsed parts don't know the state */
+		i_stream_seek(input, 0);
+		parser = message_parser_init_from_parts(parts, input, 0, 0);
+		while (message_parser_parse_next_block(parser, &block) > 0) ;
+		test_assert_idx(!message_parser_get_dot_lines(parser, &have_dot_lines), i);
+		test_assert_idx(message_parser_deinit(&parser, &parts) == 0, i);
+		i_stream_unref(&input);
+	}
+	pool_unref(&pool);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*test_functions[])(void) = {
 		test_message_parser_small_blocks,
 		test_message_parser_truncated_mime_headers,
 		test_message_parser_no_eoh,
+		test_message_parser_dot_lines,
 		NULL
 	};
 	return test_run(test_functions);
@@ -0,0 +1,241 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "istream.h"
+#include "hostpid.h"
+#include "unlink-directory.h"
+#include "master-service.h"
+#include "mail-storage-service.h"
+#include "mail-namespace.h"
+#include "mail-storage.h"
+#include "test-bench.h"
+
+#include <sys/stat.h>
+
+#define BENCH_MULTIAPPEND_COUNT 100
+#define BENCH_COPY_COUNT 100
+
+static const char bench_mail[] =
+"From: Sender <sender@example.com>\r\n"
+"To: Recipient <rcpt@example.com>\r\n"
+"Subject: Benchmark message\r\n"
+"Message-ID: <bench@example.com>\r\n"
+"Date: Mon, 1 Aug 2016 12:00:00 +0300\r\n"
+"MIME-Version: 1.0\r\n"
+"Content-Type: text/plain; charset=us-ascii\r\n"
+"\r\n"
+"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do\r\n"
+"eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim\r\n"
+"ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut\r\n"
+"aliquip ex ea commodo consequat.\r\n";
+
+struct bench_mail_save_ctx {
+	struct mailbox *box;
+	unsigned int mails_per_transaction;
+};
+
+struct bench_mail_copy_ctx {
+	struct mailbox *src_box, *dest_box;
+};
+
+static struct mail_storage_service_ctx *storage_service;
+
+static int bench_mail_save_one(struct mailbox_transaction_context *t)
+{
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	int ret;
+
+	input = i_stream_create_from_data(bench_mail, sizeof(bench_mail)-1);
+	save_ctx = mailbox_save_alloc(t);
+	if (mailbox_save_begin(&save_ctx, input) < 0) {
+		i_stream_unref(&input);
+		return -1;
+	}
+	/* the whole mail is already buffered in the input stream */
+	ret = mailbox_save_continue(save_ctx);
+	i_stream_unref(&input);
+	if (ret < 0) {
+		mailbox_save_cancel(&save_ctx);
+		return -1;
+	}
+	return mailbox_save_finish(&save_ctx);
+}
+
+static void bench_mail_save(struct bench_mail_save_ctx *ctx,
+			    unsigned int iterations)
+{
+	struct mailbox_transaction_context *t;
+	unsigned int i, j;
+
+	for (i = 0; i < iterations; i++) {
+		t = mailbox_transaction_begin(ctx->box,
+				MAILBOX_TRANSACTION_FLAG_EXTERNAL);
+		for (j = 0; j < ctx->mails_per_transaction; j++) {
+			if (bench_mail_save_one(t) < 0) {
+				i_fatal("Saving mail failed: %s",
+					mailbox_get_last_error(ctx->box, NULL));
+			}
+		}
+		if (mailbox_transaction_commit(&t) < 0) {
+			i_fatal("Committing saved mails failed: %s",
+				mailbox_get_last_error(ctx->box, NULL));
+		}
+	}
+	test_bench_sink += iterations;
+}
+
+static void bench_mail_copy(struct bench_mail_copy_ctx *ctx,
+			    unsigned int iterations)
+{
+	struct mailbox_transaction_context *src_trans, *dest_trans;
+	struct mail_save_context *save_ctx;
+	struct mail *mail;
+	unsigned int i;
+	uint32_t seq;
+
+	for (i = 0; i < iterations; i++) {
+		src_trans = mailbox_transaction_begin(ctx->src_box, 0);
+		dest_trans = mailbox_transaction_begin(ctx->dest_box,
+					MAILBOX_TRANSACTION_FLAG_EXTERNAL);
+		mail = mail_alloc(src_trans, 0, NULL);
+		for (seq = 1; seq <= BENCH_COPY_COUNT; seq++) {
+			mail_set_seq(mail, seq);
+			save_ctx = mailbox_save_alloc(dest_trans);
+			if (mailbox_copy(&save_ctx, mail) < 0) {
+				i_fatal("Copying mail failed: %s",
+					mailbox_get_last_error(ctx->dest_box,
+							       NULL));
+			}
+		}
+		mail_free(&mail);
+		if (mailbox_transaction_commit(&dest_trans) < 0) {
+			i_fatal("Committing copied mails failed: %s",
+				mailbox_get_last_error(ctx->dest_box, NULL));
+		}
+		(void)mailbox_transaction_commit(&src_trans);
+	}
+	test_bench_sink += iterations;
+}
+
+static void bench_mail_save_driver(const char *driver)
+{
+	struct bench_mail_save_ctx ctx;
+	struct bench_mail_copy_ctx copy_ctx;
+	struct mailbox_status status;
+	struct mail_storage_service_input input;
+	struct mail_storage_service_user *service_user;
+	struct mail_user *user;
+	struct mail_namespace *ns;
+	const char *home, *userdb_fields[3], *error;
+
+	/* use real files, since the point is to see how much the disk
+	   writes and fsyncs cost */
+	home = t_strdup_printf("/tmp/dovecot-bench-save.%s.%s",
+			       driver, my_pid);
+	if (mkdir(home, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", home);
+
+	userdb_fields[0] = t_strconcat("mail=", driver, ":~/mail", NULL);
+	userdb_fields[1] = t_strconcat("home=", home, NULL);
+	userdb_fields[2] = NULL;
+
+	memset(&input, 0, sizeof(input));
+	input.module = input.service = "bench-mail-save";
+	input.username = "bench";
+	input.userdb_fields = userdb_fields;
+	if (mail_storage_service_lookup_next(storage_service, &input,
+					     &service_user, &user,
+					     &error) <= 0)
+		i_fatal("User initialization failed: %s", error);
+
+	memset(&ctx, 0, sizeof(ctx));
+	ns = mail_namespace_find_inbox(user->namespaces);
+	ctx.box = mailbox_alloc(ns->list, "INBOX", 0);
+	if (mailbox_open(ctx.box) < 0) {
+		i_fatal("Opening INBOX failed: %s",
+			mailbox_get_last_error(ctx.box, NULL));
+	}
+
+	/* each iteration is one transaction: a single APPEND vs.
+	   a MULTIAPPEND of many mails */
+	ctx.mails_per_transaction = 1;
+	test_bench(t_strdup_printf("%s_append", driver),
+		   bench_mail_save, &ctx);
+	ctx.mails_per_transaction = BENCH_MULTIAPPEND_COUNT;
+	test_bench(t_strdup_printf("%s_multiappend_%u", driver,
+				   BENCH_MULTIAPPEND_COUNT),
+		   bench_mail_save, &ctx);
+
+	/* bulk copy within the same storage, e.g. what lazy_expunge and
+	   IMAP COPY do. the source mails are normally the ones saved above,
+	   unless BENCH_FILTER skipped those. */
+	if (mailbox_sync(ctx.box, 0) < 0) {
+		i_fatal("Syncing INBOX failed: %s",
+			mailbox_get_last_error(ctx.box, NULL));
+	}
+	mailbox_get_open_status(ctx.box, STATUS_MESSAGES, &status);
+	if (status.messages < BENCH_COPY_COUNT) {
+		ctx.mails_per_transaction = BENCH_COPY_COUNT;
+		bench_mail_save(&ctx, 1);
+		if (mailbox_sync(ctx.box, 0) < 0) {
+			i_fatal("Syncing INBOX failed: %s",
+				mailbox_get_last_error(ctx.box, NULL));
+		}
+	}
+
+	memset(&copy_ctx, 0, sizeof(copy_ctx));
+	copy_ctx.src_box = ctx.box;
+	copy_ctx.dest_box = mailbox_alloc(ns->list, "Copies", 0);
+	if (mailbox_create(copy_ctx.dest_box, NULL, FALSE) < 0 ||
+	    mailbox_open(copy_ctx.dest_box) < 0) {
+		i_fatal("Creating mailbox Copies failed: %s",
+			mailbox_get_last_error(copy_ctx.dest_box, NULL));
+	}
+	test_bench(t_strdup_printf("%s_copy_%u", driver, BENCH_COPY_COUNT),
+		   bench_mail_copy, &copy_ctx);
+	mailbox_free(&copy_ctx.dest_box);
+
+	mailbox_free(&ctx.box);
+	mail_user_unref(&user);
+	mail_storage_service_user_free(&service_user);
+	if (unlink_directory(home, UNLINK_DIRECTORY_FLAG_RMDIR) < 0)
+		i_error("unlink_directory(%s) failed: %m", home);
+}
+
+static void bench_maildir(void)
+{
+	bench_mail_save_driver("maildir");
+}
+
+static void bench_mdbox(void)
+{
+	bench_mail_save_driver("mdbox");
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*bench_functions[])(void) = {
+		bench_maildir,
+		bench_mdbox,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("bench-mail-save",
+				MASTER_SERVICE_FLAG_STANDALONE |
+				MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS,
+				&argc, &argv, "");
+	master_service_init_finish(master_service);
+	storage_service = mail_storage_service_init(master_service, NULL,
+				MAIL_STORAGE_SERVICE_FLAG_NO_RESTRICT_ACCESS |
+				MAIL_STORAGE_SERVICE_FLAG_NO_CHDIR |
+				MAIL_STORAGE_SERVICE_FLAG_NO_LOG_INIT |
+				MAIL_STORAGE_SERVICE_FLAG_NO_PLUGINS);
+
+	ret = test_bench_run_initialized(bench_functions);
+
+	mail_storage_service_deinit(&storage_service);
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -39,6 +39,7 @@ static void fail_mail_set_seq(struct mail *mail, uint32_t seq, bool saving)
 	mail->expunged = TRUE;
 	mail->has_nuls = FALSE;
 	mail->has_no_nuls = FALSE;
+	mail->has_no_dot_lines = FALSE;
 }
 
 static bool fail_mail_set_uid(struct mail *mail, uint32_t uid)
@@ -151,7 +151,7 @@ struct mailbox cydir_mailbox = {
 		cydir_storage_sync_init,
 		index_mailbox_sync_next,
 		index_mailbox_sync_deinit,
-		NULL,
+		index_storage_sync_notify,
 		cydir_notify_changes,
 		index_transaction_begin,
 		index_transaction_commit,
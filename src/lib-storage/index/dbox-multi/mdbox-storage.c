@@ -475,7 +475,7 @@ struct mailbox mdbox_mailbox = {
 		mdbox_storage_sync_init,
 		index_mailbox_sync_next,
 		index_mailbox_sync_deinit,
-		NULL,
+		index_storage_sync_notify,
 		dbox_notify_changes,
 		index_transaction_begin,
 		index_transaction_commit,
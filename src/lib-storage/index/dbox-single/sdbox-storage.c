@@ -460,7 +460,7 @@ struct mailbox sdbox_mailbox = {
 		sdbox_storage_sync_init,
 		index_mailbox_sync_next,
 		index_mailbox_sync_deinit,
-		NULL,
+		index_storage_sync_notify,
 		dbox_notify_changes,
 		index_transaction_begin,
 		index_transaction_commit,
@@ -67,18 +67,12 @@ static int index_attachment_open_temp_fd(void *context)
 
 	temp_path = t_str_new(256);
 	mail_user_set_get_temp_prefix(temp_path, storage->user->set);
-	fd = safe_mkstemp_hostpid(temp_path, 0600, (uid_t)-1, (gid_t)-1);
+	fd = safe_mkstemp_anon(temp_path, 0600);
 	if (fd == -1) {
 		mail_storage_set_critical(storage,
 			"safe_mkstemp(%s) failed: %m", str_c(temp_path));
 		return -1;
 	}
-	if (unlink(str_c(temp_path)) < 0) {
-		mail_storage_set_critical(storage,
-			"unlink(%s) failed: %m", str_c(temp_path));
-		i_close_fd(&fd);
-		return -1;
-	}
 	return fd;
 }
 
@@ -10,6 +10,9 @@ struct index_storage_attribute_iter {
 	struct dict_iterate_context *diter;
 	char *prefix;
 	unsigned int prefix_len;
+	/* the full dict key and value returned by the latest
+	   index_storage_attribute_iter_next() */
+	const char *last_key, *last_value;
 	bool dict_disabled;
 };
 
@@ -232,8 +235,9 @@ int index_storage_attribute_get(struct mailbox_transaction_context *t,
 				enum mail_attribute_type type, const char *key,
 				struct mail_attribute_value *value_r)
 {
+	struct index_mailbox_context *ibox;
 	struct dict *dict;
-	const char *mailbox_prefix;
+	const char *mailbox_prefix, *prefixed_key;
 	int ret;
 
 	memset(value_r, 0, sizeof(*value_r));
@@ -245,8 +249,19 @@ int index_storage_attribute_get(struct mailbox_transaction_context *t,
 	if (index_storage_get_dict(t->box, type, &dict, &mailbox_prefix) < 0)
 		return -1;
 
-	ret = dict_lookup(dict, pool_datastack_create(),
-			  key_get_prefixed(type, mailbox_prefix, key),
+	prefixed_key = key_get_prefixed(type, mailbox_prefix, key);
+	ibox = INDEX_STORAGE_CONTEXT(t->box);
+	if (ibox != NULL && ibox->attr_iter != NULL &&
+	    ibox->attr_iter->last_value != NULL &&
+	    strcmp(ibox->attr_iter->last_key, prefixed_key) == 0) {
+		/* looking up the attribute that is being iterated, e.g.
+		   GETMETADATA with DEPTH. the iteration already returned its
+		   value, so avoid a dict lookup. */
+		value_r->value = t_strdup(ibox->attr_iter->last_value);
+		return 1;
+	}
+
+	ret = dict_lookup(dict, pool_datastack_create(), prefixed_key,
 			  &value_r->value);
 	if (ret < 0) {
 		mail_storage_set_internal_error(t->box->storage);
@@ -260,6 +275,7 @@ index_storage_attribute_iter_init(struct mailbox *box,
 				  enum mail_attribute_type type,
 				  const char *prefix)
 {
+	struct index_mailbox_context *ibox;
 	struct index_storage_attribute_iter *iter;
 	struct dict *dict;
 	const char *mailbox_prefix;
@@ -273,9 +289,13 @@ index_storage_attribute_iter_init(struct mailbox *box,
 		iter->prefix = i_strdup(key_get_prefixed(type, mailbox_prefix,
 							 prefix));
 		iter->prefix_len = strlen(iter->prefix);
+		/* the values are usually looked up right after iterating
+		   their keys, so get them at the same time */
 		iter->diter = dict_iterate_init(dict, iter->prefix,
-						DICT_ITERATE_FLAG_RECURSE |
-						DICT_ITERATE_FLAG_NO_VALUE);
+						DICT_ITERATE_FLAG_RECURSE);
+		ibox = INDEX_STORAGE_CONTEXT(box);
+		if (ibox != NULL)
+			ibox->attr_iter = iter;
 	}
 	return &iter->iter;
 }
@@ -287,10 +307,14 @@ index_storage_attribute_iter_next(struct mailbox_attribute_iter *_iter)
 		(struct index_storage_attribute_iter *)_iter;
 	const char *key, *value;
 
+	iter->last_key = iter->last_value = NULL;
 	if (iter->diter == NULL || !dict_iterate(iter->diter, &key, &value))
 		return NULL;
 
 	i_assert(strncmp(key, iter->prefix, iter->prefix_len) == 0);
+	/* these stay valid until the next dict_iterate() call */
+	iter->last_key = key;
+	iter->last_value = value;
 	key += iter->prefix_len;
 	return key;
 }
@@ -299,8 +323,11 @@ int index_storage_attribute_iter_deinit(struct mailbox_attribute_iter *_iter)
 {
 	struct index_storage_attribute_iter *iter =
 		(struct index_storage_attribute_iter *)_iter;
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(_iter->box);
 	int ret;
 
+	if (ibox != NULL && ibox->attr_iter == iter)
+		ibox->attr_iter = NULL;
 	if (iter->diter == NULL) {
 		ret = iter->dict_disabled ? 0 : -1;
 	} else {
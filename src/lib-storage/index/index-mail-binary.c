@@ -1,7 +1,12 @@
 /* Copyright (c) 2002-2016 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
+#include "ioloop.h"
 #include "str.h"
+#include "crc32.h"
+#include "mkdir-parents.h"
+#include "unlink-directory.h"
 #include "safe-mkstemp.h"
 #include "istream.h"
 #include "istream-crlf.h"
@@ -17,7 +22,22 @@
 #include "index-storage.h"
 #include "index-mail.h"
 
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+
 #define MAIL_BINARY_CACHE_EXPIRE_MSECS (60*1000)
+/* mail_binary_cache_dir is split into this many subdirectories by the mail
+   GUID's hash. Each one gets the same share of mail_binary_cache_max_size. */
+#define MAIL_BINARY_STORE_BUCKET_COUNT 16
+/* When evicting, delete files until this much of the max size is used */
+#define MAIL_BINARY_STORE_EVICT_TARGET_PERCENTAGE 90
+/* Delete temp files left behind by crashed processes after this long */
+#define MAIL_BINARY_STORE_TEMP_FILE_TIMEOUT_SECS (60*60)
+#define MAIL_BINARY_STORE_TEMP_PREFIX ".temp."
 
 #define IS_CONVERTED_CTE(cte) \
 	((cte) == MESSAGE_CTE_QP || (cte) == MESSAGE_CTE_BASE64)
@@ -29,6 +49,13 @@ struct binary_block {
 	bool converted, converted_hdr;
 };
 
+struct binary_store_file {
+	const char *mail_dir, *path;
+	time_t mtime;
+	uoff_t size;
+};
+ARRAY_DEFINE_TYPE(binary_store_file, struct binary_store_file);
+
 struct binary_ctx {
 	struct mail *mail;
 	struct istream *input;
@@ -359,6 +386,313 @@ blocks_count_lines(struct binary_ctx *ctx, struct istream *full_input)
 	return 0;
 }
 
+static uoff_t binary_store_get_bucket_max_size(struct mail_storage *storage)
+{
+	return storage->set->mail_binary_cache_max_size /
+		MAIL_BINARY_STORE_BUCKET_COUNT;
+}
+
+static const char *
+binary_store_get_mail_dir(struct mail_storage *storage, const char *guid)
+{
+	const char *dir;
+
+	if (*storage->set->mail_binary_cache_dir == '\0')
+		return NULL;
+	if (guid[0] == '\0' || guid[0] == '.' || strchr(guid, '/') != NULL)
+		return NULL;
+
+	dir = mail_user_home_expand(storage->user,
+				    storage->set->mail_binary_cache_dir);
+	return t_strdup_printf("%s/%x/%s", dir,
+			       crc32_str(guid) % MAIL_BINARY_STORE_BUCKET_COUNT,
+			       guid);
+}
+
+static const char *
+binary_store_get_path(struct mail *_mail, const struct message_part *part,
+		      bool include_hdr)
+{
+	const char *guid, *dir;
+
+	if (*_mail->box->storage->set->mail_binary_cache_dir == '\0')
+		return NULL;
+	if (mail_get_special(_mail, MAIL_FETCH_GUID, &guid) < 0)
+		return NULL;
+	dir = binary_store_get_mail_dir(_mail->box->storage, guid);
+	if (dir == NULL)
+		return NULL;
+
+	return t_strdup_printf("%s/%"PRIuUOFF_T"-%c", dir, part->physical_pos,
+			       include_hdr ? 'h' : 'b');
+}
+
+static int
+binary_store_file_cmp(const struct binary_store_file *f1,
+		      const struct binary_store_file *f2)
+{
+	if (f1->mtime < f2->mtime)
+		return -1;
+	if (f1->mtime > f2->mtime)
+		return 1;
+	return 0;
+}
+
+static void
+binary_store_rmdir_if_empty(const char *dir)
+{
+	if (rmdir(dir) < 0 && errno != ENOENT &&
+	    errno != ENOTEMPTY && errno != EEXIST)
+		i_error("rmdir(%s) failed: %m", dir);
+}
+
+static void
+binary_store_evict_scan_mail(const char *mail_dir,
+			     ARRAY_TYPE(binary_store_file) *files,
+			     uoff_t *total_size)
+{
+	struct binary_store_file *file;
+	const char *path;
+	struct dirent *d;
+	struct stat st;
+	bool found = FALSE;
+	DIR *dirp;
+
+	dirp = opendir(mail_dir);
+	if (dirp == NULL) {
+		if (errno != ENOENT && errno != ENOTDIR)
+			i_error("opendir(%s) failed: %m", mail_dir);
+		return;
+	}
+	while ((d = readdir(dirp)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+
+		path = t_strdup_printf("%s/%s", mail_dir, d->d_name);
+		if (stat(path, &st) < 0) {
+			if (errno != ENOENT)
+				i_error("stat(%s) failed: %m", path);
+			continue;
+		}
+		file = array_append_space(files);
+		file->mail_dir = mail_dir;
+		file->path = path;
+		file->mtime = st.st_mtime;
+		file->size = st.st_size;
+		*total_size += st.st_size;
+		found = TRUE;
+	}
+	if (closedir(dirp) < 0)
+		i_error("closedir(%s) failed: %m", mail_dir);
+	if (!found) {
+		/* the mail was expunged or evicted while a file was being
+		   saved for it */
+		binary_store_rmdir_if_empty(mail_dir);
+	}
+}
+
+static void
+binary_store_evict(struct mail_storage *storage, const char *bucket_dir,
+		   const char *new_path)
+{
+	ARRAY_TYPE(binary_store_file) files;
+	struct binary_store_file *file;
+	const char *path;
+	struct dirent *d;
+	struct stat st;
+	uoff_t total_size = 0, max_size, target_size;
+	DIR *dirp;
+
+	/* only the bucket that was just written to is checked, so this
+	   stats only about 1/MAIL_BINARY_STORE_BUCKET_COUNT of the files */
+	dirp = opendir(bucket_dir);
+	if (dirp == NULL) {
+		if (errno != ENOENT)
+			i_error("opendir(%s) failed: %m", bucket_dir);
+		return;
+	}
+
+	t_array_init(&files, 32);
+	while ((d = readdir(dirp)) != NULL) {
+		if (d->d_name[0] != '.') {
+			binary_store_evict_scan_mail(
+				t_strdup_printf("%s/%s", bucket_dir, d->d_name),
+				&files, &total_size);
+			continue;
+		}
+		if (strncmp(d->d_name, MAIL_BINARY_STORE_TEMP_PREFIX,
+			    strlen(MAIL_BINARY_STORE_TEMP_PREFIX)) != 0)
+			continue;
+
+		path = t_strdup_printf("%s/%s", bucket_dir, d->d_name);
+		if (stat(path, &st) < 0) {
+			if (errno != ENOENT)
+				i_error("stat(%s) failed: %m", path);
+		} else if (st.st_mtime + MAIL_BINARY_STORE_TEMP_FILE_TIMEOUT_SECS <
+			   ioloop_time) {
+			i_unlink_if_exists(path);
+		}
+	}
+	if (closedir(dirp) < 0)
+		i_error("closedir(%s) failed: %m", bucket_dir);
+
+	max_size = binary_store_get_bucket_max_size(storage);
+	if (total_size <= max_size)
+		return;
+
+	/* delete the least recently used files first. the file that was
+	   just saved is kept, even if its mtime isn't newer than the rest. */
+	target_size = max_size / 100 * MAIL_BINARY_STORE_EVICT_TARGET_PERCENTAGE;
+	array_sort(&files, binary_store_file_cmp);
+	array_foreach_modifiable(&files, file) {
+		if (total_size <= target_size)
+			break;
+		if (strcmp(file->path, new_path) == 0)
+			continue;
+		if (i_unlink_if_exists(file->path) < 0)
+			continue;
+		total_size -= file->size;
+		binary_store_rmdir_if_empty(file->mail_dir);
+	}
+}
+
+static void
+binary_store_save(struct mail *_mail, const char *path, struct istream *input)
+{
+	struct mail_storage *storage = _mail->box->storage;
+	struct ostream *output;
+	const char *mail_dir, *bucket_dir;
+	string_t *temp_path;
+	int fd, ret;
+
+	mail_dir = t_strdup_until(path, strrchr(path, '/'));
+	bucket_dir = t_strdup_until(mail_dir, strrchr(mail_dir, '/'));
+	temp_path = t_str_new(256);
+	str_printfa(temp_path, "%s/"MAIL_BINARY_STORE_TEMP_PREFIX, bucket_dir);
+	fd = safe_mkstemp_hostpid(temp_path, 0600, (uid_t)-1, (gid_t)-1);
+	if (fd == -1 && errno == ENOENT) {
+		if (mkdir_parents(bucket_dir, 0700) < 0 && errno != EEXIST) {
+			i_error("mkdir_parents(%s) failed: %m", bucket_dir);
+			return;
+		}
+		str_truncate(temp_path, 0);
+		str_printfa(temp_path, "%s/"MAIL_BINARY_STORE_TEMP_PREFIX,
+			    bucket_dir);
+		fd = safe_mkstemp_hostpid(temp_path, 0600, (uid_t)-1, (gid_t)-1);
+	}
+	if (fd == -1) {
+		i_error("safe_mkstemp(%s) failed: %m", str_c(temp_path));
+		return;
+	}
+
+	output = o_stream_create_fd_file(fd, 0, FALSE);
+	o_stream_cork(output);
+	if (o_stream_send_istream(output, input) < 0 ||
+	    input->stream_errno != 0) {
+		if (input->stream_errno != 0) {
+			i_error("read(%s) failed: %s", i_stream_get_name(input),
+				i_stream_get_error(input));
+		} else {
+			i_error("write(%s) failed: %s", str_c(temp_path),
+				o_stream_get_error(output));
+		}
+		o_stream_destroy(&output);
+		i_close_fd(&fd);
+		i_unlink(str_c(temp_path));
+		i_stream_seek(input, 0);
+		return;
+	}
+	if (o_stream_nfinish(output) < 0) {
+		i_error("write(%s) failed: %s", str_c(temp_path),
+			o_stream_get_error(output));
+		o_stream_destroy(&output);
+		i_close_fd(&fd);
+		i_unlink(str_c(temp_path));
+		i_stream_seek(input, 0);
+		return;
+	}
+	o_stream_destroy(&output);
+	i_close_fd(&fd);
+	i_stream_seek(input, 0);
+
+	ret = rename(str_c(temp_path), path);
+	if (ret < 0 && errno == ENOENT) {
+		/* the mail's first stored part, or the directory was just
+		   deleted by eviction */
+		if (mkdir(mail_dir, 0700) < 0 && errno != EEXIST) {
+			i_error("mkdir(%s) failed: %m", mail_dir);
+			i_unlink(str_c(temp_path));
+			return;
+		}
+		ret = rename(str_c(temp_path), path);
+	}
+	if (ret < 0) {
+		i_error("rename(%s, %s) failed: %m", str_c(temp_path), path);
+		i_unlink(str_c(temp_path));
+		return;
+	}
+	T_BEGIN {
+		binary_store_evict(storage, bucket_dir, path);
+	} T_END;
+}
+
+void index_mail_binary_store_expunge(struct mail *_mail, const char *guid)
+{
+	const char *mail_dir;
+
+	mail_dir = binary_store_get_mail_dir(_mail->box->storage, guid);
+	if (mail_dir == NULL)
+		return;
+
+	/* copies of the mail with the same GUID lose their stored parts
+	   as well, but they're decoded again when needed */
+	if (unlink_directory(mail_dir, UNLINK_DIRECTORY_FLAG_RMDIR) < 0)
+		i_error("unlink_directory(%s) failed: %m", mail_dir);
+}
+
+static bool
+binary_store_open(struct mail *_mail, const struct message_part *part,
+		  bool include_hdr)
+{
+	struct mail_binary_cache *cache = &_mail->box->storage->binary_cache;
+	const char *path;
+	struct stat st;
+	int fd;
+
+	path = binary_store_get_path(_mail, part, include_hdr);
+	if (path == NULL)
+		return FALSE;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			i_error("open(%s) failed: %m", path);
+		return FALSE;
+	}
+	if (fstat(fd, &st) < 0) {
+		i_error("fstat(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return FALSE;
+	}
+	/* the mtime is used for finding the least recently used files */
+	if (st.st_mtime != ioloop_time && utime(path, NULL) < 0 &&
+	    errno != ENOENT)
+		i_error("utime(%s) failed: %m", path);
+
+	mail_storage_free_binary_cache(_mail->box->storage);
+	cache->to = timeout_add(MAIL_BINARY_CACHE_EXPIRE_MSECS,
+				mail_storage_free_binary_cache,
+				_mail->box->storage);
+	cache->box = _mail->box;
+	cache->uid = _mail->uid;
+	cache->orig_physical_pos = part->physical_pos;
+	cache->include_hdr = include_hdr;
+	cache->input = i_stream_create_fd_autoclose(&fd, IO_BLOCK_SIZE);
+	i_stream_set_name(cache->input, path);
+	cache->size = st.st_size;
+	return TRUE;
+}
+
 static int
 index_mail_read_binary_to_cache(struct mail *_mail,
 				const struct message_part *part,
@@ -368,6 +702,7 @@ index_mail_read_binary_to_cache(struct mail *_mail,
 	struct index_mail *mail = (struct index_mail *)_mail;
 	struct mail_binary_cache *cache = &_mail->box->storage->binary_cache;
 	struct binary_ctx ctx;
+	const char *store_path;
 
 	memset(&ctx, 0, sizeof(ctx));
 	ctx.mail = _mail;
@@ -427,6 +762,12 @@ index_mail_read_binary_to_cache(struct mail *_mail,
 	}
 	binary_streams_free(&ctx);
 
+	if (ctx.converted &&
+	    cache->size <=
+	    binary_store_get_bucket_max_size(_mail->box->storage) &&
+	    (store_path = binary_store_get_path(_mail, part, include_hdr)) != NULL)
+		binary_store_save(_mail, store_path, cache->input);
+
 	*binary_r = ctx.converted ? TRUE : ctx.has_nuls;
 	*converted_r = ctx.converted;
 	return 0;
@@ -566,6 +907,10 @@ int index_mail_get_binary_stream(struct mail *_mail,
 		timeout_reset(cache->to);
 		binary = TRUE;
 		converted = TRUE;
+	} else if (binary_store_open(_mail, part, include_hdr)) {
+		/* decoded earlier and stored to mail_binary_cache_dir */
+		binary = TRUE;
+		converted = TRUE;
 	} else {
 		if (index_mail_read_binary_to_cache(_mail, part, include_hdr,
 						    &binary, &converted) < 0)
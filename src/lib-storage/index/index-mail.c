@@ -634,6 +634,16 @@ static void index_mail_body_parsed_cache_flags(struct index_mail *mail)
 		cache_flags |= MAIL_CACHE_FLAG_HAS_NO_NULS;
 	}
 
+	if (data->dot_lines_parsed) {
+		if (data->have_dot_lines) {
+			_mail->has_no_dot_lines = FALSE;
+			cache_flags &= ~MAIL_CACHE_FLAG_NO_DOT_LINES;
+		} else {
+			_mail->has_no_dot_lines = TRUE;
+			cache_flags |= MAIL_CACHE_FLAG_NO_DOT_LINES;
+		}
+	}
+
 	if (data->hdr_size.virtual_size == data->hdr_size.physical_size)
 		cache_flags |= MAIL_CACHE_FLAG_BINARY_HEADER;
 	if (data->body_size.virtual_size == data->body_size.physical_size)
@@ -968,8 +978,16 @@ index_mail_parse_body_finish(struct index_mail *mail,
 {
 	struct istream *parser_input = mail->data.parser_input;
 	const char *error = NULL;
+	bool have_dot_lines;
 	int ret;
 
+	if (success && mail->data.parser_ctx != NULL &&
+	    message_parser_get_dot_lines(mail->data.parser_ctx,
+					 &have_dot_lines)) {
+		mail->data.dot_lines_parsed = TRUE;
+		mail->data.have_dot_lines = have_dot_lines;
+	}
+
 	if (parser_input == NULL) {
 		ret = message_parser_deinit_from_parts(&mail->data.parser_ctx,
 			&mail->data.parts, &error) < 0 ? 0 : 1;
@@ -1552,6 +1570,7 @@ static void index_mail_reset_data(struct index_mail *mail)
 	mail->mail.mail.expunged = FALSE;
 	mail->mail.mail.has_nuls = FALSE;
 	mail->mail.mail.has_no_nuls = FALSE;
+	mail->mail.mail.has_no_dot_lines = FALSE;
 	mail->mail.mail.saving = FALSE;
 }
 
@@ -1624,6 +1643,8 @@ void index_mail_update_access_parts_pre(struct mail *_mail)
 			(data->cache_flags & MAIL_CACHE_FLAG_HAS_NULS) != 0;
 		_mail->has_no_nuls =
 			(data->cache_flags & MAIL_CACHE_FLAG_HAS_NO_NULS) != 0;
+		_mail->has_no_dot_lines =
+			(data->cache_flags & MAIL_CACHE_FLAG_NO_DOT_LINES) != 0;
 		/* we currently don't forcibly set the nul state. if it's not
 		   already cached, the caller can figure out itself what to
 		   do when neither is set */
@@ -2084,6 +2105,7 @@ void index_mail_expunge(struct mail *mail)
 		mail_generate_guid_128_hash(value, guid_128);
 		mail_index_expunge_guid(mail->transaction->itrans,
 					mail->seq, guid_128);
+		index_mail_binary_store_expunge(mail, value);
 	}
 }
 
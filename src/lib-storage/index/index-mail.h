@@ -50,7 +50,11 @@ enum mail_cache_record_flag {
 
 	/* BODY is IMAP_BODY_PLAIN_7BIT_ASCII and rest of BODYSTRUCTURE
 	   fields are NIL */
-	MAIL_CACHE_FLAG_TEXT_PLAIN_7BIT_ASCII	= 0x0010
+	MAIL_CACHE_FLAG_TEXT_PLAIN_7BIT_ASCII	= 0x0010,
+
+	/* None of the mail's lines begin with '.', so it can be sent as
+	   POP3 reply without dot-stuffing. */
+	MAIL_CACHE_FLAG_NO_DOT_LINES		= 0x0040
 };
 
 enum index_mail_access_part {
@@ -129,6 +133,8 @@ struct index_mail_data {
 	unsigned int destroy_callback_set:1;
 	unsigned int prefetch_sent:1;
 	unsigned int header_parser_initialized:1;
+	unsigned int dot_lines_parsed:1;
+	unsigned int have_dot_lines:1;
 };
 
 struct index_mail {
@@ -222,6 +228,8 @@ int index_mail_get_binary_stream(struct mail *_mail,
 				 bool include_hdr, uoff_t *size_r,
 				 unsigned int *body_lines_r, bool *binary_r,
 				 struct istream **stream_r);
+/* Delete the mail's decoded parts from mail_binary_cache_dir */
+void index_mail_binary_store_expunge(struct mail *mail, const char *guid);
 int index_mail_get_special(struct mail *_mail, enum mail_fetch_field field,
 			   const char **value_r);
 struct mail *index_mail_get_real_mail(struct mail *mail);
@@ -20,8 +20,10 @@
    vsize updates before locking syncing (to avoid deadlocks). Check if the
    message count + last-indexed-uid are still valid. If not, unlock vsize and
    do nothing else. Otherwise, for each expunged mail whose UID <=
-   last-indexed-uid, decrease the message count and the vsize in memory. After
-   syncing is successfully committed, write the changes to header. Unlock.
+   last-indexed-uid, decrease the message count and the vsize in memory. The
+   expunged mails' vsizes are looked up from cache while syncing, so the
+   header is rebuilt only if some of them aren't known. After syncing is
+   successfully committed, write the changes to header. Unlock.
 
    Note that the final expunge handling with some mailbox formats is done while
    syncing is no longer locked. Because of this we need to have the vsize
@@ -231,6 +233,23 @@ void index_mailbox_vsize_hdr_expunge(struct mailbox_vsize_update *update,
 	update->vsize_hdr.vsize -= vsize;
 }
 
+void index_mailbox_vsize_hdr_expunge_mail(struct mailbox_vsize_update *update,
+					  struct mail *mail, uint32_t uid)
+{
+	uoff_t vsize;
+
+	i_assert(update->lock != NULL);
+
+	if (uid > update->vsize_hdr.highest_uid)
+		return;
+	if (mail_set_uid(mail, uid) && mail_get_virtual_size(mail, &vsize) == 0)
+		index_mailbox_vsize_hdr_expunge(update, uid, vsize);
+	else {
+		/* vsize isn't known - rebuild the header later */
+		memset(&update->vsize_hdr, 0, sizeof(update->vsize_hdr));
+	}
+}
+
 static int
 index_mailbox_vsize_hdr_add_missing(struct mailbox_vsize_update *update,
 				    bool need_result)
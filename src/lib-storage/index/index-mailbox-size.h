@@ -1,6 +1,7 @@
 #ifndef INDEX_MAILBOX_SIZE_H
 #define INDEX_MAILBOX_SIZE_H
 
+struct mail;
 struct mailbox;
 
 struct mailbox_vsize_update *
@@ -9,6 +10,10 @@ void index_mailbox_vsize_update_deinit(struct mailbox_vsize_update **update);
 
 void index_mailbox_vsize_hdr_expunge(struct mailbox_vsize_update *update,
 				     uint32_t uid, uoff_t vsize);
+/* Like index_mailbox_vsize_hdr_expunge(), but look up the vsize using the
+   given mail. If it can't be found, the vsize header is rebuilt later. */
+void index_mailbox_vsize_hdr_expunge_mail(struct mailbox_vsize_update *update,
+					  struct mail *mail, uint32_t uid);
 
 bool index_mailbox_vsize_update_try_lock(struct mailbox_vsize_update *update);
 bool index_mailbox_vsize_update_wait_lock(struct mailbox_vsize_update *update);
@@ -19,6 +19,8 @@ struct index_search_context {
 	struct mail *cur_mail;
 	struct index_mail *cur_imail;
 	struct mail_thread_context *thread_ctx;
+	/* original order of the search args, restored at deinit */
+	struct mail_search_args_order *args_order;
 
 	ARRAY(struct mail *) mails;
 	unsigned int unused_mail_idx;
@@ -27,6 +29,8 @@ struct index_search_context {
 	struct timeval search_start_time, last_notify;
 	struct timeval last_nonblock_timeval;
 	unsigned long long cost, next_time_check_cost;
+	/* all matching messages have at least this modseq, 0 if unknown */
+	uint64_t min_modseq;
 
 	unsigned int failed:1;
 	unsigned int sorted:1;
@@ -36,6 +36,16 @@
 #define SEARCH_INITIAL_MAX_COST 30000
 #define SEARCH_RECALC_MIN_USECS 50000
 
+/* Estimated relative costs of checking a search arg for one mail. These are
+   used only for ordering the search args, so that the expensive ones can be
+   skipped when the cheaper ones already decided the result. */
+#define SEARCH_ARG_COST_INDEX 1
+#define SEARCH_ARG_COST_CACHE 5
+#define SEARCH_ARG_COST_STAT 20
+#define SEARCH_ARG_COST_HEADER 100
+#define SEARCH_ARG_COST_READ 500
+#define SEARCH_ARG_COST_BODY 1000
+
 struct search_header_context {
         struct index_search_context *index_ctx;
         struct index_mail *imail;
@@ -1055,6 +1065,144 @@ static void search_get_seqset(struct index_search_context *ctx,
 	}
 }
 
+static unsigned int
+search_arg_cache_cost(struct index_search_context *ctx, const char *field_name,
+		      unsigned int uncached_cost)
+{
+	enum mail_cache_decision_type dec;
+	unsigned int field_idx;
+
+	if (ctx->box->cache == NULL)
+		return uncached_cost;
+	field_idx = mail_cache_register_lookup(ctx->box->cache, field_name);
+	if (field_idx == UINT_MAX)
+		return uncached_cost;
+	dec = mail_cache_field_get_decision(ctx->box->cache, field_idx);
+	return (dec & ~MAIL_CACHE_DECISION_FORCED) == MAIL_CACHE_DECISION_NO ?
+		uncached_cost : SEARCH_ARG_COST_CACHE;
+}
+
+static unsigned int
+search_arg_date_cost(struct index_search_context *ctx,
+		     const struct mail_search_arg *arg)
+{
+	switch (arg->value.date_type) {
+	case MAIL_SEARCH_DATE_TYPE_SENT:
+		return search_arg_cache_cost(ctx, "date.sent",
+					     SEARCH_ARG_COST_HEADER);
+	case MAIL_SEARCH_DATE_TYPE_RECEIVED:
+		return search_arg_cache_cost(ctx, "date.received",
+					     SEARCH_ARG_COST_STAT);
+	case MAIL_SEARCH_DATE_TYPE_SAVED:
+		return search_arg_cache_cost(ctx, "date.save",
+					     SEARCH_ARG_COST_STAT);
+	}
+	i_unreached();
+}
+
+static void
+search_arg_estimate(const struct mail_search_arg *arg,
+		    struct index_search_context *ctx,
+		    unsigned int *cost_r, unsigned int *match_pct_r)
+{
+	unsigned int messages_count = ctx->mail_ctx.progress_max;
+	unsigned int count;
+
+	switch (arg->type) {
+	case SEARCH_OR:
+	case SEARCH_SUB:
+		i_unreached();
+	case SEARCH_ALL:
+		*cost_r = 0;
+		*match_pct_r = 99;
+		break;
+	case SEARCH_SEQSET:
+		*cost_r = SEARCH_ARG_COST_INDEX;
+		count = seq_range_count(&arg->value.seqset);
+		*match_pct_r = messages_count == 0 ? 50 :
+			count >= messages_count ? 99 :
+			count * 100ULL / messages_count;
+		break;
+	case SEARCH_UIDSET:
+	case SEARCH_MODSEQ:
+	case SEARCH_INTHREAD:
+	case SEARCH_MAILBOX:
+	case SEARCH_MAILBOX_GUID:
+	case SEARCH_MAILBOX_GLOB:
+		*cost_r = SEARCH_ARG_COST_INDEX;
+		*match_pct_r = 50;
+		break;
+	case SEARCH_FLAGS:
+		*cost_r = SEARCH_ARG_COST_INDEX;
+		/* most mails are usually \Seen, few have the other flags */
+		*match_pct_r = arg->value.flags == MAIL_SEEN ? 80 : 10;
+		break;
+	case SEARCH_KEYWORDS:
+		*cost_r = SEARCH_ARG_COST_INDEX;
+		*match_pct_r = 10;
+		break;
+	case SEARCH_BEFORE:
+	case SEARCH_SINCE:
+		*cost_r = search_arg_date_cost(ctx, arg);
+		*match_pct_r = 50;
+		break;
+	case SEARCH_ON:
+		*cost_r = search_arg_date_cost(ctx, arg);
+		*match_pct_r = 5;
+		break;
+	case SEARCH_SMALLER:
+	case SEARCH_LARGER:
+		/* without the cached size the whole mail needs to be read */
+		*cost_r = search_arg_cache_cost(ctx, "size.virtual",
+						SEARCH_ARG_COST_READ);
+		*match_pct_r = 50;
+		break;
+	case SEARCH_HEADER:
+	case SEARCH_HEADER_ADDRESS:
+	case SEARCH_HEADER_COMPRESS_LWSP:
+		*cost_r = search_arg_cache_cost(ctx,
+				t_strconcat("hdr.", arg->hdr_field_name, NULL),
+				SEARCH_ARG_COST_HEADER);
+		*match_pct_r = 10;
+		break;
+	case SEARCH_BODY:
+	case SEARCH_TEXT:
+		*cost_r = SEARCH_ARG_COST_BODY;
+		*match_pct_r = 10;
+		break;
+	case SEARCH_GUID:
+		*cost_r = search_arg_cache_cost(ctx, "guid",
+						SEARCH_ARG_COST_STAT);
+		*match_pct_r = 1;
+		break;
+	case SEARCH_REAL_UID:
+		*cost_r = SEARCH_ARG_COST_STAT;
+		*match_pct_r = 50;
+		break;
+	default:
+		*cost_r = SEARCH_ARG_COST_BODY;
+		*match_pct_r = 50;
+		break;
+	}
+}
+
+static void search_args_order_by_cost(struct index_search_context *ctx,
+				      struct mail_search_args *args)
+{
+	string_t *explain = NULL;
+
+	T_BEGIN {
+		if (ctx->box->storage->set->mail_debug)
+			explain = t_str_new(256);
+		ctx->args_order = mail_search_args_order_by_cost(args,
+					search_arg_estimate, ctx, explain);
+		if (ctx->args_order != NULL && explain != NULL) {
+			i_debug("%s: Search plan: %s", ctx->box->vname,
+				str_c(explain));
+		}
+	} T_END;
+}
+
 static int search_build_subthread(struct mail_thread_iterate_context *iter,
 				  ARRAY_TYPE(seq_range) *uids)
 {
@@ -1205,6 +1353,18 @@ wanted_sort_fields_get(struct mailbox *box,
 	}
 }
 
+static void
+search_init_min_modseq(struct index_search_context *ctx,
+		       const struct mail_search_arg *args)
+{
+	/* the top level args are ANDed together */
+	for (; args != NULL; args = args->next) {
+		if (args->type == SEARCH_MODSEQ && !args->match_not &&
+		    ctx->min_modseq < args->value.modseq->modseq)
+			ctx->min_modseq = args->value.modseq->modseq;
+	}
+}
+
 struct mail_search_context *
 index_storage_search_init(struct mailbox_transaction_context *t,
 			  struct mail_search_args *args,
@@ -1257,7 +1417,9 @@ index_storage_search_init(struct mailbox_transaction_context *t,
 	ctx->mail_ctx.wanted_fields |= wanted_fields;
 
 	search_get_seqset(ctx, status.messages, args->args);
+	search_args_order_by_cost(ctx, args);
 	(void)mail_search_args_foreach(args->args, search_init_arg, ctx);
+	search_init_min_modseq(ctx, args->args);
 
 	/* Need to reset results for match_always cases */
 	mail_search_args_reset(ctx->mail_ctx.args->args, FALSE);
@@ -1287,6 +1449,8 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 	mail_search_args_reset(ctx->mail_ctx.args->args, FALSE);
 	(void)mail_search_args_foreach(ctx->mail_ctx.args->args,
 				       search_arg_deinit, ctx);
+	if (ctx->args_order != NULL)
+		mail_search_args_order_restore(&ctx->args_order);
 
 	if (ctx->mail_ctx.wanted_headers != NULL)
 		mailbox_header_lookup_unref(&ctx->mail_ctx.wanted_headers);
@@ -1786,6 +1950,16 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 
 	ret = 0;
 	while (_ctx->seq <= ctx->seq2) {
+		if (ctx->min_modseq != 0) {
+			/* skip over blocks of messages that haven't changed
+			   since the wanted modseq */
+			_ctx->seq = mail_index_modseq_next_changed_seq(ctx->view,
+						_ctx->seq, ctx->min_modseq);
+			if (_ctx->seq > ctx->seq2) {
+				_ctx->seq = ctx->seq2 + 1;
+				break;
+			}
+		}
 		/* check if the sequence matches */
 		ret = mail_search_args_foreach(ctx->mail_ctx.args->args,
 					       search_seqset_arg, ctx);
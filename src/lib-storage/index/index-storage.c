@@ -813,16 +813,14 @@ void index_save_context_free(struct mail_save_context *ctx)
 
 static void
 mail_copy_cache_field(struct mail_save_context *ctx, struct mail *src_mail,
-		      uint32_t dest_seq, const char *name, buffer_t *buf)
+		      uint32_t dest_seq, unsigned int src_field_idx,
+		      const char *name, buffer_t *buf)
 {
 	struct mailbox_transaction_context *dest_trans = ctx->transaction;
 	const struct mail_cache_field *dest_field;
-	unsigned int src_field_idx, dest_field_idx;
+	unsigned int dest_field_idx;
 	uint32_t t;
 
-	src_field_idx = mail_cache_register_lookup(src_mail->box->cache, name);
-	i_assert(src_field_idx != UINT_MAX);
-
 	dest_field_idx = mail_cache_register_lookup(dest_trans->box->cache, name);
 	if (dest_field_idx == UINT_MAX) {
 		/* unknown field */
@@ -873,26 +871,30 @@ void index_copy_cache_fields(struct mail_save_context *ctx,
 			     struct mail *src_mail, uint32_t dest_seq)
 {
 	T_BEGIN {
-		struct mailbox_metadata src_metadata, dest_metadata;
-		const struct mailbox_cache_field *field;
+		const struct mail_cache_field *src_fields;
+		enum mail_cache_decision_type dec;
+		unsigned int i, count, dest_count;
 		buffer_t *buf;
 
-		if (mailbox_get_metadata(src_mail->box,
-					 MAILBOX_METADATA_CACHE_FIELDS,
-					 &src_metadata) < 0)
-			i_unreached();
+		/* not using MAILBOX_METADATA_CACHE_FIELDS here, because it
+		   allocates the field list from the mailbox's metadata pool,
+		   which would grow with each copied mail. */
+		src_fields = mail_cache_register_get_list(src_mail->box->cache,
+					pool_datastack_create(), &count);
 		/* the only reason we're doing the destination lookup is to
 		   make sure that the cache file is opened and the cache
 		   decisinos are up to date */
-		if (mailbox_get_metadata(ctx->transaction->box,
-					 MAILBOX_METADATA_CACHE_FIELDS,
-					 &dest_metadata) < 0)
-			i_unreached();
+		(void)mail_cache_register_get_list(ctx->transaction->box->cache,
+					pool_datastack_create(), &dest_count);
 
 		buf = buffer_create_dynamic(pool_datastack_create(), 1024);
-		array_foreach(src_metadata.cache_fields, field) {
+		for (i = 0; i < count; i++) {
+			dec = src_fields[i].decision & ~MAIL_CACHE_DECISION_FORCED;
+			if (dec == MAIL_CACHE_DECISION_NO)
+				continue;
 			mail_copy_cache_field(ctx, src_mail, dest_seq,
-					      field->name, buf);
+					      src_fields[i].idx,
+					      src_fields[i].name, buf);
 		}
 	} T_END;
 }
@@ -969,6 +971,58 @@ void index_storage_expunging_deinit(struct mailbox *box)
 		index_mailbox_vsize_update_deinit(&ibox->vsize_update);
 }
 
+void index_storage_sync_notify(struct mailbox *box, uint32_t uid,
+			       enum mailbox_sync_type sync_type)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
+
+	if (uid == 0) {
+		/* sync finished. free the transaction before view syncing
+		   begins. */
+		if (ibox->vsize_expunge_mail != NULL) {
+			mail_free(&ibox->vsize_expunge_mail);
+			(void)mailbox_transaction_commit(&ibox->vsize_expunge_trans);
+		}
+		ibox->vsize_expunge_uid = 0;
+		return;
+	}
+	if (sync_type != MAILBOX_SYNC_TYPE_EXPUNGE || ibox->vsize_update == NULL)
+		return;
+
+	if (ibox->vsize_expunge_uid == uid) {
+		ibox->vsize_expunge_uid = 0;
+		index_mailbox_vsize_hdr_expunge(ibox->vsize_update, uid,
+						ibox->vsize_expunge_size);
+		return;
+	}
+
+	if (ibox->vsize_expunge_mail == NULL) {
+		/* box->view may not have all the mails that are being
+		   expunged */
+		ibox->vsize_expunge_trans = mailbox_transaction_begin(box,
+					MAILBOX_TRANSACTION_FLAG_SYNC_VIEW);
+		ibox->vsize_expunge_mail =
+			mail_alloc(ibox->vsize_expunge_trans,
+				   MAIL_FETCH_VIRTUAL_SIZE, NULL);
+		/* don't open the mail files in the middle of syncing */
+		ibox->vsize_expunge_mail->lookup_abort =
+			MAIL_LOOKUP_ABORT_NOT_IN_CACHE;
+	}
+	index_mailbox_vsize_hdr_expunge_mail(ibox->vsize_update,
+					     ibox->vsize_expunge_mail, uid);
+}
+
+void index_storage_sync_notify_expunge_vsize(struct mailbox *box,
+					     uint32_t uid, uoff_t vsize)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
+
+	if (ibox == NULL)
+		return;
+	ibox->vsize_expunge_uid = uid;
+	ibox->vsize_expunge_size = vsize;
+}
+
 static bool index_storage_expunging_want_updates(struct mailbox *box)
 {
 	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
@@ -29,11 +29,21 @@ struct index_mailbox_context {
 	struct mail_cache_field *cache_fields;
 
 	struct mailbox_vsize_update *vsize_update;
+	/* for looking up the vsizes of mails expunged while syncing */
+	struct mailbox_transaction_context *vsize_expunge_trans;
+	struct mail *vsize_expunge_mail;
+	/* vsize of the mail being expunged, if a plugin already knew it */
+	uint32_t vsize_expunge_uid;
+	uoff_t vsize_expunge_size;
 
 	uint32_t recent_flags_last_check_nextuid;
 
 	time_t sync_last_check;
 	uint32_t list_index_sync_ext_id;
+
+	/* the latest attribute iteration. the value of the key that it
+	   returned last can be looked up without accessing the dict. */
+	struct index_storage_attribute_iter *attr_iter;
 };
 
 #define INDEX_STORAGE_CONTEXT(obj) \
@@ -165,5 +175,11 @@ int index_storage_expunged_sync_begin(struct mailbox *box,
 				      struct mail_index_transaction **trans_r,
 				      enum mail_index_sync_flags flags);
 void index_storage_expunging_deinit(struct mailbox *box);
+void index_storage_sync_notify(struct mailbox *box, uint32_t uid,
+			       enum mailbox_sync_type sync_type);
+/* Tell the following index_storage_sync_notify() call for the expunged uid
+   that its vsize is already known, so it doesn't need to be looked up. */
+void index_storage_sync_notify_expunge_vsize(struct mailbox *box,
+					     uint32_t uid, uoff_t vsize);
 
 #endif
@@ -136,15 +136,19 @@ void index_transaction_init(struct mailbox_transaction_context *t,
 			    enum mailbox_transaction_flags flags)
 {
 	enum mail_index_transaction_flags itrans_flags;
+	struct mail_index_view *view = box->view;
 
 	i_assert(box->opened);
 
 	itrans_flags = index_transaction_flags_get(flags);
 	if ((flags & MAILBOX_TRANSACTION_FLAG_REFRESH) != 0)
 		mail_index_refresh(box->index);
+	if ((flags & MAILBOX_TRANSACTION_FLAG_SYNC_VIEW) != 0 &&
+	    box->tmp_sync_view != NULL)
+		view = box->tmp_sync_view;
 
 	t->box = box;
-	t->itrans = mail_index_transaction_begin(box->view, itrans_flags);
+	t->itrans = mail_index_transaction_begin(view, itrans_flags);
 	t->view = mail_index_transaction_open_updated_view(t->itrans);
 
 	array_create(&t->module_contexts, default_pool,
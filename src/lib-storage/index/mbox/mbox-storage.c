@@ -850,7 +850,7 @@ struct mailbox mbox_mailbox = {
 		mbox_storage_sync_init,
 		index_mailbox_sync_next,
 		index_mailbox_sync_deinit,
-		NULL,
+		index_storage_sync_notify,
 		mbox_notify_changes,
 		mbox_transaction_begin,
 		mbox_transaction_commit,
@@ -33,6 +33,8 @@ struct index_list_storage_module index_list_storage_module =
 #define MAILBOX_IS_NEVER_IN_INDEX(box) \
 	((box)->inbox_any)
 
+/* Returns the shared status view in view_r. It's owned by the list index,
+   so the caller must not close it. */
 static int
 index_list_open_view(struct mailbox *box, struct mail_index_view **view_r,
 		     uint32_t *seq_r)
@@ -54,7 +56,11 @@ index_list_open_view(struct mailbox *box, struct mail_index_view **view_r,
 		return 0;
 	}
 
-	view = mail_index_view_open(ilist->index);
+	/* the view stays valid until the next refresh, so when STATUS is
+	   asked for many mailboxes at once they all use the same snapshot */
+	if (ilist->status_view == NULL)
+		ilist->status_view = mail_index_view_open(ilist->index);
+	view = ilist->status_view;
 	if (!mail_index_lookup_seq(view, node->uid, &seq)) {
 		/* our in-memory tree is out of sync */
 		ret = 1;
@@ -69,7 +75,6 @@ index_list_open_view(struct mailbox *box, struct mail_index_view **view_r,
 			mailbox_list_index_refresh_later(box->list);
 		else
 			ilist->index_last_check_changed = TRUE;
-		mail_index_view_close(&view);
 		return ret < 0 ? -1 : 0;
 	}
 
@@ -97,7 +102,6 @@ index_list_exists(struct mailbox *box, bool auto_boxes,
 	}
 	rec = mail_index_lookup(view, seq);
 	flags = rec->flags;
-	mail_index_view_close(&view);
 
 	if ((flags & MAILBOX_LIST_INDEX_FLAG_NONEXISTENT) != 0)
 		*existence_r = MAILBOX_EXISTENCE_NONE;
@@ -196,10 +200,20 @@ index_list_get_cached_status(struct mailbox *box,
 	if ((ret = index_list_open_view(box, &view, &seq)) <= 0)
 		return ret;
 
-	ret = mailbox_list_index_status(box->list, view, seq, items,
-					status_r, NULL, NULL) ? 1 : 0;
-	mail_index_view_close(&view);
-	return ret;
+	return mailbox_list_index_status(box->list, view, seq, items,
+					 status_r, NULL, NULL) ? 1 : 0;
+}
+
+static void index_list_mailbox_open_avoided(struct mailbox *box)
+{
+	struct index_list_mailbox *ibox = INDEX_LIST_STORAGE_CONTEXT(box);
+
+	/* STATUS commonly asks for both status and metadata items.
+	   count the mailbox only once. */
+	if (!ibox->open_avoided) {
+		ibox->open_avoided = TRUE;
+		box->storage->user->mailbox_opens_avoided++;
+	}
 }
 
 static int
@@ -209,8 +223,10 @@ index_list_get_status(struct mailbox *box, enum mailbox_status_items items,
 	struct index_list_mailbox *ibox = INDEX_LIST_STORAGE_CONTEXT(box);
 
 	if ((items & ~CACHED_STATUS_ITEMS) == 0 && !box->opened) {
-		if (index_list_get_cached_status(box, items, status_r) > 0)
+		if (index_list_get_cached_status(box, items, status_r) > 0) {
+			index_list_mailbox_open_avoided(box);
 			return 0;
+		}
 		/* nonsynced / error, fallback to doing it the slow way */
 	}
 	return ibox->module_ctx.super.get_status(box, items, status_r);
@@ -237,7 +253,6 @@ index_list_get_cached_guid(struct mailbox *box, guid_128_t guid_r)
 					&status, guid_r, NULL) ? 1 : 0;
 	if (ret > 0 && guid_128_is_empty(guid_r))
 		ret = 0;
-	mail_index_view_close(&view);
 	return ret;
 }
 
@@ -265,7 +280,6 @@ static int index_list_get_cached_vsize(struct mailbox *box, uoff_t *vsize_r)
 	}
 	if (ret > 0)
 		*vsize_r = vsize.vsize;
-	mail_index_view_close(&view);
 	return ret;
 }
 
@@ -299,7 +313,6 @@ index_list_get_cached_first_saved(struct mailbox *box,
 		    status.messages != 0)
 			first_saved_r->timestamp = 0;
 	}
-	mail_index_view_close(&view);
 	return first_saved_r->timestamp != 0 ? 1 : 0;
 }
 
@@ -365,9 +378,13 @@ index_list_get_metadata(struct mailbox *box,
 			struct mailbox_metadata *metadata_r)
 {
 	struct index_list_mailbox *ibox = INDEX_LIST_STORAGE_CONTEXT(box);
+	int ret;
 
-	if (index_list_try_get_metadata(box, items, metadata_r) != 0)
+	if ((ret = index_list_try_get_metadata(box, items, metadata_r)) != 0) {
+		if (ret > 0 && items != 0)
+			index_list_mailbox_open_avoided(box);
 		return 0;
+	}
 	return ibox->module_ctx.super.get_metadata(box, items, metadata_r);
 }
 
@@ -680,7 +697,9 @@ static int index_list_update_mailbox(struct mailbox *box)
 		ilist->updating_status = FALSE;
 	}
 
-	if (mail_index_sync_commit(&list_sync_ctx) < 0) {
+	ret = mail_index_sync_commit(&list_sync_ctx);
+	mailbox_list_index_status_view_close(ilist);
+	if (ret < 0) {
 		mailbox_set_index_error(box);
 		return -1;
 	}
@@ -691,6 +710,7 @@ static int index_list_update_mailbox(struct mailbox *box)
 void mailbox_list_index_update_mailbox_index(struct mailbox *box,
 					     const struct mailbox_update *update)
 {
+	struct mailbox_list_index *ilist = INDEX_LIST_CONTEXT(box->list);
 	struct mail_index_view *list_view;
 	struct mail_index_transaction *list_trans;
 	struct index_list_changes changes;
@@ -731,7 +751,8 @@ void mailbox_list_index_update_mailbox_index(struct mailbox *box,
 					MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
 	index_list_update(box, list_view, list_trans, &changes);
 	(void)mail_index_transaction_commit(&list_trans);
-	mail_index_view_close(&list_view);
+	/* list_view was the shared status view, which is now outdated */
+	mailbox_list_index_status_view_close(ilist);
 }
 
 static int index_list_sync_deinit(struct mailbox_sync_context *ctx,
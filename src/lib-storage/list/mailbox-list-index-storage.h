@@ -8,6 +8,10 @@
 
 struct index_list_mailbox {
 	union mailbox_module_context module_ctx;
+
+	/* status/metadata was looked up from the list index without opening
+	   the mailbox (counted in mail_user.mailbox_opens_avoided) */
+	unsigned int open_avoided:1;
 };
 
 extern MODULE_CONTEXT_DEFINE(index_list_storage_module,
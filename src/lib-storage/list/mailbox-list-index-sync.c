@@ -370,6 +370,7 @@ int mailbox_list_index_sync_end(struct mailbox_list_index_sync_context **_sync_c
 		mail_index_sync_rollback(&sync_ctx->index_sync_ctx);
 		ret = -1;
 	}
+	mailbox_list_index_status_view_close(sync_ctx->ilist);
 	sync_ctx->ilist->syncing = FALSE;
 	sync_ctx->ilist->sync_ctx = NULL;
 	i_free(sync_ctx);
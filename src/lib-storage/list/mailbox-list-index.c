@@ -32,8 +32,15 @@ static void mailbox_list_index_init_pool(struct mailbox_list_index *ilist)
 	hash_table_create_direct(&ilist->mailbox_hash, ilist->mailbox_pool, 0);
 }
 
+void mailbox_list_index_status_view_close(struct mailbox_list_index *ilist)
+{
+	if (ilist->status_view != NULL)
+		mail_index_view_close(&ilist->status_view);
+}
+
 void mailbox_list_index_reset(struct mailbox_list_index *ilist)
 {
+	mailbox_list_index_status_view_close(ilist);
 	hash_table_destroy(&ilist->mailbox_names);
 	hash_table_destroy(&ilist->mailbox_hash);
 	pool_unref(&ilist->mailbox_pool);
@@ -439,6 +446,7 @@ int mailbox_list_index_refresh_force(struct mailbox_list *list)
 
 	i_assert(!ilist->syncing);
 
+	mailbox_list_index_status_view_close(ilist);
 	ilist->last_refresh_timeval = ioloop_timeval;
 	if (mailbox_list_index_index_open(list) < 0)
 		return -1;
@@ -493,6 +501,7 @@ void mailbox_list_index_refresh_later(struct mailbox_list *list)
 			&new_hdr.refresh_flag, sizeof(new_hdr.refresh_flag));
 		if (mail_index_transaction_commit(&trans) < 0)
 			mail_index_mark_corrupted(ilist->index);
+		mailbox_list_index_status_view_close(ilist);
 
 	}
 	mail_index_view_close(&view);
@@ -510,6 +519,7 @@ static void mailbox_list_index_deinit(struct mailbox_list *list)
 
 	if (ilist->to_refresh != NULL)
 		timeout_remove(&ilist->to_refresh);
+	mailbox_list_index_status_view_close(ilist);
 	if (ilist->index != NULL) {
 		hash_table_destroy(&ilist->mailbox_hash);
 		hash_table_destroy(&ilist->mailbox_names);
@@ -614,6 +624,7 @@ mailbox_list_index_set_subscribed(struct mailbox_list *_list,
 				     0, &counter, sizeof(counter));
 	(void)mail_index_transaction_commit(&trans);
 	mail_index_view_close(&view);
+	mailbox_list_index_status_view_close(ilist);
 	return 0;
 }
 
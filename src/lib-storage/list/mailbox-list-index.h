@@ -102,6 +102,10 @@ struct mailbox_list_index {
 	uoff_t sync_log_file_offset;
 	uint32_t sync_stamp;
 	struct timeout *to_refresh;
+	/* Snapshot of the index shared by all the STATUS/metadata lookups
+	   done between refreshes, so e.g. LIST-STATUS doesn't open a new
+	   view for each mailbox. Closed whenever the index changes. */
+	struct mail_index_view *status_view;
 
 	/* uint32_t uid => node */
 	HASH_TABLE(void *, struct mailbox_list_index_node *) mailbox_hash;
@@ -144,6 +148,7 @@ void mailbox_list_index_node_unlink(struct mailbox_list_index *ilist,
 				    struct mailbox_list_index_node *node);
 
 int mailbox_list_index_index_open(struct mailbox_list *list);
+void mailbox_list_index_status_view_close(struct mailbox_list_index *ilist);
 bool mailbox_list_index_need_refresh(struct mailbox_list_index *ilist,
 				     struct mail_index_view *view);
 /* Refresh the index, but only if it hasn't been refreshed "recently"
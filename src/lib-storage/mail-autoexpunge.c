@@ -1,21 +1,180 @@
 /* Copyright (c) 2015-2016 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "crc32.h"
 #include "ioloop.h"
+#include "eacces-error.h"
 #include "mailbox-list-iter.h"
 #include "mail-storage-private.h"
 #include "mail-namespace.h"
 #include "mail-user.h"
 #include "mail-autoexpunge.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+/* The file's mtime is the last time the namespace was autoexpunged.
+   Namespaces with a prefix append a hash of it to the name, since they may
+   share the index root directory with other namespaces. */
+#define AUTOEXPUNGE_STAMP_FNAME "dovecot.autoexpunge"
+
+/* Summary of the mails' save dates, kept in the mailbox index's header.
+   Each block covers a UID range and has the oldest and newest save date of
+   the mails that were in the range when the block was built. A mail's save
+   date doesn't change and new mails get higher UIDs, so a block can be
+   skipped if its oldest mail hasn't expired, and it can be expunged
+   without looking up the mails if its newest mail has expired. */
+#define AUTOEXPUNGE_SUMMARY_EXT_NAME "autoexpunge"
+#define AUTOEXPUNGE_SUMMARY_BLOCK_MAX_MAILS 256
+
+struct autoexpunge_summary_header {
+	/* the blocks are ignored if this doesn't match the mailbox */
+	uint32_t uid_validity;
+	uint32_t unused;
+	/* struct autoexpunge_summary_block blocks[]; sorted by UID */
+};
+
+struct autoexpunge_summary_block {
+	uint32_t first_uid, last_uid;
+	uint32_t mail_count;
+	uint32_t min_save_date, max_save_date;
+};
+ARRAY_DEFINE_TYPE(autoexpunge_summary_block, struct autoexpunge_summary_block);
+
+static const struct autoexpunge_summary_block *
+mailbox_autoexpunge_summary_get(struct mailbox *box, uint32_t ext_id,
+				uint32_t uid_validity, unsigned int *count_r)
+{
+	const struct autoexpunge_summary_header *shdr;
+	const struct autoexpunge_summary_block *blocks;
+	const void *data;
+	size_t size;
+	unsigned int i, count;
+
+	*count_r = 0;
+	mail_index_get_header_ext(box->view, ext_id, &data, &size);
+	if (size < sizeof(*shdr) ||
+	    (size - sizeof(*shdr)) % sizeof(*blocks) != 0)
+		return NULL;
+	shdr = data;
+	if (shdr->uid_validity != uid_validity)
+		return NULL;
+
+	blocks = CONST_PTR_OFFSET(data, sizeof(*shdr));
+	count = (size - sizeof(*shdr)) / sizeof(*blocks);
+	for (i = 0; i < count; i++) {
+		if (blocks[i].first_uid > blocks[i].last_uid ||
+		    (i > 0 && blocks[i-1].last_uid >= blocks[i].first_uid)) {
+			/* broken - rebuild it */
+			return NULL;
+		}
+	}
+	*count_r = count;
+	/* copy the blocks out of the index map, which may change while
+	   the mails are looked up */
+	return p_memdup(pool_datastack_create(), blocks,
+			sizeof(*blocks) * count);
+}
+
+static void
+mailbox_autoexpunge_summary_update(struct mailbox_transaction_context *t,
+				   uint32_t ext_id, uint32_t uid_validity,
+				   const struct autoexpunge_summary_block *old_blocks,
+				   unsigned int old_count,
+				   const ARRAY_TYPE(autoexpunge_summary_block) *blocks)
+{
+	struct autoexpunge_summary_header shdr;
+	const struct autoexpunge_summary_block *new_blocks;
+	unsigned int new_count;
+	buffer_t *buf;
+
+	new_blocks = array_get(blocks, &new_count);
+	if (old_blocks != NULL && old_count == new_count &&
+	    memcmp(old_blocks, new_blocks, sizeof(*new_blocks) * new_count) == 0)
+		return;
+
+	memset(&shdr, 0, sizeof(shdr));
+	shdr.uid_validity = uid_validity;
+	buf = buffer_create_dynamic(pool_datastack_create(),
+		sizeof(shdr) + sizeof(*new_blocks) * new_count);
+	buffer_append(buf, &shdr, sizeof(shdr));
+	buffer_append(buf, new_blocks, sizeof(*new_blocks) * new_count);
+
+	mail_index_ext_resize_hdr(t->itrans, ext_id, buf->used);
+	mail_index_update_header_ext(t->itrans, ext_id, 0, buf->data, buf->used);
+}
+
+static void
+mailbox_autoexpunge_summary_add(struct autoexpunge_summary_block *block,
+				uint32_t uid, time_t save_date)
+{
+	uint32_t date = save_date < 0 ? 0 : (uint32_t)save_date;
+
+	if (block->mail_count == 0) {
+		block->first_uid = uid;
+		block->min_save_date = block->max_save_date = date;
+	} else {
+		if (block->min_save_date > date)
+			block->min_save_date = date;
+		if (block->max_save_date < date)
+			block->max_save_date = date;
+	}
+	block->last_uid = uid;
+	block->mail_count++;
+}
+
+static void
+mailbox_autoexpunge_summary_reopen_last(ARRAY_TYPE(autoexpunge_summary_block) *blocks,
+					struct autoexpunge_summary_block *block_r)
+{
+	const struct autoexpunge_summary_block *last;
+	unsigned int count;
+
+	last = array_get(blocks, &count);
+	if (count > 0 &&
+	    last[count-1].mail_count < AUTOEXPUNGE_SUMMARY_BLOCK_MAX_MAILS) {
+		*block_r = last[count-1];
+		array_delete(blocks, count-1, 1);
+	}
+}
+
+/* Expunge the mail if it has expired, otherwise add it to the block.
+   Returns 0 if ok, -1 if the save date lookup failed. */
+static int
+mailbox_autoexpunge_mail(struct mail *mail, time_t expire_time,
+			 struct autoexpunge_summary_block *block)
+{
+	time_t timestamp;
+
+	if (mail_get_save_date(mail, &timestamp) == 0) {
+		if (timestamp <= expire_time)
+			mail_expunge(mail);
+		else
+			mailbox_autoexpunge_summary_add(block, mail->uid, timestamp);
+		return 0;
+	}
+	if (mailbox_get_last_mail_error(mail->box) == MAIL_ERROR_EXPUNGED) {
+		/* already expunged */
+		return 0;
+	}
+	return -1;
+}
+
 static int mailbox_autoexpunge(struct mailbox *box, time_t expire_time)
 {
 	struct mailbox_transaction_context *t;
 	struct mail *mail;
 	struct mailbox_metadata metadata;
 	const struct mail_index_header *hdr;
-	uint32_t seq;
-	time_t timestamp;
+	const struct autoexpunge_summary_block *old_blocks;
+	ARRAY_TYPE(autoexpunge_summary_block) blocks;
+	struct autoexpunge_summary_block block;
+	unsigned int i, old_count;
+	uint32_t ext_id, seq, seq1, seq2, uid;
 	int ret = 0;
 
 	/* first try to check quickly from mailbox list index if we should
@@ -39,21 +198,84 @@ static int mailbox_autoexpunge(struct mailbox *box, time_t expire_time)
 	mail = mail_alloc(t, 0, NULL);
 
 	hdr = mail_index_get_header(box->view);
-	for (seq = 1; seq <= hdr->messages_count; seq++) {
-		mail_set_seq(mail, seq);
-		if (mail_get_save_date(mail, &timestamp) == 0) {
-			if (timestamp > expire_time)
-				break;
-			mail_expunge(mail);
-		} else if (mailbox_get_last_mail_error(box) == MAIL_ERROR_EXPUNGED) {
-			/* already expunged */
+	ext_id = mail_index_ext_register(box->index,
+					 AUTOEXPUNGE_SUMMARY_EXT_NAME, 0, 0, 0);
+	old_blocks = mailbox_autoexpunge_summary_get(box, ext_id,
+						     hdr->uid_validity,
+						     &old_count);
+	t_array_init(&blocks, old_count + 8);
+	memset(&block, 0, sizeof(block));
+
+	/* mails that aren't in any block are added to the last block, or to
+	   new blocks when it's full. */
+	i = 0;
+	for (seq = 1; seq <= hdr->messages_count && ret == 0; ) {
+		mail_index_lookup_uid(box->view, seq, &uid);
+		while (i < old_count && old_blocks[i].last_uid < uid)
+			i++;
+		if (i == old_count || old_blocks[i].first_uid > uid) {
+			if (block.mail_count == 0) {
+				/* continue filling the previous block */
+				mailbox_autoexpunge_summary_reopen_last(&blocks,
+									&block);
+			}
+			mail_set_seq(mail, seq);
+			if (mailbox_autoexpunge_mail(mail, expire_time,
+						     &block) < 0)
+				ret = -1;
+			else if (block.mail_count ==
+				 AUTOEXPUNGE_SUMMARY_BLOCK_MAX_MAILS) {
+				array_append(&blocks, &block, 1);
+				memset(&block, 0, sizeof(block));
+			}
+			seq++;
+			continue;
+		}
+		if (block.mail_count > 0) {
+			array_append(&blocks, &block, 1);
+			memset(&block, 0, sizeof(block));
+		}
+
+		/* the following mails are all in this block */
+		if (!mail_index_lookup_seq_range(box->view, uid,
+						 old_blocks[i].last_uid,
+						 &seq1, &seq2))
+			i_unreached();
+		if (old_blocks[i].min_save_date > expire_time) {
+			/* nothing expired yet */
+			array_append(&blocks, &old_blocks[i], 1);
+		} else if (old_blocks[i].max_save_date <= expire_time) {
+			/* everything expired */
+			for (; seq <= seq2; seq++) {
+				mail_set_seq(mail, seq);
+				mail_expunge(mail);
+			}
 		} else {
-			/* failed */
-			ret = -1;
-			break;
+			/* some expired, rebuild the block from what's left */
+			for (; seq <= seq2 && ret == 0; seq++) {
+				mail_set_seq(mail, seq);
+				if (mailbox_autoexpunge_mail(mail, expire_time,
+							     &block) < 0)
+					ret = -1;
+			}
+			if (block.mail_count > 0) {
+				array_append(&blocks, &block, 1);
+				memset(&block, 0, sizeof(block));
+			}
 		}
+		seq = seq2 + 1;
+		i++;
 	}
+	if (block.mail_count > 0)
+		array_append(&blocks, &block, 1);
 	mail_free(&mail);
+
+	/* the blocks are incomplete after a failure */
+	if (ret == 0 && hdr->uid_validity != 0) {
+		mailbox_autoexpunge_summary_update(t, ext_id, hdr->uid_validity,
+						   old_blocks, old_count,
+						   &blocks);
+	}
 	if (mailbox_transaction_commit(&t) < 0)
 		ret = -1;
 	return ret;
@@ -101,6 +323,85 @@ mailbox_autoexpunge_wildcards(struct mail_namespace *ns,
 	}
 }
 
+static bool
+mail_namespace_autoexpunge_have_settings(struct mail_namespace *ns)
+{
+	struct mailbox_settings *const *box_set;
+
+	array_foreach(&ns->set->mailboxes, box_set) {
+		if ((*box_set)->autoexpunge != 0 &&
+		    (unsigned int)ioloop_time >= (*box_set)->autoexpunge)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static bool mail_namespace_autoexpunge_want_run(struct mail_namespace *ns)
+{
+	unsigned int interval = ns->mail_set->mail_autoexpunge_interval;
+	struct mailbox_permissions perm;
+	struct utimbuf ut;
+	struct stat st;
+	const char *dir, *path;
+	mode_t old_mask;
+	int fd;
+
+	if (interval == 0)
+		return TRUE;
+	if (!mailbox_list_get_root_path(ns->list, MAILBOX_LIST_PATH_TYPE_INDEX,
+					&dir))
+		return TRUE;
+	if (ns->prefix_len == 0)
+		path = t_strconcat(dir, "/"AUTOEXPUNGE_STAMP_FNAME, NULL);
+	else {
+		path = t_strdup_printf("%s/"AUTOEXPUNGE_STAMP_FNAME".%08x",
+				       dir, crc32_str(ns->prefix));
+	}
+
+	if (stat(path, &st) == 0) {
+		if (st.st_mtime <= ioloop_time &&
+		    st.st_mtime > ioloop_time - (time_t)interval)
+			return FALSE;
+	} else if (errno != ENOENT) {
+		i_error("stat(%s) failed: %m", path);
+		return TRUE;
+	}
+
+	/* update the timestamp already before expunging, so that other
+	   sessions ending at the same time skip the namespace instead of
+	   doing the same work in parallel. */
+	ut.actime = ut.modtime = ioloop_time;
+	if (utime(path, &ut) < 0) {
+		if (errno != ENOENT) {
+			i_error("utime(%s) failed: %m", path);
+			return TRUE;
+		}
+		mailbox_list_get_root_permissions(ns->list, &perm);
+		old_mask = umask(0666 & ~perm.file_create_mode);
+		fd = open(path, O_WRONLY | O_CREAT, 0666);
+		umask(old_mask);
+		if (fd == -1) {
+			/* ENOENT = index directory isn't created yet */
+			if (errno != ENOENT)
+				i_error("creat(%s) failed: %m", path);
+			return TRUE;
+		}
+		if (perm.file_create_gid != (gid_t)-1 &&
+		    fchown(fd, (uid_t)-1, perm.file_create_gid) < 0) {
+			if (errno == EPERM) {
+				i_error("%s", eperm_error_get_chgrp("fchown", path,
+							perm.file_create_gid,
+							perm.file_create_gid_origin));
+			} else {
+				i_error("fchown(%s, -1, %ld) failed: %m",
+					path, (long)perm.file_create_gid);
+			}
+		}
+		i_close_fd(&fd);
+	}
+	return TRUE;
+}
+
 static void mail_namespace_autoexpunge(struct mail_namespace *ns)
 {
 	struct mailbox_settings *const *box_set;
@@ -108,6 +409,9 @@ static void mail_namespace_autoexpunge(struct mail_namespace *ns)
 
 	if (!array_is_created(&ns->set->mailboxes))
 		return;
+	if (!mail_namespace_autoexpunge_have_settings(ns) ||
+	    !mail_namespace_autoexpunge_want_run(ns))
+		return;
 
 	array_foreach(&ns->set->mailboxes, box_set) {
 		if ((*box_set)->autoexpunge == 0 ||
@@ -0,0 +1,225 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "mail-search.h"
+
+struct mail_search_arg_link {
+	struct mail_search_arg **ptr;
+	struct mail_search_arg *orig;
+};
+
+struct mail_search_args_order {
+	struct mail_search_args *args;
+	/* the original values of all the list heads and next pointers */
+	ARRAY(struct mail_search_arg_link) links;
+};
+
+struct mail_search_order_context {
+	struct mail_search_args_order *order;
+	mail_search_arg_estimate_callback_t *callback;
+	void *context;
+	bool explain;
+};
+
+struct search_arg_plan {
+	struct mail_search_arg *arg;
+	unsigned int idx;
+	/* expected cost of checking the arg */
+	unsigned int cost;
+	/* estimated probability of the arg matching, 1..99% */
+	unsigned int match_pct;
+	/* cost per decided result - smallest is checked first */
+	unsigned long long rank;
+	const char *explain;
+};
+
+static int search_arg_plan_cmp(const struct search_arg_plan *p1,
+			       const struct search_arg_plan *p2)
+{
+	if (p1->rank < p2->rank)
+		return -1;
+	if (p1->rank > p2->rank)
+		return 1;
+	/* keep the original order for otherwise equal args */
+	return p1->idx < p2->idx ? -1 : 1;
+}
+
+static void
+search_args_order_list(struct mail_search_order_context *ctx,
+		       struct mail_search_arg **argsp, bool and_args,
+		       struct search_arg_plan *plan_r);
+
+static void
+search_arg_order(struct mail_search_order_context *ctx,
+		 struct mail_search_arg *arg, struct search_arg_plan *plan_r)
+{
+	const char *error;
+	string_t *str;
+
+	memset(plan_r, 0, sizeof(*plan_r));
+	plan_r->arg = arg;
+
+	if (arg->match_always || arg->nonmatch_always) {
+		/* already known */
+		plan_r->match_pct = arg->match_always ? 99 : 1;
+	} else if (arg->type == SEARCH_SUB || arg->type == SEARCH_OR) {
+		search_args_order_list(ctx, &arg->value.subargs,
+				       arg->type == SEARCH_SUB, plan_r);
+		plan_r->arg = arg;
+		if (arg->match_not)
+			plan_r->match_pct = 100 - plan_r->match_pct;
+	} else {
+		ctx->callback(arg, ctx->context,
+			      &plan_r->cost, &plan_r->match_pct);
+		if (plan_r->match_pct < 1)
+			plan_r->match_pct = 1;
+		else if (plan_r->match_pct > 99)
+			plan_r->match_pct = 99;
+		if (arg->match_not)
+			plan_r->match_pct = 100 - plan_r->match_pct;
+		if (ctx->explain) {
+			str = t_str_new(64);
+			if (arg->type == SEARCH_MAILBOX ||
+			    arg->type == SEARCH_MAILBOX_GLOB ||
+			    arg->type == SEARCH_MAILBOX_GUID) {
+				str_printfa(str, "%sMAILBOX %s",
+					    arg->match_not ? "NOT " : "",
+					    arg->value.str);
+			} else if (!mail_search_arg_to_imap(str, arg, &error))
+				str_printfa(str, "<%s>", error);
+			plan_r->explain = str_c(str);
+		}
+	}
+	if (ctx->explain && plan_r->explain == NULL) {
+		plan_r->explain = arg->match_always ? "<always>" :
+			arg->nonmatch_always ? "<never>" : "";
+	}
+	if (ctx->explain) {
+		plan_r->explain = t_strdup_printf("%s%s[cost=%u,%u%%]",
+			(arg->type == SEARCH_SUB || arg->type == SEARCH_OR) &&
+			arg->match_not ? "NOT " : "",
+			plan_r->explain, plan_r->cost, plan_r->match_pct);
+	}
+}
+
+static void
+search_args_order_save_link(struct mail_search_order_context *ctx,
+			    struct mail_search_arg **ptr)
+{
+	struct mail_search_arg_link *link;
+
+	link = array_append_space(&ctx->order->links);
+	link->ptr = ptr;
+	link->orig = *ptr;
+}
+
+static void
+search_args_order_list(struct mail_search_order_context *ctx,
+		       struct mail_search_arg **argsp, bool and_args,
+		       struct search_arg_plan *plan_r)
+{
+	ARRAY(struct search_arg_plan) plans;
+	struct search_arg_plan *plan;
+	struct mail_search_arg *arg, **nextp;
+	unsigned long long cost = 0, pct = 100;
+	unsigned int i, count;
+	string_t *str = NULL;
+
+	search_args_order_save_link(ctx, argsp);
+	for (arg = *argsp; arg != NULL; arg = arg->next)
+		search_args_order_save_link(ctx, &arg->next);
+
+	t_array_init(&plans, 8);
+	for (arg = *argsp, i = 0; arg != NULL; arg = arg->next, i++) {
+		plan = array_append_space(&plans);
+		search_arg_order(ctx, arg, plan);
+		plan->idx = i;
+		/* With AND the next args are checked only if this one matched,
+		   with OR only if it didn't. Check first the args that are
+		   cheapest for the probability of them deciding the result. */
+		plan->rank = plan->cost * 100ULL /
+			(and_args ? 100 - plan->match_pct : plan->match_pct);
+	}
+	array_sort(&plans, search_arg_plan_cmp);
+
+	if (ctx->explain)
+		str = t_str_new(128);
+	plan = array_get_modifiable(&plans, &count);
+	nextp = argsp;
+	for (i = 0; i < count; i++) {
+		*nextp = plan[i].arg;
+		nextp = &plan[i].arg->next;
+
+		/* expected cost = the cost of each arg multiplied by the
+		   probability of it being reached */
+		cost += plan[i].cost * pct / 100;
+		pct = pct * (and_args ? plan[i].match_pct :
+			     100 - plan[i].match_pct) / 100;
+		if (str != NULL) {
+			if (i > 0)
+				str_append(str, and_args ? " " : " OR ");
+			str_append(str, plan[i].explain);
+		}
+	}
+	*nextp = NULL;
+
+	plan_r->cost = cost > UINT_MAX ? UINT_MAX : cost;
+	/* pct is now the probability of reaching past the last arg, i.e.
+	   of AND matching or OR not matching */
+	plan_r->match_pct = and_args ? pct : 100 - pct;
+	if (plan_r->match_pct < 1)
+		plan_r->match_pct = 1;
+	else if (plan_r->match_pct > 99)
+		plan_r->match_pct = 99;
+	if (str != NULL)
+		plan_r->explain = t_strdup_printf("(%s)", str_c(str));
+}
+
+#undef mail_search_args_order_by_cost
+struct mail_search_args_order *
+mail_search_args_order_by_cost(struct mail_search_args *args,
+			       mail_search_arg_estimate_callback_t *callback,
+			       void *context, string_t *explain)
+{
+	struct mail_search_order_context ctx;
+	struct search_arg_plan plan;
+
+	if (args->args == NULL || args->ordered) {
+		/* nothing to do, or another search is using the args in the
+		   order it chose. don't change it under it. */
+		return NULL;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.order = i_new(struct mail_search_args_order, 1);
+	ctx.order->args = args;
+	i_array_init(&ctx.order->links, 16);
+	ctx.callback = callback;
+	ctx.context = context;
+	ctx.explain = explain != NULL;
+
+	T_BEGIN {
+		search_args_order_list(&ctx, &args->args, TRUE, &plan);
+		if (explain != NULL)
+			str_append(explain, plan.explain);
+	} T_END;
+	args->ordered = TRUE;
+	return ctx.order;
+}
+
+void mail_search_args_order_restore(struct mail_search_args_order **_order)
+{
+	struct mail_search_args_order *order = *_order;
+	const struct mail_search_arg_link *link;
+
+	*_order = NULL;
+
+	array_foreach(&order->links, link)
+		*link->ptr = link->orig;
+	i_assert(order->args->ordered);
+	order->args->ordered = FALSE;
+	array_free(&order->links);
+	i_free(order);
+}
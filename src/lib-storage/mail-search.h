@@ -120,6 +120,8 @@ struct mail_search_args {
 	/* fts plugin has already expanded the search args - no need to do
 	   it again. */
 	unsigned int fts_expanded:1;
+	/* args are reordered by mail_search_args_order_by_cost() */
+	unsigned int ordered:1;
 };
 
 #define ARG_SET_RESULT(arg, res) \
@@ -203,6 +205,30 @@ bool mail_search_args_match_mailbox(struct mail_search_args *args,
    guaranteed to have match_not=FALSE. */
 void mail_search_args_simplify(struct mail_search_args *args);
 
+typedef void
+mail_search_arg_estimate_callback_t(const struct mail_search_arg *arg,
+				    void *context, unsigned int *cost_r,
+				    unsigned int *match_pct_r);
+/* Reorder the args in each AND and OR list, so that the args that decide the
+   result most cheaply are checked first. The callback returns the relative
+   cost and the match probability (1..99%) of each arg that isn't a list.
+   If explain is non-NULL, the chosen order is written to it. The original
+   order must be restored with mail_search_args_order_restore() after the
+   search. Returns NULL if there's nothing to restore, because the args are
+   empty or already reordered by another search. */
+struct mail_search_args_order *
+mail_search_args_order_by_cost(struct mail_search_args *args,
+			       mail_search_arg_estimate_callback_t *callback,
+			       void *context, string_t *explain) ATTR_NULL(4);
+#define mail_search_args_order_by_cost(args, callback, context, explain) \
+	  mail_search_args_order_by_cost(args, \
+		(mail_search_arg_estimate_callback_t *)callback, \
+		(void *)((char *)context + \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			const struct mail_search_arg *, typeof(context), \
+			unsigned int *, unsigned int *))), explain)
+void mail_search_args_order_restore(struct mail_search_args_order **order);
+
 /* Append all args as IMAP SEARCH AND-query to the dest string and returns TRUE.
    If some search arg can't be written as IMAP SEARCH parameter, error_r is set
    and FALSE is returned. */
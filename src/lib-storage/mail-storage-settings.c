@@ -30,6 +30,8 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(SET_STR_VARS, mail_attachment_dir),
 	DEF(SET_STR, mail_attachment_hash),
 	DEF(SET_SIZE, mail_attachment_min_size),
+	DEF(SET_STR_VARS, mail_binary_cache_dir),
+	DEF(SET_SIZE, mail_binary_cache_max_size),
 	DEF(SET_STR_VARS, mail_attribute_dict),
 	DEF(SET_UINT, mail_prefetch_count),
 	DEF(SET_STR, mail_cache_fields),
@@ -42,6 +44,7 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(SET_UINT, mail_max_keyword_length),
 	DEF(SET_TIME, mail_max_lock_timeout),
 	DEF(SET_TIME, mail_temp_scan_interval),
+	DEF(SET_TIME, mail_autoexpunge_interval),
 	DEF(SET_BOOL, mail_save_crlf),
 	DEF(SET_ENUM, mail_fsync),
 	DEF(SET_BOOL, mmap_disable),
@@ -70,6 +73,8 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_attachment_dir = "",
 	.mail_attachment_hash = "%{sha1}",
 	.mail_attachment_min_size = 1024*128,
+	.mail_binary_cache_dir = "",
+	.mail_binary_cache_max_size = 1024*1024*100,
 	.mail_attribute_dict = "",
 	.mail_prefetch_count = 0,
 	.mail_cache_fields = "flags",
@@ -82,6 +87,7 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_max_keyword_length = 50,
 	.mail_max_lock_timeout = 0,
 	.mail_temp_scan_interval = 7*24*60*60,
+	.mail_autoexpunge_interval = 0,
 	.mail_save_crlf = FALSE,
 	.mail_fsync = "optimized:never:always",
 	.mmap_disable = FALSE,
@@ -361,7 +367,7 @@ static bool mail_storage_settings_check(void *_set, pool_t pool ATTR_UNUSED,
 {
 	struct mail_storage_settings *set = _set;
 	struct hash_format *format;
-	const char *p, *error;
+	const char *p, *error, *binary_cache_dir;
 	bool uidl_format_ok;
 	char c;
 
@@ -443,6 +449,18 @@ static bool mail_storage_settings_check(void *_set, pool_t pool ATTR_UNUSED,
 		return FALSE;
 	}
 	hash_format_deinit_free(&format);
+
+	binary_cache_dir = set->mail_binary_cache_dir;
+	if (binary_cache_dir[0] == SETTING_STRVAR_UNEXPANDED[0] &&
+	    binary_cache_dir[1] != '\0' && binary_cache_dir[1] != '~' &&
+	    !var_has_key(binary_cache_dir + 1, 'u', "user") &&
+	    !var_has_key(binary_cache_dir + 1, 'h', "home")) {
+		/* the files are named by mail GUIDs, so a shared directory
+		   would allow users to read each others' mails */
+		*error_r = "mail_binary_cache_dir setting must be a per-user "
+			"directory: begin it with ~/ or use %u or %h";
+		return FALSE;
+	}
 #ifndef CONFIG_BINARY
 	if (*set->ssl_client_ca_dir != '\0' &&
 	    access(set->ssl_client_ca_dir, X_OK) < 0) {
@@ -15,6 +15,8 @@ struct mail_storage_settings {
 	const char *mail_attachment_dir;
 	const char *mail_attachment_hash;
 	uoff_t mail_attachment_min_size;
+	const char *mail_binary_cache_dir;
+	uoff_t mail_binary_cache_max_size;
 	const char *mail_attribute_dict;
 	unsigned int mail_prefetch_count;
 	const char *mail_cache_fields;
@@ -27,6 +29,7 @@ struct mail_storage_settings {
 	unsigned int mail_max_keyword_length;
 	unsigned int mail_max_lock_timeout;
 	unsigned int mail_temp_scan_interval;
+	unsigned int mail_autoexpunge_interval;
 	bool mail_save_crlf;
 	const char *mail_fsync;
 	bool mmap_disable;
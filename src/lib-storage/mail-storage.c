@@ -635,6 +635,17 @@ bool mail_storage_is_mailbox_file(struct mail_storage *storage)
 		MAIL_STORAGE_CLASS_FLAG_MAILBOX_IS_FILE) != 0;
 }
 
+bool mail_storage_is_file_per_msg(struct mail_storage *storage)
+{
+	return (storage->class_flags &
+		MAIL_STORAGE_CLASS_FLAG_FILE_PER_MSG) != 0;
+}
+
+const char *mail_storage_get_name(struct mail_storage *storage)
+{
+	return storage->name;
+}
+
 bool mail_storage_set_error_from_errno(struct mail_storage *storage)
 {
 	const char *error_string;
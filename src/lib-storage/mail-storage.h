@@ -141,7 +141,7 @@ enum mail_fetch_field {
 	MAIL_FETCH_PHYSICAL_SIZE	= 0x00000080,
 	MAIL_FETCH_VIRTUAL_SIZE		= 0x00000100,
 
-	/* Set has_nuls / has_no_nuls fields */
+	/* Set has_nuls / has_no_nuls / has_no_dot_lines fields */
 	MAIL_FETCH_NUL_STATE		= 0x00000200,
 
 	MAIL_FETCH_STREAM_BINARY	= 0x00000400,
@@ -183,7 +183,12 @@ enum mailbox_transaction_flags {
 	/* Don't trigger any notifications for this transaction. This
 	   especially means the notify plugin. This would normally be used only
 	   with _FLAG_SYNC. */
-	MAILBOX_TRANSACTION_FLAG_NO_NOTIFY	= 0x40
+	MAILBOX_TRANSACTION_FLAG_NO_NOTIFY	= 0x40,
+	/* Open the transaction for the index view that is currently being
+	   synced, instead of the mailbox's view. This is useful within
+	   sync_notify(), since the mailbox's view may not yet have the mails
+	   that the sync is notifying about. */
+	MAILBOX_TRANSACTION_FLAG_SYNC_VIEW	= 0x80
 };
 
 enum mailbox_sync_flags {
@@ -363,6 +368,8 @@ struct mail {
 	unsigned int saving:1; /* This mail is still being saved */
 	unsigned int has_nuls:1; /* message data is known to contain NULs */
 	unsigned int has_no_nuls:1; /* -''- known to not contain NULs */
+	/* message data is known to not contain any lines beginning with '.' */
+	unsigned int has_no_dot_lines:1;
 
 	/* If the lookup is aborted, error is set to MAIL_ERROR_NOTPOSSIBLE */
 	enum mail_lookup_abort lookup_abort;
@@ -449,6 +456,10 @@ void mail_storage_last_error_pop(struct mail_storage *storage);
 
 /* Returns TRUE if mailboxes are files. */
 bool mail_storage_is_mailbox_file(struct mail_storage *storage) ATTR_PURE;
+/* Returns TRUE if each mail is stored in a separate file. */
+bool mail_storage_is_file_per_msg(struct mail_storage *storage) ATTR_PURE;
+/* Returns the storage driver's name, e.g. "maildir". */
+const char *mail_storage_get_name(struct mail_storage *storage) ATTR_PURE;
 
 /* Initialize mailbox without actually opening any files or verifying that
    it exists. Note that append and copy may open the selected mailbox again
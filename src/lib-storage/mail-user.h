@@ -56,6 +56,9 @@ struct mail_user {
 
 	/* Module-specific contexts. See mail_storage_module_id. */
 	ARRAY(union mail_user_module_context *) module_contexts;
+	/* Number of mailboxes whose STATUS was answered from the mailbox list
+	   index without opening them. */
+	unsigned int mailbox_opens_avoided;
 
 	/* User doesn't exist (as reported by userdb lookup when looking
 	   up home) */
@@ -0,0 +1,277 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "hostpid.h"
+#include "unlink-directory.h"
+#include "master-service.h"
+#include "mail-storage-service.h"
+#include "mail-namespace.h"
+#include "mail-storage.h"
+#include "mail-autoexpunge.h"
+#include "test-common.h"
+
+#include <sys/stat.h>
+
+#define TEST_EXPIRED_DATE (ioloop_time - 10*24*3600)
+#define TEST_UNEXPIRED_DATE (ioloop_time - 3600)
+
+static const char test_mail[] =
+"From: Sender <sender@example.com>\r\n"
+"Subject: Autoexpunge test\r\n"
+"\r\n"
+"body\r\n";
+
+struct test_user {
+	struct mail_storage_service_user *service_user;
+	struct mail_user *user;
+	struct mailbox *box;
+};
+
+static struct mail_storage_service_ctx *storage_service;
+static char *test_dir;
+
+static void
+test_user_init_fields(struct test_user *tuser, const char *name,
+		      const char *const *userdb_fields)
+{
+	struct mail_storage_service_input input;
+	struct mail_namespace *ns;
+	const char *error;
+
+	memset(tuser, 0, sizeof(*tuser));
+	memset(&input, 0, sizeof(input));
+	input.module = input.service = "test-mail-autoexpunge";
+	input.username = name;
+	input.userdb_fields = userdb_fields;
+	if (mail_storage_service_lookup_next(storage_service, &input,
+					     &tuser->service_user,
+					     &tuser->user, &error) <= 0)
+		i_fatal("User initialization failed: %s", error);
+
+	ns = mail_namespace_find_inbox(tuser->user->namespaces);
+	tuser->box = mailbox_alloc(ns->list, "INBOX", 0);
+	if (mailbox_open(tuser->box) < 0) {
+		i_fatal("Opening INBOX failed: %s",
+			mailbox_get_last_error(tuser->box, NULL));
+	}
+}
+
+static void test_user_init(struct test_user *tuser, const char *name)
+{
+	const char *userdb_fields[] = {
+		"mail=sdbox:~/mail",
+		t_strdup_printf("home=%s/%s", test_dir, name),
+		"namespace=inbox",
+		"namespace/inbox/inbox=yes",
+		"namespace/inbox/mailbox=INBOX",
+		"namespace/inbox/mailbox/INBOX/name=INBOX",
+		"namespace/inbox/mailbox/INBOX/autoexpunge=1d",
+		NULL
+	};
+
+	test_user_init_fields(tuser, name, userdb_fields);
+}
+
+static void test_user_deinit(struct test_user *tuser)
+{
+	mailbox_free(&tuser->box);
+	mail_user_unref(&tuser->user);
+	mail_storage_service_user_free(&tuser->service_user);
+}
+
+static void
+test_save_mails(struct mailbox *box, const time_t *save_dates,
+		unsigned int count)
+{
+	struct mailbox_transaction_context *t;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	unsigned int i;
+
+	t = mailbox_transaction_begin(box, MAILBOX_TRANSACTION_FLAG_EXTERNAL);
+	for (i = 0; i < count; i++) {
+		input = i_stream_create_from_data(test_mail,
+						  sizeof(test_mail)-1);
+		save_ctx = mailbox_save_alloc(t);
+		mailbox_save_set_save_date(save_ctx, save_dates[i]);
+		if (mailbox_save_begin(&save_ctx, input) < 0 ||
+		    mailbox_save_continue(save_ctx) < 0 ||
+		    mailbox_save_finish(&save_ctx) < 0) {
+			i_fatal("Saving mail failed: %s",
+				mailbox_get_last_error(box, NULL));
+		}
+		i_stream_unref(&input);
+	}
+	if (mailbox_transaction_commit(&t) < 0) {
+		i_fatal("Committing saved mails failed: %s",
+			mailbox_get_last_error(box, NULL));
+	}
+}
+
+static unsigned int test_count_mails(struct mailbox *box)
+{
+	struct mailbox_status status;
+
+	if (mailbox_sync(box, 0) < 0) {
+		i_fatal("Syncing %s failed: %s", mailbox_get_vname(box),
+			mailbox_get_last_error(box, NULL));
+	}
+	mailbox_get_open_status(box, STATUS_MESSAGES, &status);
+	return status.messages;
+}
+
+/* Returns the number of mails in the mailbox. Fails the test if any of
+   them has expired. */
+static unsigned int test_count_unexpired(struct mailbox *box)
+{
+	struct mailbox_transaction_context *t;
+	struct mail *mail;
+	unsigned int count = test_count_mails(box);
+	time_t save_date;
+	uint32_t seq;
+
+	t = mailbox_transaction_begin(box, 0);
+	mail = mail_alloc(t, 0, NULL);
+	for (seq = 1; seq <= count; seq++) {
+		mail_set_seq(mail, seq);
+		test_assert_idx(mail_get_save_date(mail, &save_date) == 0 &&
+				save_date > ioloop_time - 24*3600, seq);
+	}
+	mail_free(&mail);
+	(void)mailbox_transaction_commit(&t);
+	return count;
+}
+
+/* Returns the number of mails left in INBOX after autoexpunging. */
+static unsigned int test_autoexpunge(struct test_user *tuser)
+{
+	mail_user_autoexpunge(tuser->user);
+	return test_count_unexpired(tuser->box);
+}
+
+static void test_autoexpunge_unordered_save_dates(void)
+{
+	struct test_user tuser;
+	time_t save_dates[6];
+	time_t orig_ioloop_time = ioloop_time;
+	unsigned int i;
+
+	test_begin("autoexpunge with unordered save dates");
+	test_user_init(&tuser, "unordered");
+
+	/* e.g. mails moved from other mailboxes keep their save dates.
+	   all the expired mails are expunged, not only the ones before the
+	   first unexpired mail. */
+	for (i = 0; i < N_ELEMENTS(save_dates); i++) {
+		save_dates[i] = i % 2 == 0 ?
+			TEST_EXPIRED_DATE : TEST_UNEXPIRED_DATE;
+	}
+	test_save_mails(tuser.box, save_dates, N_ELEMENTS(save_dates));
+	test_assert(test_autoexpunge(&tuser) == 3);
+
+	/* the above mails are now in the save date summary. new mails
+	   are checked one by one. */
+	test_save_mails(tuser.box, save_dates, 2);
+	test_assert(test_autoexpunge(&tuser) == 4);
+	test_assert(test_autoexpunge(&tuser) == 4);
+
+	/* two days later everything in the summary has expired */
+	ioloop_time += 2*24*3600;
+	save_dates[0] = ioloop_time;
+	test_save_mails(tuser.box, save_dates, 1);
+	test_assert(test_autoexpunge(&tuser) == 1);
+	ioloop_time = orig_ioloop_time;
+
+	test_user_deinit(&tuser);
+	test_end();
+}
+
+static void test_autoexpunge_shared_index_root(void)
+{
+	const char *userdb_fields[] = {
+		"mail=sdbox:~/mail:INDEX=~/index",
+		t_strdup_printf("home=%s/shared-index-root", test_dir),
+		"mail_autoexpunge_interval=1h",
+		"namespace=inbox second",
+		"namespace/inbox/inbox=yes",
+		"namespace/inbox/separator=/",
+		"namespace/inbox/mailbox=INBOX",
+		"namespace/inbox/mailbox/INBOX/name=INBOX",
+		"namespace/inbox/mailbox/INBOX/autoexpunge=1d",
+		"namespace/second/prefix=second/",
+		"namespace/second/separator=/",
+		"namespace/second/location=sdbox:~/mail2:INDEX=~/index",
+		"namespace/second/mailbox=box",
+		"namespace/second/mailbox/box/name=box",
+		"namespace/second/mailbox/box/autoexpunge=1d",
+		NULL
+	};
+	struct test_user tuser;
+	struct mail_namespace *ns;
+	struct mailbox *box;
+	time_t save_dates[] = { TEST_EXPIRED_DATE, TEST_UNEXPIRED_DATE };
+
+	test_begin("autoexpunge with namespaces sharing the index root");
+	test_user_init_fields(&tuser, "shared-index-root", userdb_fields);
+
+	ns = mail_namespace_find_prefix(tuser.user->namespaces, "second/");
+	box = mailbox_alloc(ns->list, "second/box", 0);
+	if (mailbox_create(box, NULL, FALSE) < 0 || mailbox_open(box) < 0) {
+		i_fatal("Opening second/box failed: %s",
+			mailbox_get_last_error(box, NULL));
+	}
+	test_save_mails(tuser.box, save_dates, N_ELEMENTS(save_dates));
+	test_save_mails(box, save_dates, N_ELEMENTS(save_dates));
+
+	/* the first namespace's run must not stop the second namespace from
+	   being autoexpunged within the interval */
+	test_assert(test_autoexpunge(&tuser) == 1);
+	test_assert(test_count_unexpired(box) == 1);
+
+	/* within the interval neither namespace is autoexpunged again */
+	test_save_mails(tuser.box, save_dates, 1);
+	test_save_mails(box, save_dates, 1);
+	mail_user_autoexpunge(tuser.user);
+	test_assert(test_count_mails(tuser.box) == 2);
+	test_assert(test_count_mails(box) == 2);
+
+	mailbox_free(&box);
+	test_user_deinit(&tuser);
+	test_end();
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*test_functions[])(void) = {
+		test_autoexpunge_unordered_save_dates,
+		test_autoexpunge_shared_index_root,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-mail-autoexpunge",
+				MASTER_SERVICE_FLAG_STANDALONE |
+				MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS,
+				&argc, &argv, "");
+	master_service_init_finish(master_service);
+	storage_service = mail_storage_service_init(master_service, NULL,
+				MAIL_STORAGE_SERVICE_FLAG_NO_RESTRICT_ACCESS |
+				MAIL_STORAGE_SERVICE_FLAG_NO_CHDIR |
+				MAIL_STORAGE_SERVICE_FLAG_NO_LOG_INIT |
+				MAIL_STORAGE_SERVICE_FLAG_NO_PLUGINS);
+
+	test_dir = i_strdup_printf("/tmp/test-mail-autoexpunge.%s", my_pid);
+	if (mkdir(test_dir, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", test_dir);
+
+	ret = test_run_initialized(test_functions);
+
+	if (unlink_directory(test_dir, UNLINK_DIRECTORY_FLAG_RMDIR) < 0)
+		i_error("unlink_directory(%s) failed: %m", test_dir);
+	i_free(test_dir);
+	mail_storage_service_deinit(&storage_service);
+	master_service_deinit(&master_service);
+	return ret;
+}
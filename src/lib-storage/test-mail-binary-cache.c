@@ -0,0 +1,386 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "crc32.h"
+#include "istream.h"
+#include "hostpid.h"
+#include "unlink-directory.h"
+#include "settings-parser.h"
+#include "message-part.h"
+#include "master-service.h"
+#include "mail-storage-service.h"
+#include "mail-namespace.h"
+#include "mail-storage.h"
+#include "mail-storage-settings.h"
+#include "test-common.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* must match index-mail-binary.c */
+#define TEST_BUCKET_COUNT 16
+
+static const char test_mail[] =
+"From: Sender <sender@example.com>\r\n"
+"Subject: Binary test\r\n"
+"MIME-Version: 1.0\r\n"
+"Content-Type: text/plain\r\n"
+"Content-Transfer-Encoding: base64\r\n"
+"\r\n"
+"aGVsbG8gd29ybGQK\r\n";
+static const char test_mail_decoded[] = "hello world\n";
+
+struct test_user {
+	struct mail_storage_service_user *service_user;
+	struct mail_user *user;
+	struct mailbox *box;
+	const char *home;
+};
+
+static struct mail_storage_service_ctx *storage_service;
+static char *test_dir;
+
+static void
+test_user_init(struct test_user *tuser, const char *name, uoff_t max_size)
+{
+	struct mail_storage_service_input input;
+	struct mail_namespace *ns;
+	const char *userdb_fields[5], *error;
+
+	memset(tuser, 0, sizeof(*tuser));
+	tuser->home = t_strdup_printf("%s/%s", test_dir, name);
+	userdb_fields[0] = "mail=sdbox:~/mail";
+	userdb_fields[1] = t_strconcat("home=", tuser->home, NULL);
+	userdb_fields[2] = "mail_binary_cache_dir=~/binary-cache";
+	userdb_fields[3] = t_strdup_printf("mail_binary_cache_max_size=%"
+					   PRIuUOFF_T, max_size);
+	userdb_fields[4] = NULL;
+
+	memset(&input, 0, sizeof(input));
+	input.module = input.service = "test-mail-binary-cache";
+	input.username = name;
+	input.userdb_fields = userdb_fields;
+	if (mail_storage_service_lookup_next(storage_service, &input,
+					     &tuser->service_user,
+					     &tuser->user, &error) <= 0)
+		i_fatal("User initialization failed: %s", error);
+
+	ns = mail_namespace_find_inbox(tuser->user->namespaces);
+	tuser->box = mailbox_alloc(ns->list, "INBOX", 0);
+	if (mailbox_open(tuser->box) < 0) {
+		i_fatal("Opening INBOX failed: %s",
+			mailbox_get_last_error(tuser->box, NULL));
+	}
+}
+
+static void test_user_deinit(struct test_user *tuser)
+{
+	mailbox_free(&tuser->box);
+	mail_user_unref(&tuser->user);
+	mail_storage_service_user_free(&tuser->service_user);
+}
+
+static void test_save_mails(struct test_user *tuser, unsigned int count)
+{
+	struct mailbox_transaction_context *t;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	unsigned int i;
+
+	t = mailbox_transaction_begin(tuser->box,
+				      MAILBOX_TRANSACTION_FLAG_EXTERNAL);
+	for (i = 0; i < count; i++) {
+		input = i_stream_create_from_data(test_mail,
+						  sizeof(test_mail)-1);
+		save_ctx = mailbox_save_alloc(t);
+		if (mailbox_save_begin(&save_ctx, input) < 0 ||
+		    mailbox_save_continue(save_ctx) < 0 ||
+		    mailbox_save_finish(&save_ctx) < 0) {
+			i_fatal("Saving mail failed: %s",
+				mailbox_get_last_error(tuser->box, NULL));
+		}
+		i_stream_unref(&input);
+	}
+	if (mailbox_transaction_commit(&t) < 0) {
+		i_fatal("Committing saved mails failed: %s",
+			mailbox_get_last_error(tuser->box, NULL));
+	}
+	if (mailbox_sync(tuser->box, 0) < 0) {
+		i_fatal("Syncing INBOX failed: %s",
+			mailbox_get_last_error(tuser->box, NULL));
+	}
+}
+
+static const char *
+test_get_mail_dir(struct test_user *tuser, struct mail *mail)
+{
+	const char *guid;
+
+	if (mail_get_special(mail, MAIL_FETCH_GUID, &guid) < 0)
+		i_fatal("GUID lookup failed");
+	return t_strdup_printf("%s/binary-cache/%x/%s", tuser->home,
+			       crc32_str(guid) % TEST_BUCKET_COUNT, guid);
+}
+
+static const char *
+test_get_path(struct test_user *tuser, struct mail *mail, bool include_hdr)
+{
+	struct message_part *parts;
+
+	if (mail_get_parts(mail, &parts) < 0)
+		i_fatal("MIME parts lookup failed");
+	return t_strdup_printf("%s/%"PRIuUOFF_T"-%c",
+			       test_get_mail_dir(tuser, mail),
+			       parts->physical_pos, include_hdr ? 'h' : 'b');
+}
+
+static const char *test_fetch_binary(struct mail *mail, bool include_hdr)
+{
+	struct message_part *parts;
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	uoff_t binary_size;
+	bool binary;
+	const char *ret;
+
+	if (mail_get_parts(mail, &parts) < 0 ||
+	    mail_get_binary_stream(mail, parts, include_hdr, &binary_size,
+				   &binary, &input) < 0)
+		return NULL;
+	while (i_stream_read(input) > 0) ;
+	data = i_stream_get_data(input, &size);
+	ret = t_strndup(data, size);
+	i_stream_unref(&input);
+	return ret;
+}
+
+static bool test_file_exists(const char *path)
+{
+	struct stat st;
+
+	return stat(path, &st) == 0;
+}
+
+static void test_binary_cache_hit_miss(void)
+{
+	struct test_user tuser;
+	struct mailbox_transaction_context *t;
+	struct mail *mail;
+	const char *path;
+	FILE *f;
+
+	test_begin("mail binary cache hit and miss");
+	test_user_init(&tuser, "hitmiss", 1024*1024);
+	test_save_mails(&tuser, 1);
+
+	t = mailbox_transaction_begin(tuser.box, 0);
+	mail = mail_alloc(t, 0, NULL);
+	mail_set_seq(mail, 1);
+	path = test_get_path(&tuser, mail, FALSE);
+
+	/* miss: decoded and stored */
+	test_assert(!test_file_exists(path));
+	test_assert(null_strcmp(test_fetch_binary(mail, FALSE),
+				test_mail_decoded) == 0);
+	test_assert(test_file_exists(path));
+
+	/* fetch the header too, so the body isn't in the memory cache */
+	test_assert(test_fetch_binary(mail, TRUE) != NULL);
+	test_assert(test_file_exists(test_get_path(&tuser, mail, TRUE)));
+
+	/* hit: the body is read from the stored file */
+	f = fopen(path, "w");
+	test_assert(f != NULL);
+	if (f != NULL) {
+		fputs("from the store\n", f);
+		fclose(f);
+	}
+	test_assert(null_strcmp(test_fetch_binary(mail, FALSE),
+				"from the store\n") == 0);
+
+	mail_free(&mail);
+	(void)mailbox_transaction_commit(&t);
+	test_user_deinit(&tuser);
+	test_end();
+}
+
+static void test_binary_cache_size_limit(void)
+{
+	struct test_user tuser;
+	struct mailbox_transaction_context *t;
+	struct mail *mail;
+
+	test_begin("mail binary cache size limit");
+	/* each bucket may contain less than the decoded part */
+	test_user_init(&tuser, "sizelimit",
+		       TEST_BUCKET_COUNT * (sizeof(test_mail_decoded)-2));
+	test_save_mails(&tuser, 1);
+
+	t = mailbox_transaction_begin(tuser.box, 0);
+	mail = mail_alloc(t, 0, NULL);
+	mail_set_seq(mail, 1);
+	test_assert(null_strcmp(test_fetch_binary(mail, FALSE),
+				test_mail_decoded) == 0);
+	test_assert(!test_file_exists(test_get_path(&tuser, mail, FALSE)));
+
+	mail_free(&mail);
+	(void)mailbox_transaction_commit(&t);
+	test_user_deinit(&tuser);
+	test_end();
+}
+
+static void test_binary_cache_eviction(void)
+{
+#define TEST_EVICTION_MAIL_COUNT 40
+	struct test_user tuser;
+	struct mailbox_transaction_context *t;
+	struct mail *mail;
+	uoff_t bucket_sizes[TEST_BUCKET_COUNT];
+	const char *path, *guid;
+	struct stat st;
+	unsigned int i, seq, file_count = 0;
+
+	test_begin("mail binary cache eviction");
+	/* each bucket has room for two decoded parts */
+	test_user_init(&tuser, "eviction",
+		       TEST_BUCKET_COUNT * (sizeof(test_mail_decoded)-1) * 2);
+	test_save_mails(&tuser, TEST_EVICTION_MAIL_COUNT);
+
+	t = mailbox_transaction_begin(tuser.box, 0);
+	mail = mail_alloc(t, 0, NULL);
+	for (seq = 1; seq <= TEST_EVICTION_MAIL_COUNT; seq++) {
+		mail_set_seq(mail, seq);
+		test_assert_idx(null_strcmp(test_fetch_binary(mail, FALSE),
+					    test_mail_decoded) == 0, seq);
+		/* the just stored file is never evicted */
+		path = test_get_path(&tuser, mail, FALSE);
+		test_assert_idx(test_file_exists(path), seq);
+	}
+
+	memset(bucket_sizes, 0, sizeof(bucket_sizes));
+	for (seq = 1; seq <= TEST_EVICTION_MAIL_COUNT; seq++) {
+		mail_set_seq(mail, seq);
+		path = test_get_path(&tuser, mail, FALSE);
+		if (stat(path, &st) < 0)
+			continue;
+		file_count++;
+		if (mail_get_special(mail, MAIL_FETCH_GUID, &guid) < 0)
+			i_fatal("GUID lookup failed");
+		bucket_sizes[crc32_str(guid) % TEST_BUCKET_COUNT] += st.st_size;
+	}
+	/* 40 mails don't fit into 16 buckets with room for two each */
+	test_assert(file_count > 0 && file_count <= TEST_BUCKET_COUNT * 2);
+	for (i = 0; i < TEST_BUCKET_COUNT; i++) {
+		test_assert_idx(bucket_sizes[i] <=
+				(sizeof(test_mail_decoded)-1) * 2, i);
+	}
+
+	mail_free(&mail);
+	(void)mailbox_transaction_commit(&t);
+	test_user_deinit(&tuser);
+	test_end();
+}
+
+static void test_binary_cache_expunge(void)
+{
+	struct test_user tuser;
+	struct mailbox_transaction_context *t;
+	struct mail *mail;
+	const char *mail_dir, *mail_dir2;
+
+	test_begin("mail binary cache expunge");
+	test_user_init(&tuser, "expunge", 1024*1024);
+	test_save_mails(&tuser, 2);
+
+	t = mailbox_transaction_begin(tuser.box, 0);
+	mail = mail_alloc(t, 0, NULL);
+	mail_set_seq(mail, 2);
+	test_assert(test_fetch_binary(mail, FALSE) != NULL);
+	mail_dir2 = test_get_mail_dir(&tuser, mail);
+	mail_set_seq(mail, 1);
+	test_assert(test_fetch_binary(mail, FALSE) != NULL);
+	test_assert(test_fetch_binary(mail, TRUE) != NULL);
+	mail_dir = test_get_mail_dir(&tuser, mail);
+	test_assert(test_file_exists(mail_dir));
+
+	mail_expunge(mail);
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&t) == 0);
+	test_assert(!test_file_exists(mail_dir));
+	/* the other mail's parts are still stored */
+	test_assert(test_file_exists(mail_dir2));
+
+	test_user_deinit(&tuser);
+	test_end();
+}
+
+static bool test_binary_cache_dir_check(const char *dir)
+{
+	struct setting_parser_context *parser;
+	const char *error;
+	pool_t pool;
+	bool ret;
+
+	pool = pool_alloconly_create("binary cache settings", 1024);
+	parser = settings_parser_init(pool, &mail_storage_setting_parser_info,
+				      0);
+	if (settings_parse_line(parser, t_strconcat(
+			"mail_binary_cache_dir=", dir, NULL)) < 0)
+		i_fatal("settings_parse_line() failed");
+	ret = settings_parser_check(parser, pool, &error);
+	settings_parser_deinit(&parser);
+	pool_unref(&pool);
+	return ret;
+}
+
+static void test_binary_cache_per_user_dir(void)
+{
+	test_begin("mail binary cache per-user directory");
+	test_assert(test_binary_cache_dir_check(""));
+	test_assert(test_binary_cache_dir_check("~/binary-cache"));
+	test_assert(test_binary_cache_dir_check("/var/cache/%u"));
+	test_assert(test_binary_cache_dir_check("/var/cache/%{user}"));
+	test_assert(test_binary_cache_dir_check("%h/binary-cache"));
+	test_assert(!test_binary_cache_dir_check("/var/cache/binary"));
+	test_assert(!test_binary_cache_dir_check("/var/cache/%d"));
+	test_end();
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*test_functions[])(void) = {
+		test_binary_cache_hit_miss,
+		test_binary_cache_size_limit,
+		test_binary_cache_eviction,
+		test_binary_cache_expunge,
+		test_binary_cache_per_user_dir,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-mail-binary-cache",
+				MASTER_SERVICE_FLAG_STANDALONE |
+				MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS,
+				&argc, &argv, "");
+	master_service_init_finish(master_service);
+	storage_service = mail_storage_service_init(master_service, NULL,
+				MAIL_STORAGE_SERVICE_FLAG_NO_RESTRICT_ACCESS |
+				MAIL_STORAGE_SERVICE_FLAG_NO_CHDIR |
+				MAIL_STORAGE_SERVICE_FLAG_NO_LOG_INIT |
+				MAIL_STORAGE_SERVICE_FLAG_NO_PLUGINS);
+
+	test_dir = i_strdup_printf("/tmp/test-mail-binary-cache.%s", my_pid);
+	if (mkdir(test_dir, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", test_dir);
+
+	ret = test_run_initialized(test_functions);
+
+	if (unlink_directory(test_dir, UNLINK_DIRECTORY_FLAG_RMDIR) < 0)
+		i_error("unlink_directory(%s) failed: %m", test_dir);
+	i_free(test_dir);
+	mail_storage_service_deinit(&storage_service);
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -0,0 +1,181 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "test-common.h"
+#include "mail-search-build.h"
+#include "mail-search-parser.h"
+#include "mail-search.h"
+
+struct {
+	const char *input;
+	const char *output;
+} tests[] = {
+	/* AND: cheapest per non-match first */
+	{ "TEXT foo SUBJECT bar FLAGGED", "(FLAGGED) SUBJECT bar TEXT foo" },
+	{ "SEEN FLAGGED", "(FLAGGED) (SEEN)" },
+	{ "TEXT foo NOT SEEN", "NOT (SEEN) TEXT foo" },
+	/* equal args keep their order */
+	{ "SUBJECT a SUBJECT b", "SUBJECT a SUBJECT b" },
+	{ "SUBJECT b SUBJECT a", "SUBJECT b SUBJECT a" },
+
+	/* OR: cheapest per match first */
+	{ "OR TEXT foo FLAGGED", "(OR (FLAGGED) TEXT foo)" },
+	{ "OR FLAGGED SEEN", "(OR (SEEN) (FLAGGED))" },
+	{ "OR TEXT foo OR SUBJECT bar SEEN",
+	  "(OR (SEEN) OR SUBJECT bar TEXT foo)" },
+
+	/* subtrees are ordered internally and by their total cost */
+	{ "TEXT foo OR SUBJECT a SUBJECT b",
+	  "(OR SUBJECT a SUBJECT b) TEXT foo" },
+	{ "OR ( TEXT foo FLAGGED ) SEEN", "(OR (SEEN) ((FLAGGED) TEXT foo))" },
+	{ "TEXT foo ( TEXT bar SEEN ) FLAGGED",
+	  "(FLAGGED) ((SEEN) TEXT bar) TEXT foo" },
+	/* NOT (OR ..) is unlikely to match, but it's still costlier than
+	   LARGER per decided result */
+	{ "NOT ( OR TEXT foo SEEN ) LARGER 10",
+	  "LARGER 10 NOT ((OR (SEEN) TEXT foo))" },
+};
+
+static void
+test_estimate(const struct mail_search_arg *arg, void *context ATTR_UNUSED,
+	      unsigned int *cost_r, unsigned int *match_pct_r)
+{
+	switch (arg->type) {
+	case SEARCH_FLAGS:
+		*cost_r = 1;
+		*match_pct_r = arg->value.flags == MAIL_SEEN ? 80 : 10;
+		break;
+	case SEARCH_HEADER:
+	case SEARCH_HEADER_ADDRESS:
+	case SEARCH_HEADER_COMPRESS_LWSP:
+		*cost_r = 100;
+		*match_pct_r = 10;
+		break;
+	case SEARCH_BODY:
+	case SEARCH_TEXT:
+		*cost_r = 1000;
+		*match_pct_r = 10;
+		break;
+	default:
+		*cost_r = 20;
+		*match_pct_r = 50;
+		break;
+	}
+}
+
+static struct mail_search_args *
+test_build_search_args(const char *args)
+{
+	struct mail_search_parser *parser;
+	struct mail_search_args *sargs;
+	const char *error, *charset = "UTF-8";
+
+	parser = mail_search_parser_init_cmdline(t_strsplit(args, " "));
+	if (mail_search_build(mail_search_register_get_imap(),
+			      parser, &charset, &sargs, &error) < 0)
+		i_panic("%s", error);
+	mail_search_parser_deinit(&parser);
+	return sargs;
+}
+
+static const char *test_args_to_imap(struct mail_search_args *args)
+{
+	string_t *str = t_str_new(128);
+	const char *error;
+
+	test_assert(mail_search_args_to_imap(str, args->args, &error));
+	return str_c(str);
+}
+
+static void test_mail_search_args_order(void)
+{
+	struct mail_search_args *args;
+	struct mail_search_args_order *order;
+	const char *orig;
+	unsigned int i;
+
+	test_begin("mail search args order");
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		args = test_build_search_args(tests[i].input);
+		orig = test_args_to_imap(args);
+		order = mail_search_args_order_by_cost(args, test_estimate,
+						       NULL, NULL);
+		test_assert_idx(order != NULL, i);
+		test_assert_idx(strcmp(test_args_to_imap(args),
+				       tests[i].output) == 0, i);
+
+		/* the caller's args are given back in the original order */
+		mail_search_args_order_restore(&order);
+		test_assert_idx(order == NULL, i);
+		test_assert_idx(strcmp(test_args_to_imap(args), orig) == 0, i);
+		mail_search_args_unref(&args);
+	}
+	test_end();
+}
+
+static void test_mail_search_args_order_shared(void)
+{
+	struct mail_search_args *args;
+	struct mail_search_args_order *order;
+	struct mail_search_arg *first;
+
+	test_begin("mail search args order shared");
+	args = test_build_search_args("TEXT foo FLAGGED");
+	first = args->args;
+
+	/* a second search using the same args doesn't reorder them */
+	order = mail_search_args_order_by_cost(args, test_estimate,
+					       NULL, NULL);
+	test_assert(order != NULL);
+	test_assert(mail_search_args_order_by_cost(args, test_estimate,
+						   NULL, NULL) == NULL);
+	test_assert(strcmp(test_args_to_imap(args), "(FLAGGED) TEXT foo") == 0);
+	mail_search_args_order_restore(&order);
+	test_assert(args->args == first);
+	test_assert(!args->ordered);
+
+	/* reusing the args after restoring orders them again */
+	order = mail_search_args_order_by_cost(args, test_estimate,
+					       NULL, NULL);
+	test_assert(order != NULL);
+	mail_search_args_order_restore(&order);
+	test_assert(strcmp(test_args_to_imap(args), "TEXT foo (FLAGGED)") == 0);
+	mail_search_args_unref(&args);
+
+	args = mail_search_build_init();
+	test_assert(mail_search_args_order_by_cost(args, test_estimate,
+						   NULL, NULL) == NULL);
+	mail_search_args_unref(&args);
+	test_end();
+}
+
+static void test_mail_search_args_order_explain(void)
+{
+	struct mail_search_args *args;
+	struct mail_search_args_order *order;
+	string_t *str = t_str_new(128);
+
+	test_begin("mail search args order explain");
+	args = test_build_search_args("TEXT foo OR SEEN FLAGGED");
+	order = mail_search_args_order_by_cost(args, test_estimate,
+					       NULL, str);
+	test_assert(strcmp(str_c(str),
+		"(((SEEN)[cost=1,80%] OR (FLAGGED)[cost=1,10%])[cost=1,82%] "
+		"TEXT foo[cost=1000,10%])") == 0);
+	mail_search_args_order_restore(&order);
+	mail_search_args_unref(&args);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_mail_search_args_order,
+		test_mail_search_args_order_shared,
+		test_mail_search_args_order_explain,
+		NULL
+	};
+
+	return test_run(test_functions);
+}
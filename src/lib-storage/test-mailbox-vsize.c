@@ -0,0 +1,230 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "hostpid.h"
+#include "unlink-directory.h"
+#include "master-service.h"
+#include "mail-cache.h"
+#include "mail-index-alloc-cache.h"
+#include "mail-storage-service.h"
+#include "mail-namespace.h"
+#include "mail-storage-private.h"
+#include "test-common.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char test_mail[] =
+"From: Sender <sender@example.com>\r\n"
+"Subject: Vsize test\r\n"
+"\r\n"
+"body\r\n";
+#define TEST_MAIL_VSIZE (sizeof(test_mail)-1)
+
+struct test_user {
+	struct mail_storage_service_user *service_user;
+	struct mail_user *user;
+	struct mailbox *box;
+};
+
+static struct mail_storage_service_ctx *storage_service;
+static char *test_dir;
+
+static void test_mailbox_open(struct test_user *tuser)
+{
+	struct mail_namespace *ns;
+
+	ns = mail_namespace_find_inbox(tuser->user->namespaces);
+	tuser->box = mailbox_alloc(ns->list, "INBOX", 0);
+	if (mailbox_open(tuser->box) < 0) {
+		i_fatal("Opening INBOX failed: %s",
+			mailbox_get_last_error(tuser->box, NULL));
+	}
+}
+
+static void test_user_init(struct test_user *tuser, const char *name)
+{
+	const char *userdb_fields[] = {
+		"mail=sdbox:~/mail",
+		t_strdup_printf("home=%s/%s", test_dir, name),
+		"namespace=inbox",
+		"namespace/inbox/inbox=yes",
+		NULL
+	};
+	struct mail_storage_service_input input;
+	const char *error;
+
+	memset(tuser, 0, sizeof(*tuser));
+	memset(&input, 0, sizeof(input));
+	input.module = input.service = "test-mailbox-vsize";
+	input.username = name;
+	input.userdb_fields = userdb_fields;
+	if (mail_storage_service_lookup_next(storage_service, &input,
+					     &tuser->service_user,
+					     &tuser->user, &error) <= 0)
+		i_fatal("User initialization failed: %s", error);
+	test_mailbox_open(tuser);
+}
+
+static void test_user_deinit(struct test_user *tuser)
+{
+	mailbox_free(&tuser->box);
+	mail_user_unref(&tuser->user);
+	mail_storage_service_user_free(&tuser->service_user);
+}
+
+static void test_save_mails(struct mailbox *box, unsigned int count)
+{
+	struct mailbox_transaction_context *t;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+
+	t = mailbox_transaction_begin(box, MAILBOX_TRANSACTION_FLAG_EXTERNAL);
+	for (; count > 0; count--) {
+		input = i_stream_create_from_data(test_mail,
+						  sizeof(test_mail)-1);
+		save_ctx = mailbox_save_alloc(t);
+		if (mailbox_save_begin(&save_ctx, input) < 0 ||
+		    mailbox_save_continue(save_ctx) < 0 ||
+		    mailbox_save_finish(&save_ctx) < 0) {
+			i_fatal("Saving mail failed: %s",
+				mailbox_get_last_error(box, NULL));
+		}
+		i_stream_unref(&input);
+	}
+	if (mailbox_transaction_commit(&t) < 0) {
+		i_fatal("Committing saved mails failed: %s",
+			mailbox_get_last_error(box, NULL));
+	}
+}
+
+static void test_expunge_uid(struct mailbox *box, uint32_t uid)
+{
+	struct mailbox_transaction_context *t;
+	struct mail *mail;
+
+	t = mailbox_transaction_begin(box, 0);
+	mail = mail_alloc(t, 0, NULL);
+	if (!mail_set_uid(mail, uid))
+		i_fatal("UID %u not found", uid);
+	mail_expunge(mail);
+	mail_free(&mail);
+	if (mailbox_transaction_commit(&t) < 0 || mailbox_sync(box, 0) < 0) {
+		i_fatal("Expunging UID %u failed: %s", uid,
+			mailbox_get_last_error(box, NULL));
+	}
+}
+
+static uoff_t test_get_vsize(struct mailbox *box)
+{
+	struct mailbox_metadata metadata;
+
+	if (mailbox_get_metadata(box, MAILBOX_METADATA_VIRTUAL_SIZE,
+				 &metadata) < 0) {
+		i_fatal("Getting vsize failed: %s",
+			mailbox_get_last_error(box, NULL));
+	}
+	return metadata.virtual_size;
+}
+
+static void
+test_get_vsize_hdr(struct mailbox *box, struct mailbox_index_vsize *hdr_r)
+{
+	const void *data;
+	size_t size;
+
+	memset(hdr_r, 0, sizeof(*hdr_r));
+	mail_index_get_header_ext(box->view, box->vsize_hdr_ext_id,
+				  &data, &size);
+	memcpy(hdr_r, data, I_MIN(size, sizeof(*hdr_r)));
+}
+
+/* Reopen the mailbox without its cache file */
+static void test_mailbox_reopen_uncached(struct test_user *tuser)
+{
+	const char *path;
+
+	if (mailbox_get_path_to(tuser->box, MAILBOX_LIST_PATH_TYPE_INDEX,
+				&path) <= 0)
+		i_fatal("Mailbox has no index path");
+	path = t_strconcat(path, "/"MAIL_INDEX_PREFIX MAIL_CACHE_FILE_SUFFIX,
+			   NULL);
+	mailbox_free(&tuser->box);
+	mail_index_alloc_cache_destroy_unrefed();
+	if (unlink(path) < 0)
+		i_fatal("unlink(%s) failed: %m", path);
+	test_mailbox_open(tuser);
+}
+
+static void test_mailbox_vsize_expunge(void)
+{
+	struct test_user tuser;
+	struct mailbox_index_vsize hdr;
+
+	test_begin("mailbox vsize header on expunge");
+	test_user_init(&tuser, "expunge");
+
+	test_save_mails(tuser.box, 3);
+	test_assert(test_get_vsize(tuser.box) == 3*TEST_MAIL_VSIZE);
+	test_get_vsize_hdr(tuser.box, &hdr);
+	test_assert(hdr.highest_uid == 3 && hdr.message_count == 3 &&
+		    hdr.vsize == 3*TEST_MAIL_VSIZE);
+
+	/* the expunged mail's vsize is in cache, so the header is updated */
+	test_expunge_uid(tuser.box, 1);
+	test_get_vsize_hdr(tuser.box, &hdr);
+	test_assert(hdr.highest_uid == 3 && hdr.message_count == 2 &&
+		    hdr.vsize == 2*TEST_MAIL_VSIZE);
+
+	/* the mail files aren't opened while syncing, so without the cache
+	   the header is reset */
+	test_mailbox_reopen_uncached(&tuser);
+	test_expunge_uid(tuser.box, 2);
+	test_get_vsize_hdr(tuser.box, &hdr);
+	test_assert(hdr.highest_uid == 0 && hdr.message_count == 0 &&
+		    hdr.vsize == 0);
+
+	/* ..and rebuilt when the vsize is looked up the next time */
+	test_assert(test_get_vsize(tuser.box) == TEST_MAIL_VSIZE);
+	test_get_vsize_hdr(tuser.box, &hdr);
+	test_assert(hdr.highest_uid == 3 && hdr.message_count == 1 &&
+		    hdr.vsize == TEST_MAIL_VSIZE);
+
+	test_user_deinit(&tuser);
+	test_end();
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*test_functions[])(void) = {
+		test_mailbox_vsize_expunge,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-mailbox-vsize",
+				MASTER_SERVICE_FLAG_STANDALONE |
+				MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS,
+				&argc, &argv, "");
+	master_service_init_finish(master_service);
+	storage_service = mail_storage_service_init(master_service, NULL,
+				MAIL_STORAGE_SERVICE_FLAG_NO_RESTRICT_ACCESS |
+				MAIL_STORAGE_SERVICE_FLAG_NO_CHDIR |
+				MAIL_STORAGE_SERVICE_FLAG_NO_LOG_INIT |
+				MAIL_STORAGE_SERVICE_FLAG_NO_PLUGINS);
+
+	test_dir = i_strdup_printf("/tmp/test-mailbox-vsize.%s", my_pid);
+	if (mkdir(test_dir, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", test_dir);
+
+	ret = test_run_initialized(test_functions);
+
+	if (unlink_directory(test_dir, UNLINK_DIRECTORY_FLAG_RMDIR) < 0)
+		i_error("unlink_directory(%s) failed: %m", test_dir);
+	i_free(test_dir);
+	mail_storage_service_deinit(&storage_service);
+	master_service_deinit(&master_service);
+	return ret;
+}
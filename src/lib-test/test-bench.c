@@ -0,0 +1,169 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "strnum.h"
+#include "test-bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+
+/* Calibrate the iteration count so that each sample takes at least this
+   long. Anything shorter is dominated by the clock's overhead. */
+#define BENCH_SAMPLE_MIN_NSECS 1000000ULL
+#define BENCH_WARMUP_SAMPLES 10
+#define BENCH_DEFAULT_SAMPLES 100
+#define BENCH_NAME_ALIGN 40
+
+volatile uintmax_t test_bench_sink;
+
+static const char *bench_filter;
+static unsigned int bench_samples;
+static bool bench_tsv;
+
+static uint64_t bench_now_nsecs(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		i_fatal("clock_gettime() failed: %m");
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+	struct timeval tv;
+
+	if (gettimeofday(&tv, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	return (uint64_t)tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+#endif
+}
+
+static uint64_t
+bench_run_sample(test_bench_callback_t *callback, void *context,
+		 unsigned int iterations)
+{
+	uint64_t start;
+
+	start = bench_now_nsecs();
+	callback(context, iterations);
+	return bench_now_nsecs() - start;
+}
+
+static unsigned int
+bench_calibrate(test_bench_callback_t *callback, void *context)
+{
+	unsigned int iterations = 1;
+	uint64_t nsecs, next;
+
+	for (;;) {
+		nsecs = bench_run_sample(callback, context, iterations);
+		if (nsecs >= BENCH_SAMPLE_MIN_NSECS)
+			return iterations;
+
+		/* aim a bit over the minimum, but don't grow too fast in
+		   case the first runs were slowed down by cold caches */
+		if (nsecs == 0)
+			next = (uint64_t)iterations * 100;
+		else {
+			next = (uint64_t)iterations *
+				BENCH_SAMPLE_MIN_NSECS * 12 / 10 / nsecs + 1;
+			if (next > (uint64_t)iterations * 100)
+				next = (uint64_t)iterations * 100;
+		}
+		if (next >= UINT_MAX / 2)
+			return UINT_MAX / 2;
+		iterations = next;
+	}
+}
+
+static double
+bench_percentile(const uint64_t *sorted, unsigned int count,
+		 unsigned int percentile, unsigned int iterations)
+{
+	unsigned int idx = (count - 1) * percentile / 100;
+
+	return (double)sorted[idx] / iterations;
+}
+
+#undef test_bench
+void test_bench(const char *name, test_bench_callback_t *callback,
+		void *context)
+{
+	ARRAY(uint64_t) samples;
+	const uint64_t *nsecs;
+	unsigned int i, count, iterations;
+
+	if (bench_filter != NULL && strstr(name, bench_filter) == NULL)
+		return;
+
+	T_BEGIN {
+		iterations = bench_calibrate(callback, context);
+		for (i = 0; i < BENCH_WARMUP_SAMPLES; i++)
+			(void)bench_run_sample(callback, context, iterations);
+
+		t_array_init(&samples, bench_samples);
+		for (i = 0; i < bench_samples; i++) {
+			uint64_t n = bench_run_sample(callback, context,
+						      iterations);
+			array_append(&samples, &n, 1);
+		}
+		array_sort(&samples, uint64_cmp);
+		nsecs = array_get(&samples, &count);
+
+		if (bench_tsv) {
+			printf("%s\t%u\t%u\t%.2f\t%.2f\t%.2f\t%.2f\t%.2f\n",
+			       name, iterations, count,
+			       bench_percentile(nsecs, count, 0, iterations),
+			       bench_percentile(nsecs, count, 50, iterations),
+			       bench_percentile(nsecs, count, 90, iterations),
+			       bench_percentile(nsecs, count, 99, iterations),
+			       bench_percentile(nsecs, count, 100, iterations));
+		} else {
+			printf("%-*s %10.1f ns/op (p90 %.1f, p99 %.1f, "
+			       "%u x %u)\n", BENCH_NAME_ALIGN, name,
+			       bench_percentile(nsecs, count, 50, iterations),
+			       bench_percentile(nsecs, count, 90, iterations),
+			       bench_percentile(nsecs, count, 99, iterations),
+			       count, iterations);
+		}
+		fflush(stdout);
+	} T_END;
+}
+
+int test_bench_run_initialized(void (*bench_functions[])(void))
+{
+	const char *value;
+	unsigned int i;
+
+	bench_filter = getenv("BENCH_FILTER");
+	value = getenv("BENCH_FORMAT");
+	bench_tsv = value != NULL && strcmp(value, "tsv") == 0;
+	value = getenv("BENCH_SAMPLES");
+	if (value == NULL)
+		bench_samples = BENCH_DEFAULT_SAMPLES;
+	else if (str_to_uint(value, &bench_samples) < 0 || bench_samples == 0)
+		i_fatal("Invalid BENCH_SAMPLES: %s", value);
+
+	if (bench_tsv) {
+		printf("name\titerations\tsamples\tmin_ns\tp50_ns\tp90_ns\t"
+		       "p99_ns\tmax_ns\n");
+	}
+	for (i = 0; bench_functions[i] != NULL; i++) {
+		T_BEGIN {
+			bench_functions[i]();
+		} T_END;
+	}
+	return 0;
+}
+
+int test_bench_run(void (*bench_functions[])(void))
+{
+	int ret;
+
+	lib_init();
+	ret = test_bench_run_initialized(bench_functions);
+	lib_deinit();
+	return ret;
+}
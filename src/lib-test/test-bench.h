@@ -0,0 +1,35 @@
+#ifndef TEST_BENCH_H
+#define TEST_BENCH_H
+
+/* Microbenchmark harness. Each benchmark callback runs the measured
+   operation the given number of times. The harness first calibrates the
+   iteration count so that a single sample takes a measurable amount of
+   time, runs a few warmup samples and then reports the per-operation time
+   percentiles over a number of samples.
+
+   Environment variables:
+    - BENCH_FILTER: Run only benchmarks whose name contains the string
+    - BENCH_FORMAT=tsv: Write tab-separated output (for regression scripts)
+    - BENCH_SAMPLES: Number of measured samples (default 100) */
+
+typedef void test_bench_callback_t(void *context, unsigned int iterations);
+
+/* Assign the benchmark's results here so the compiler can't optimize away
+   the code being measured. */
+extern volatile uintmax_t test_bench_sink;
+
+void test_bench(const char *name, test_bench_callback_t *callback,
+		void *context);
+#define test_bench(name, callback, context) \
+	test_bench(name + \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			typeof(context), unsigned int)), \
+		(test_bench_callback_t *)callback, context)
+
+/* Run all the benchmark functions. Returns the process exit code. */
+int test_bench_run(void (*bench_functions[])(void));
+/* Same as test_bench_run(), but the caller initializes and deinitializes
+   the library itself (e.g. with master_service_init()). */
+int test_bench_run_initialized(void (*bench_functions[])(void));
+
+#endif
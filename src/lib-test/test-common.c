@@ -315,25 +315,38 @@ test_fatal_handler(const struct failure_context *ctx,
 	default_fatal_handler(ctx, format, args);
 }
 
-static void test_init(void)
+static void test_init_counts(void)
 {
 	test_prefix = NULL;
 	failure_count = 0;
 	total_count = 0;
 
-	lib_init();
 	i_set_error_handler(test_error_handler);
 	/* Don't set fatal handler until actually needed for fatal testing */
 }
 
-static int test_deinit(void)
+static int test_finish_counts(void)
 {
 	i_assert(test_prefix == NULL);
 	printf("%u / %u tests failed\n", failure_count, total_count);
-	lib_deinit();
 	return failure_count == 0 ? 0 : 1;
 }
 
+static void test_init(void)
+{
+	lib_init();
+	test_init_counts();
+}
+
+static int test_deinit(void)
+{
+	int ret;
+
+	ret = test_finish_counts();
+	lib_deinit();
+	return ret;
+}
+
 static void test_run_funcs(void (*test_functions[])(void))
 {
 	unsigned int i;
@@ -393,6 +406,12 @@ int test_run(void (*test_functions[])(void))
 	test_run_funcs(test_functions);
 	return test_deinit();
 }
+int test_run_initialized(void (*test_functions[])(void))
+{
+	test_init_counts();
+	test_run_funcs(test_functions);
+	return test_finish_counts();
+}
 int test_run_with_fatals(void (*test_functions[])(void),
 			 enum fatal_test_state (*fatal_functions[])(int))
 {
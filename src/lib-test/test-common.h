@@ -32,6 +32,9 @@ void test_out_reason(const char *name, bool success, const char *reason)
 	ATTR_NULL(3);
 
 int test_run(void (*test_functions[])(void));
+/* Like test_run(), but the caller has already called lib_init(), e.g. via
+   master_service_init(), and deinitializes it itself afterwards. */
+int test_run_initialized(void (*test_functions[])(void));
 
 enum fatal_test_state {
 	FATAL_TEST_FINISHED, /* no more test stages, don't call again */
@@ -0,0 +1,168 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "str.h"
+#include "base64.h"
+#include "hash.h"
+#include "test-bench.h"
+
+#define BENCH_HASH_KEY_COUNT 10000
+
+struct bench_hash_ctx {
+	HASH_TABLE(char *, void *) hash;
+	const char **keys;
+};
+
+static void bench_hash_lookup(struct bench_hash_ctx *ctx,
+			      unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		test_bench_sink += POINTER_CAST_TO(hash_table_lookup(ctx->hash,
+			ctx->keys[i % BENCH_HASH_KEY_COUNT]), uintmax_t);
+	}
+}
+
+static void bench_hash_insert_remove(struct bench_hash_ctx *ctx,
+				     unsigned int iterations)
+{
+	unsigned int i;
+	char *key;
+
+	for (i = 0; i < iterations; i++) {
+		key = (char *)ctx->keys[i % BENCH_HASH_KEY_COUNT];
+		hash_table_remove(ctx->hash, key);
+		hash_table_insert(ctx->hash, key, POINTER_CAST(i + 1));
+	}
+}
+
+static void bench_hash(void)
+{
+	struct bench_hash_ctx ctx;
+	unsigned int i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.keys = t_new(const char *, BENCH_HASH_KEY_COUNT);
+	hash_table_create(&ctx.hash, default_pool, 0, str_hash, strcmp);
+	for (i = 0; i < BENCH_HASH_KEY_COUNT; i++) {
+		ctx.keys[i] = t_strdup_printf("key%u@example.com", i);
+		hash_table_insert(ctx.hash, (char *)ctx.keys[i],
+				  POINTER_CAST(i + 1));
+	}
+	test_bench("hash_table_lookup", bench_hash_lookup, &ctx);
+	test_bench("hash_table_insert_remove", bench_hash_insert_remove, &ctx);
+	hash_table_destroy(&ctx.hash);
+}
+
+static void bench_str_append(string_t *str, unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		if (str_len(str) > 4096)
+			str_truncate(str, 0);
+		str_append(str, "Subject: hello world");
+	}
+	test_bench_sink += str_len(str);
+}
+
+static void bench_str_printfa(string_t *str, unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		if (str_len(str) > 4096)
+			str_truncate(str, 0);
+		str_printfa(str, "* %u FETCH (UID %u)\r\n", i, i + 1000);
+	}
+	test_bench_sink += str_len(str);
+}
+
+static void bench_buffer_append(buffer_t *buf, unsigned int iterations)
+{
+	static const unsigned char data[64] = { 0 };
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		if (buf->used > 65536)
+			buffer_set_used_size(buf, 0);
+		buffer_append(buf, data, sizeof(data));
+	}
+	test_bench_sink += buf->used;
+}
+
+static void bench_str(void)
+{
+	string_t *str = str_new(default_pool, 8192);
+
+	test_bench("str_append", bench_str_append, str);
+	str_truncate(str, 0);
+	test_bench("str_printfa", bench_str_printfa, str);
+	str_free(&str);
+
+	str = buffer_create_dynamic(default_pool, 65536 + 128);
+	test_bench("buffer_append", bench_buffer_append, str);
+	buffer_free(&str);
+}
+
+struct bench_base64_ctx {
+	unsigned char input[4096];
+	buffer_t *encoded, *dest;
+};
+
+static void bench_base64_encode_4k(struct bench_base64_ctx *ctx,
+				   unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		buffer_set_used_size(ctx->dest, 0);
+		base64_encode(ctx->input, sizeof(ctx->input), ctx->dest);
+	}
+	test_bench_sink += ctx->dest->used;
+}
+
+static void bench_base64_decode_4k(struct bench_base64_ctx *ctx,
+				   unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		buffer_set_used_size(ctx->dest, 0);
+		if (base64_decode(ctx->encoded->data, ctx->encoded->used,
+				  NULL, ctx->dest) < 0)
+			i_unreached();
+	}
+	test_bench_sink += ctx->dest->used;
+}
+
+static void bench_base64(void)
+{
+	struct bench_base64_ctx ctx;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(ctx.input); i++)
+		ctx.input[i] = i * 7;
+	ctx.encoded = buffer_create_dynamic(default_pool,
+				MAX_BASE64_ENCODED_SIZE(sizeof(ctx.input)));
+	base64_encode(ctx.input, sizeof(ctx.input), ctx.encoded);
+	ctx.dest = buffer_create_dynamic(default_pool, ctx.encoded->used);
+
+	test_bench("base64_encode_4k", bench_base64_encode_4k, &ctx);
+	test_bench("base64_decode_4k", bench_base64_decode_4k, &ctx);
+	buffer_free(&ctx.encoded);
+	buffer_free(&ctx.dest);
+}
+
+int main(void)
+{
+	static void (*bench_functions[])(void) = {
+		bench_hash,
+		bench_str,
+		bench_base64,
+		NULL
+	};
+	return test_bench_run(bench_functions);
+}
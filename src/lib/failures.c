@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "ioloop.h"
+#include "buffer.h"
 #include "str.h"
 #include "hostpid.h"
 #include "net.h"
@@ -16,6 +17,9 @@
 #include <syslog.h>
 #include <time.h>
 
+/* Flush buffered log writes when this much is buffered */
+#define LOG_WRITE_BUF_FLUSH_SIZE (1024*32)
+
 const char *failure_log_type_prefixes[LOG_TYPE_COUNT] = {
 	"Debug: ",
 	"Info: ",
@@ -48,6 +52,14 @@ static char *log_prefix = NULL;
 static char *log_stamp_format = NULL, *log_stamp_format_suffix = NULL;
 static bool failure_ignore_errors = FALSE, log_prefix_sent = FALSE;
 static bool coredump_on_error = FALSE;
+/* the previous formatted timestamp, unless it had %{usecs} */
+static struct tm log_stamp_last_tm;
+static char log_stamp_last[256] = "";
+
+/* log_fd_write()s are delayed into this buffer while buffering is enabled */
+static buffer_t *log_write_buf = NULL;
+static int log_write_buf_fd = -1;
+static bool log_buffering = FALSE;
 
 static void ATTR_FORMAT(2, 0)
 i_internal_error_handler(const struct failure_context *ctx,
@@ -74,6 +86,14 @@ void failure_exit(int status)
 	exit(status);
 }
 
+static bool log_stamp_tm_equals(const struct tm *tm1, const struct tm *tm2)
+{
+	return tm1->tm_sec == tm2->tm_sec && tm1->tm_min == tm2->tm_min &&
+		tm1->tm_hour == tm2->tm_hour && tm1->tm_mday == tm2->tm_mday &&
+		tm1->tm_mon == tm2->tm_mon && tm1->tm_year == tm2->tm_year &&
+		tm1->tm_isdst == tm2->tm_isdst;
+}
+
 static void log_prefix_add(const struct failure_context *ctx, string_t *str)
 {
 	const struct tm *tm = ctx->timestamp;
@@ -89,11 +109,25 @@ static void log_prefix_add(const struct failure_context *ctx, string_t *str)
 			now.tv_usec = ctx->timestamp_usecs;
 		}
 
-		if (strftime(buf, sizeof(buf),
-			     get_log_stamp_format("unused", now.tv_usec), tm) > 0)
+		if (log_stamp_format_suffix == NULL &&
+		    log_stamp_last[0] != '\0' &&
+		    log_stamp_tm_equals(tm, &log_stamp_last_tm)) {
+			/* same second as with the previous line */
+			str_append(str, log_stamp_last);
+		} else if (strftime(buf, sizeof(buf),
+				    get_log_stamp_format("unused", now.tv_usec),
+				    tm) > 0) {
 			str_append(str, buf);
+			if (log_stamp_format_suffix == NULL) {
+				log_stamp_last_tm = *tm;
+				(void)i_strocpy(log_stamp_last, buf,
+						sizeof(log_stamp_last));
+			}
+		}
 	}
-	if (log_prefix != NULL)
+	if (ctx->log_prefix != NULL)
+		str_append(str, ctx->log_prefix);
+	else if (log_prefix != NULL)
 		str_append(str, log_prefix);
 }
 
@@ -153,6 +187,41 @@ static int log_fd_write(int fd, const unsigned char *data, unsigned int len)
 	return 0;
 }
 
+static int log_write_buf_flush(void)
+{
+	int ret;
+
+	if (log_write_buf == NULL || log_write_buf->used == 0)
+		return 0;
+
+	ret = log_fd_write(log_write_buf_fd, log_write_buf->data,
+			   log_write_buf->used);
+	buffer_set_used_size(log_write_buf, 0);
+	return ret;
+}
+
+static int log_write(const struct failure_context *ctx, int fd,
+		     const unsigned char *data, unsigned int len)
+{
+	if (!log_buffering || ctx->type == LOG_TYPE_FATAL ||
+	    ctx->type == LOG_TYPE_PANIC) {
+		/* keep the ordering of the lines */
+		if (log_write_buf_flush() < 0)
+			return -1;
+		return log_fd_write(fd, data, len);
+	}
+
+	if (fd != log_write_buf_fd) {
+		if (log_write_buf_flush() < 0)
+			return -1;
+		log_write_buf_fd = fd;
+	}
+	buffer_append(log_write_buf, data, len);
+	if (log_write_buf->used >= LOG_WRITE_BUF_FLUSH_SIZE)
+		return log_write_buf_flush();
+	return 0;
+}
+
 static int ATTR_FORMAT(3, 0)
 default_handler(const struct failure_context *ctx, int fd,
 		const char *format, va_list args)
@@ -176,7 +245,7 @@ default_handler(const struct failure_context *ctx, int fd,
 		str_vprintfa(str, printf_format_fix(format), args);
 		str_append_c(str, '\n');
 
-		ret = log_fd_write(fd, str_data(str), str_len(str));
+		ret = log_write(ctx, fd, str_data(str), str_len(str));
 	} T_END;
 
 	if (ret < 0 && failure_ignore_errors)
@@ -385,9 +454,12 @@ void i_get_failure_handlers(failure_callback_t **fatal_callback_r,
 }
 
 static int ATTR_FORMAT(3, 0)
-syslog_handler(int level, enum log_type type, const char *format, va_list args)
+syslog_handler(const struct failure_context *ctx, int level,
+	       const char *format, va_list args)
 {
 	static int recursed = 0;
+	const char *prefix = ctx->log_prefix != NULL ? ctx->log_prefix :
+		log_prefix;
 
 	if (recursed >= 2)
 		return -1;
@@ -397,9 +469,9 @@ syslog_handler(int level, enum log_type type, const char *format, va_list args)
 	   so make sure errors are shown clearly */
 	T_BEGIN {
 		syslog(level, "%s%s%s",
-		       log_prefix == NULL ? "" : log_prefix,
-		       type != LOG_TYPE_INFO ?
-		       failure_log_type_prefixes[type] : "",
+		       prefix == NULL ? "" : prefix,
+		       ctx->type != LOG_TYPE_INFO ?
+		       failure_log_type_prefixes[ctx->type] : "",
 		       t_strdup_vprintf(format, args));
 	} T_END;
 	recursed--;
@@ -411,7 +483,7 @@ void i_syslog_fatal_handler(const struct failure_context *ctx,
 {
 	int status = ctx->exit_status;
 
-	if (syslog_handler(LOG_CRIT, ctx->type, format, args) < 0 &&
+	if (syslog_handler(ctx, LOG_CRIT, format, args) < 0 &&
 	    status == FATAL_DEFAULT)
 		status = FATAL_LOGERROR;
 
@@ -445,7 +517,7 @@ void i_syslog_error_handler(const struct failure_context *ctx,
 		i_unreached();
 	}
 
-	if (syslog_handler(level, ctx->type, format, args) < 0)
+	if (syslog_handler(ctx, level, format, args) < 0)
 		failure_exit(FATAL_LOGERROR);
 }
 
@@ -463,6 +535,8 @@ static void open_log_file(int *fd, const char *path)
 {
 	const char *str;
 
+	if (*fd == log_write_buf_fd)
+		(void)log_write_buf_flush();
 	if (*fd != STDERR_FILENO) {
 		if (close(*fd) < 0) {
 			str = t_strdup_printf("close(%d) failed: %m\n", *fd);
@@ -686,6 +760,22 @@ void i_set_failure_internal(void)
 	i_set_debug_handler(i_internal_error_handler);
 }
 
+void i_set_failure_buffering(bool buffer)
+{
+	if (buffer) {
+		if (log_write_buf == NULL) {
+			log_write_buf = buffer_create_dynamic(default_pool,
+						LOG_WRITE_BUF_FLUSH_SIZE + 1024);
+		}
+		log_buffering = TRUE;
+		return;
+	}
+
+	log_buffering = FALSE;
+	if (log_write_buf_flush() < 0 && !failure_ignore_errors)
+		failure_exit(FATAL_LOGWRITE);
+}
+
 void i_set_failure_ignore_errors(bool ignore)
 {
 	failure_ignore_errors = ignore;
@@ -719,6 +809,7 @@ void i_set_failure_timestamp_format(const char *fmt)
 
 	i_free(log_stamp_format);
 	i_free_and_null(log_stamp_format_suffix);
+	log_stamp_last[0] = '\0';
 
 	p = strstr(fmt, "%{usecs}");
 	if (p == NULL)
@@ -746,6 +837,12 @@ void i_set_failure_exit_callback(void (*callback)(int *status))
 
 void failures_deinit(void)
 {
+	log_buffering = FALSE;
+	(void)log_write_buf_flush();
+	if (log_write_buf != NULL)
+		buffer_free(&log_write_buf);
+	log_write_buf_fd = -1;
+
 	if (log_debug_fd == log_info_fd || log_debug_fd == log_fd)
 		log_debug_fd = STDERR_FILENO;
 
@@ -37,6 +37,9 @@ struct failure_context {
 	int exit_status; /* for LOG_TYPE_FATAL */
 	const struct tm *timestamp; /* NULL = use time() + localtime() */
 	unsigned int timestamp_usecs;
+	/* override the log prefix for file and syslog logging,
+	   NULL = use i_set_failure_prefix() */
+	const char *log_prefix;
 };
 
 #define DEFAULT_FAILURE_STAMP_FORMAT "%b %d %H:%M:%S "
@@ -102,6 +105,10 @@ void i_set_failure_internal(void);
 /* If writing to log fails, ignore it instead of existing with
    FATAL_LOGWRITE or FATAL_LOGERROR. */
 void i_set_failure_ignore_errors(bool ignore);
+/* Buffer the messages written to log files until buffering is disabled
+   again. This allows writing many messages with a single write().
+   Fatal and panic messages are never buffered. */
+void i_set_failure_buffering(bool buffer);
 
 /* Send informational messages to specified log file. i_set_failure_*()
    functions modify the info file too, so call this function after them. */
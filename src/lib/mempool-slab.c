@@ -0,0 +1,400 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+#include "lib.h"
+#include "llist.h"
+#include "safe-memset.h"
+#include "mempool.h"
+
+/* Each slab is a single malloc()ed block containing objects of the same size
+   class. Allocations larger than SLAB_MAX_OBJECT_SIZE are malloc()ed
+   separately. */
+#define SLAB_SIZE 8192
+#define SLAB_CLASS_ALIGN 16
+#define SLAB_MAX_OBJECT_SIZE 512
+#define SLAB_CLASS_COUNT (SLAB_MAX_OBJECT_SIZE / SLAB_CLASS_ALIGN)
+
+#ifdef DEBUG
+#  define CLEAR_CHR 0xde
+#endif
+
+struct slab_object_header {
+	/* NULL for large allocations */
+	struct slab *slab;
+};
+#define SIZEOF_OBJECT_HEADER MEM_ALIGN(sizeof(struct slab_object_header))
+#define OBJECT_HEADER(mem) \
+	((struct slab_object_header *) \
+	 ((unsigned char *)(mem) - SIZEOF_OBJECT_HEADER))
+
+struct slab {
+	struct slab *prev, *next;
+	struct slab_class *class;
+
+	/* freed objects, linked through their first bytes */
+	void *free_list;
+	unsigned int used_count;
+	/* objects starting from this index have never been allocated */
+	unsigned int unused_idx;
+
+	/* objects[] */
+};
+#define SIZEOF_SLAB MEM_ALIGN(sizeof(struct slab))
+
+struct slab_class {
+	struct slab_pool *pool;
+	/* usable size of the objects, not including the header */
+	size_t size;
+	unsigned int objects_per_slab;
+
+	/* slabs with some free objects are kept separate from the full ones,
+	   so allocation never needs to search for space */
+	struct slab *partial_slabs, *full_slabs;
+};
+
+struct slab_large {
+	struct slab_large *prev, *next;
+	size_t size;
+
+	/* struct slab_object_header hdr; */
+};
+#define SIZEOF_LARGE MEM_ALIGN(sizeof(struct slab_large))
+#define LARGE_HEADER(hdr) \
+	((struct slab_large *)((unsigned char *)(hdr) - SIZEOF_LARGE))
+
+struct slab_pool {
+	struct pool pool;
+	int refcount;
+	char *name;
+
+	struct slab_class classes[SLAB_CLASS_COUNT];
+	struct slab_large *large;
+
+	size_t used_size, alloc_size;
+};
+
+static const char *pool_slab_get_name(pool_t pool);
+static void pool_slab_ref(pool_t pool);
+static void pool_slab_unref(pool_t *pool);
+static void *pool_slab_malloc(pool_t pool, size_t size);
+static void pool_slab_free(pool_t pool, void *mem);
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size, size_t new_size);
+static void pool_slab_clear(pool_t pool);
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool);
+
+static const struct pool_vfuncs static_slab_pool_vfuncs = {
+	pool_slab_get_name,
+
+	pool_slab_ref,
+	pool_slab_unref,
+
+	pool_slab_malloc,
+	pool_slab_free,
+
+	pool_slab_realloc,
+
+	pool_slab_clear,
+	pool_slab_get_max_easy_alloc_size
+};
+
+static const struct pool static_slab_pool = {
+	.v = &static_slab_pool_vfuncs,
+
+	.alloconly_pool = FALSE,
+	.datastack_pool = FALSE
+};
+
+pool_t pool_slab_create(const char *name)
+{
+	struct slab_pool *spool;
+	struct slab_class *class;
+	unsigned int i;
+
+	spool = i_new(struct slab_pool, 1);
+	spool->pool = static_slab_pool;
+	spool->refcount = 1;
+	spool->name = i_strdup(name);
+
+	for (i = 0; i < SLAB_CLASS_COUNT; i++) {
+		class = &spool->classes[i];
+		class->pool = spool;
+		class->size = (i + 1) * SLAB_CLASS_ALIGN;
+		class->objects_per_slab = (SLAB_SIZE - SIZEOF_SLAB) /
+			(SIZEOF_OBJECT_HEADER + class->size);
+	}
+	return &spool->pool;
+}
+
+static const char *pool_slab_get_name(pool_t pool)
+{
+	struct slab_pool *spool = (struct slab_pool *)pool;
+
+	return spool->name;
+}
+
+static void pool_slab_ref(pool_t pool)
+{
+	struct slab_pool *spool = (struct slab_pool *)pool;
+
+	spool->refcount++;
+}
+
+static void pool_slab_unref(pool_t *pool)
+{
+	struct slab_pool *spool = (struct slab_pool *)*pool;
+
+	if (--spool->refcount > 0)
+		return;
+
+	*pool = NULL;
+	pool_slab_clear(&spool->pool);
+	i_free(spool->name);
+	i_free(spool);
+}
+
+static struct slab *slab_alloc(struct slab_class *class)
+{
+	struct slab *slab;
+
+	slab = calloc(SLAB_SIZE, 1);
+	if (unlikely(slab == NULL)) {
+		i_fatal_status(FATAL_OUTOFMEM, "slab_alloc(%d): Out of memory",
+			       SLAB_SIZE);
+	}
+	slab->class = class;
+	DLLIST_PREPEND(&class->partial_slabs, slab);
+	class->pool->alloc_size += SLAB_SIZE;
+	return slab;
+}
+
+static void slab_free(struct slab_class *class, struct slab *slab)
+{
+	i_assert(slab->used_count == 0);
+
+	DLLIST_REMOVE(&class->partial_slabs, slab);
+	class->pool->alloc_size -= SLAB_SIZE;
+#ifdef DEBUG
+	safe_memset(slab, CLEAR_CHR, SLAB_SIZE);
+#endif
+	free(slab);
+}
+
+static void *pool_slab_malloc_large(struct slab_pool *spool, size_t size)
+{
+	struct slab_large *large;
+	struct slab_object_header *hdr;
+
+	if (unlikely(size > SSIZE_T_MAX - SIZEOF_LARGE - SIZEOF_OBJECT_HEADER)) {
+		i_fatal_status(FATAL_OUTOFMEM, "pool_slab_malloc(%"PRIuSIZE_T
+			       "): Out of memory", size);
+	}
+	large = calloc(SIZEOF_LARGE + SIZEOF_OBJECT_HEADER + size, 1);
+	if (unlikely(large == NULL)) {
+		i_fatal_status(FATAL_OUTOFMEM, "pool_slab_malloc(%"PRIuSIZE_T
+			       "): Out of memory", size);
+	}
+	large->size = size;
+	DLLIST_PREPEND(&spool->large, large);
+
+	spool->used_size += size;
+	spool->alloc_size += SIZEOF_LARGE + SIZEOF_OBJECT_HEADER + size;
+
+	hdr = PTR_OFFSET(large, SIZEOF_LARGE);
+	hdr->slab = NULL;
+	return PTR_OFFSET(hdr, SIZEOF_OBJECT_HEADER);
+}
+
+static void *pool_slab_malloc(pool_t pool, size_t size)
+{
+	struct slab_pool *spool = (struct slab_pool *)pool;
+	struct slab_class *class;
+	struct slab_object_header *hdr;
+	struct slab *slab;
+	void *mem;
+
+	if (unlikely(size == 0 || size > SSIZE_T_MAX))
+		i_panic("Trying to allocate %"PRIuSIZE_T" bytes", size);
+
+	if (size > SLAB_MAX_OBJECT_SIZE)
+		return pool_slab_malloc_large(spool, size);
+
+	class = &spool->classes[(size - 1) / SLAB_CLASS_ALIGN];
+	slab = class->partial_slabs;
+	if (slab == NULL)
+		slab = slab_alloc(class);
+
+	if (slab->free_list != NULL) {
+		hdr = slab->free_list;
+		mem = PTR_OFFSET(hdr, SIZEOF_OBJECT_HEADER);
+		slab->free_list = *(void **)mem;
+		*(void **)mem = NULL;
+	} else {
+		i_assert(slab->unused_idx < class->objects_per_slab);
+		hdr = PTR_OFFSET(slab, SIZEOF_SLAB + slab->unused_idx *
+				 (SIZEOF_OBJECT_HEADER + class->size));
+		slab->unused_idx++;
+		mem = PTR_OFFSET(hdr, SIZEOF_OBJECT_HEADER);
+	}
+	hdr->slab = slab;
+
+	if (++slab->used_count == class->objects_per_slab) {
+		/* slab is full now */
+		DLLIST_REMOVE(&class->partial_slabs, slab);
+		DLLIST_PREPEND(&class->full_slabs, slab);
+	}
+	spool->used_size += class->size;
+	return mem;
+}
+
+static void pool_slab_free_large(struct slab_pool *spool, void *mem)
+{
+	struct slab_large *large;
+
+	large = LARGE_HEADER(OBJECT_HEADER(mem));
+	DLLIST_REMOVE(&spool->large, large);
+
+	spool->used_size -= large->size;
+	spool->alloc_size -= SIZEOF_LARGE + SIZEOF_OBJECT_HEADER + large->size;
+#ifdef DEBUG
+	safe_memset(mem, CLEAR_CHR, large->size);
+#endif
+	free(large);
+}
+
+static void pool_slab_free(pool_t pool, void *mem)
+{
+	struct slab_pool *spool = (struct slab_pool *)pool;
+	struct slab_object_header *hdr;
+	struct slab_class *class;
+	struct slab *slab;
+
+	if (mem == NULL)
+		return;
+
+	hdr = OBJECT_HEADER(mem);
+	slab = hdr->slab;
+	if (slab == NULL) {
+		pool_slab_free_large(spool, mem);
+		return;
+	}
+	class = slab->class;
+	i_assert(class->pool == spool);
+	i_assert(slab->used_count > 0);
+
+	/* keep the free objects zeroed, so they don't need to be cleared
+	   when they're allocated again */
+	memset(mem, 0, class->size);
+	*(void **)mem = slab->free_list;
+	slab->free_list = hdr;
+	spool->used_size -= class->size;
+
+	if (slab->used_count-- == class->objects_per_slab) {
+		/* slab was full */
+		DLLIST_REMOVE(&class->full_slabs, slab);
+		DLLIST_PREPEND(&class->partial_slabs, slab);
+	}
+	if (slab->used_count == 0 &&
+	    (slab->prev != NULL || slab->next != NULL)) {
+		/* give the memory back, unless it's the last slab that still
+		   has free space. that avoids continuously allocating and
+		   freeing a slab when a single object is allocated and
+		   freed. */
+		slab_free(class, slab);
+	}
+}
+
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size, size_t new_size)
+{
+	struct slab_object_header *hdr;
+	struct slab_large *large;
+	size_t mem_size;
+	void *new_mem;
+
+	if (unlikely(new_size == 0 || new_size > SSIZE_T_MAX))
+		i_panic("Trying to allocate %"PRIuSIZE_T" bytes", new_size);
+
+	if (mem == NULL)
+		return pool_slab_malloc(pool, new_size);
+
+	hdr = OBJECT_HEADER(mem);
+	if (hdr->slab != NULL)
+		mem_size = hdr->slab->class->size;
+	else {
+		large = LARGE_HEADER(hdr);
+		mem_size = large->size;
+	}
+	if (old_size > mem_size)
+		old_size = mem_size;
+
+	if (new_size <= mem_size) {
+		/* fits into the existing allocation */
+		if (old_size < new_size) {
+			memset(PTR_OFFSET(mem, old_size), 0,
+			       new_size - old_size);
+		}
+		return mem;
+	}
+
+	new_mem = pool_slab_malloc(pool, new_size);
+	memcpy(new_mem, mem, old_size);
+	pool_slab_free(pool, mem);
+	return new_mem;
+}
+
+static void slab_list_free(struct slab **list)
+{
+	struct slab *slab;
+
+	while (*list != NULL) {
+		slab = *list;
+		*list = slab->next;
+#ifdef DEBUG
+		safe_memset(slab, CLEAR_CHR, SLAB_SIZE);
+#endif
+		free(slab);
+	}
+}
+
+static void pool_slab_clear(pool_t pool)
+{
+	struct slab_pool *spool = (struct slab_pool *)pool;
+	struct slab_large *large;
+	unsigned int i;
+
+	for (i = 0; i < SLAB_CLASS_COUNT; i++) {
+		slab_list_free(&spool->classes[i].partial_slabs);
+		slab_list_free(&spool->classes[i].full_slabs);
+	}
+	while (spool->large != NULL) {
+		large = spool->large;
+		spool->large = large->next;
+		free(large);
+	}
+	spool->used_size = 0;
+	spool->alloc_size = 0;
+}
+
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool ATTR_UNUSED)
+{
+	return 0;
+}
+
+size_t pool_slab_get_total_used_size(pool_t pool)
+{
+	struct slab_pool *spool = (struct slab_pool *)pool;
+
+	i_assert(pool->v == &static_slab_pool_vfuncs);
+
+	return spool->used_size;
+}
+
+size_t pool_slab_get_total_alloc_size(pool_t pool)
+{
+	struct slab_pool *spool = (struct slab_pool *)pool;
+
+	i_assert(pool->v == &static_slab_pool_vfuncs);
+
+	return spool->alloc_size;
+}
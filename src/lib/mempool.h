@@ -58,6 +58,13 @@ extern pool_t unsafe_data_stack_pool;
    malloc()ed block size, part of it is used internally. */
 pool_t pool_alloconly_create(const char *name, size_t size);
 
+/* Create a new pool for many small allocations that are individually freed.
+   Allocations up to 512 bytes are rounded up to a size class and packed
+   into fixed-size slabs, larger ones are malloc()ed directly. Freed objects
+   are reused for new allocations of the same size class and slabs are
+   released once all of their objects are freed. */
+pool_t pool_slab_create(const char *name);
+
 /* When allocating memory from returned pool, the data stack frame must be
    the same as it was when calling this function. pool_unref() also checks
    that the stack frame is the same. This should make it quite safe to use. */
@@ -132,4 +139,12 @@ size_t pool_alloconly_get_total_used_size(pool_t pool);
 /* Returns how much system memory has been allocated for this pool. */
 size_t pool_alloconly_get_total_alloc_size(pool_t pool);
 
+/* These functions are only for pools created with pool_slab_create(): */
+
+/* Returns how much memory is currently allocated from this pool, including
+   the rounding up to size classes. */
+size_t pool_slab_get_total_used_size(pool_t pool);
+/* Returns how much system memory is currently allocated for this pool. */
+size_t pool_slab_get_total_alloc_size(pool_t pool);
+
 #endif
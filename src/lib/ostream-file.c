@@ -704,6 +704,7 @@ static off_t io_stream_sendfile(struct ostream_private *outstream,
 	uoff_t start_offset;
 	uoff_t in_size, offset, send_size, v_offset;
 	ssize_t ret;
+	bool would_block = FALSE;
 
 	*sendfile_not_supported_r = FALSE;
 
@@ -740,6 +741,7 @@ static off_t io_stream_sendfile(struct ostream_private *outstream,
 			} else {
 				if (errno == EINTR || errno == EAGAIN) {
 					ret = 0;
+					would_block = TRUE;
 					break;
 				}
 			}
@@ -761,7 +763,7 @@ static off_t io_stream_sendfile(struct ostream_private *outstream,
 	} while ((uoff_t)ret != send_size);
 
 	i_stream_seek(instream, v_offset);
-	if (ret == 0) {
+	if (ret == 0 && !would_block) {
 		/* we should be at EOF. if not, write more. */
 		i_assert(!foutstream->file ||
 			 instream->v_offset - start_offset == in_size);
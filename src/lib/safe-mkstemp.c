@@ -1,5 +1,6 @@
 /* Copyright (c) 2007-2016 Dovecot authors, see the included COPYING file */
 
+#define _GNU_SOURCE /* for O_TMPFILE with Linux */
 #include "lib.h"
 #include "str.h"
 #include "hex-binary.h"
@@ -93,3 +94,53 @@ int safe_mkstemp_hostpid_group(string_t *prefix, mode_t mode,
 	str_printfa(prefix, "%s.%s.", my_hostname, my_pid);
 	return safe_mkstemp_group(prefix, mode, gid, gid_origin);
 }
+
+#ifdef O_TMPFILE
+static int safe_mkstemp_tmpfile(string_t *prefix, mode_t mode)
+{
+	static bool tmpfile_unsupported = FALSE;
+	const char *path, *p, *dir;
+	mode_t old_umask;
+	int fd;
+
+	if (tmpfile_unsupported)
+		return -1;
+
+	path = str_c(prefix);
+	p = strrchr(path, '/');
+	if (p == NULL)
+		dir = ".";
+	else if (p == path)
+		dir = "/";
+	else
+		dir = t_strdup_until(path, p);
+
+	old_umask = umask(0666 ^ mode);
+	fd = open(dir, O_TMPFILE | O_RDWR, 0666);
+	umask(old_umask);
+	if (fd == -1 && (errno == EOPNOTSUPP || errno == EISDIR)) {
+		/* the filesystem or kernel doesn't support O_TMPFILE.
+		   don't bother trying again. */
+		tmpfile_unsupported = TRUE;
+	}
+	return fd;
+}
+#endif
+
+int safe_mkstemp_anon(string_t *prefix, mode_t mode)
+{
+	size_t prefix_len = str_len(prefix);
+	int fd;
+
+#ifdef O_TMPFILE
+	/* on any failure fall back to the old method, which also gives the
+	   caller a proper errno */
+	if ((fd = safe_mkstemp_tmpfile(prefix, mode)) != -1)
+		return fd;
+#endif
+	fd = safe_mkstemp_hostpid(prefix, mode, (uid_t)-1, (gid_t)-1);
+	if (fd != -1 && i_unlink(str_c(prefix)) < 0)
+		i_close_fd(&fd);
+	str_truncate(prefix, prefix_len);
+	return fd;
+}
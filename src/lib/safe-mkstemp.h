@@ -11,5 +11,11 @@ int safe_mkstemp_group(string_t *prefix, mode_t mode,
 int safe_mkstemp_hostpid(string_t *prefix, mode_t mode, uid_t uid, gid_t gid);
 int safe_mkstemp_hostpid_group(string_t *prefix, mode_t mode,
 			       gid_t gid, const char *gid_origin);
+/* Create a temporary file that is already unlinked, for callers that only
+   want the fd. If possible, the file is created with O_TMPFILE to the
+   prefix's directory, so it never gets a name and the directory isn't
+   modified. Otherwise this falls back to safe_mkstemp_hostpid() + unlink().
+   The prefix string isn't modified. Returns -1 and sets errno on failure. */
+int safe_mkstemp_anon(string_t *prefix, mode_t mode);
 
 #endif
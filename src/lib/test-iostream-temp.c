@@ -4,6 +4,8 @@
 #include "ostream.h"
 #include "iostream-temp.h"
 
+#include <sys/stat.h>
+
 static void test_iostream_temp_create_sized_memory(void)
 {
 	struct ostream *output;
@@ -27,6 +29,7 @@ static void test_iostream_temp_create_sized_memory(void)
 static void test_iostream_temp_create_sized_disk(void)
 {
 	struct ostream *output;
+	struct stat st;
 
 	test_begin("iostream_temp_create_sized() disk");
 	output = iostream_temp_create_sized(".", 0, "test", 4);
@@ -35,6 +38,9 @@ static void test_iostream_temp_create_sized_disk(void)
 	test_assert(o_stream_get_fd(output) == -1);
 	test_assert(o_stream_send(output, "5", 1) == 1);
 	test_assert(o_stream_get_fd(output) != -1);
+	/* the temp file never shows up in the directory */
+	test_assert(fstat(o_stream_get_fd(output), &st) == 0 &&
+		    st.st_nlink == 0);
 	o_stream_destroy(&output);
 	test_end();
 }
@@ -37,6 +37,7 @@ int main(void)
 		test_json_tree,
 		test_llist,
 		test_mempool_alloconly,
+		test_mempool_slab,
 		test_net,
 		test_numpack,
 		test_ostream_escaped,
@@ -53,6 +54,7 @@ int main(void)
 		test_str_find,
 		test_str_sanitize,
 		test_str_table,
+		test_thread_pool,
 		test_time_util,
 		test_timing,
 		test_unichar,
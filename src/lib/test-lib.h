@@ -39,6 +39,7 @@ void test_json_tree(void);
 void test_llist(void);
 void test_mempool_alloconly(void);
 enum fatal_test_state fatal_mempool(int);
+void test_mempool_slab(void);
 void test_net(void);
 void test_numpack(void);
 void test_ostream_escaped(void);
@@ -56,6 +57,7 @@ void test_strnum(void);
 void test_str_find(void);
 void test_str_sanitize(void);
 void test_str_table(void);
+void test_thread_pool(void);
 void test_time_util(void);
 void test_timing(void);
 void test_unichar(void);
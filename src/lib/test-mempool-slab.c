@@ -0,0 +1,101 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+
+#define TEST_ALLOC_COUNT 1000
+#define TEST_MAX_ALLOC_SIZE 700
+
+static bool mem_has_bytes(const void *mem, size_t size, uint8_t b)
+{
+	const uint8_t *bytes = mem;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (bytes[i] != b)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void test_mempool_slab_alloc_free(void)
+{
+	pool_t pool;
+	unsigned char *mem[TEST_ALLOC_COUNT];
+	size_t sizes[TEST_ALLOC_COUNT], max_alloc_size;
+	unsigned int i;
+
+	test_begin("mempool_slab alloc/free");
+	pool = pool_slab_create("test");
+	for (i = 0; i < TEST_ALLOC_COUNT; i++) {
+		sizes[i] = i % TEST_MAX_ALLOC_SIZE + 1;
+		mem[i] = p_malloc(pool, sizes[i]);
+		test_assert(mem_has_bytes(mem[i], sizes[i], 0));
+		memset(mem[i], i, sizes[i]);
+	}
+	for (i = 0; i < TEST_ALLOC_COUNT; i++)
+		test_assert(mem_has_bytes(mem[i], sizes[i], i & 0xff));
+	max_alloc_size = pool_slab_get_total_alloc_size(pool);
+	test_assert(pool_slab_get_total_used_size(pool) <= max_alloc_size);
+
+	/* free every other allocation and reuse the space */
+	for (i = 0; i < TEST_ALLOC_COUNT; i += 2)
+		p_free(pool, mem[i]);
+	for (i = 1; i < TEST_ALLOC_COUNT; i += 2)
+		test_assert(mem_has_bytes(mem[i], sizes[i], i & 0xff));
+	for (i = 0; i < TEST_ALLOC_COUNT; i += 2) {
+		mem[i] = p_malloc(pool, sizes[i]);
+		test_assert(mem_has_bytes(mem[i], sizes[i], 0));
+		memset(mem[i], i, sizes[i]);
+	}
+	test_assert(pool_slab_get_total_alloc_size(pool) == max_alloc_size);
+	for (i = 0; i < TEST_ALLOC_COUNT; i++)
+		test_assert(mem_has_bytes(mem[i], sizes[i], i & 0xff));
+
+	/* freeing everything gives back all but one slab per size class */
+	for (i = 0; i < TEST_ALLOC_COUNT; i++)
+		p_free(pool, mem[i]);
+	test_assert(pool_slab_get_total_used_size(pool) == 0);
+	test_assert(pool_slab_get_total_alloc_size(pool) < max_alloc_size);
+
+	p_clear(pool);
+	test_assert(pool_slab_get_total_alloc_size(pool) == 0);
+	pool_unref(&pool);
+	test_end();
+}
+
+static void test_mempool_slab_realloc(void)
+{
+	pool_t pool;
+	unsigned char *mem;
+	size_t size, new_size;
+
+	test_begin("mempool_slab realloc");
+	pool = pool_slab_create("test");
+	mem = p_malloc(pool, 1);
+	mem[0] = 1;
+	for (size = 1; size < 2000; size = new_size) {
+		new_size = size + size/2 + 1;
+		mem = p_realloc(pool, mem, size, new_size);
+		test_assert(mem_has_bytes(mem, size, 1));
+		test_assert(mem_has_bytes(mem + size, new_size - size, 0));
+		memset(mem, 1, new_size);
+	}
+	test_assert(pool_slab_get_total_used_size(pool) == size);
+
+	/* growing within the same size class must clear the new bytes */
+	p_free(pool, mem);
+	mem = p_malloc(pool, 20);
+	memset(mem, 1, 20);
+	mem = p_realloc(pool, mem, 20, 10);
+	mem = p_realloc(pool, mem, 10, 30);
+	test_assert(mem_has_bytes(mem, 10, 1));
+	test_assert(mem_has_bytes(mem + 10, 20, 0));
+	pool_unref(&pool);
+	test_end();
+}
+
+void test_mempool_slab(void)
+{
+	test_mempool_slab_alloc_free();
+	test_mempool_slab_realloc();
+}
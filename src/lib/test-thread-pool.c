@@ -0,0 +1,97 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "ioloop.h"
+#include "thread-pool.h"
+
+#include <unistd.h>
+
+#define TEST_JOB_COUNT 20
+
+struct test_job {
+	unsigned int input, output;
+	bool done;
+};
+
+static unsigned int test_done_count;
+
+static void test_job_run(struct test_job *job)
+{
+	usleep(1000 * (job->input % 3));
+	job->output = job->input * 2;
+}
+
+static void test_job_done(struct test_job *job)
+{
+	test_assert(job->output == job->input * 2);
+	test_assert(!job->done);
+	job->done = TRUE;
+	if (++test_done_count == TEST_JOB_COUNT)
+		io_loop_stop(current_ioloop);
+}
+
+static void test_thread_pool_ioloop(void)
+{
+	struct ioloop *ioloop;
+	struct thread_pool *pool;
+	struct test_job jobs[TEST_JOB_COUNT];
+	unsigned int i;
+
+	test_begin("thread pool ioloop");
+	memset(jobs, 0, sizeof(jobs));
+	test_done_count = 0;
+
+	ioloop = io_loop_create();
+	pool = thread_pool_init(4);
+	for (i = 0; i < TEST_JOB_COUNT; i++) {
+		jobs[i].input = i;
+		thread_pool_add_job(pool, test_job_run, test_job_done,
+				    &jobs[i]);
+	}
+	/* done callbacks are never called from thread_pool_add_job() */
+	test_assert(thread_pool_get_pending_count(pool) == TEST_JOB_COUNT);
+	test_assert(test_done_count == 0);
+
+	io_loop_run(ioloop);
+	test_assert(test_done_count == TEST_JOB_COUNT);
+	test_assert(thread_pool_get_pending_count(pool) == 0);
+	for (i = 0; i < TEST_JOB_COUNT; i++)
+		test_assert(jobs[i].done);
+
+	thread_pool_deinit(&pool);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_thread_pool_deinit(void)
+{
+	struct ioloop *ioloop;
+	struct thread_pool *pool;
+	struct test_job jobs[TEST_JOB_COUNT];
+	unsigned int i;
+
+	test_begin("thread pool deinit");
+	memset(jobs, 0, sizeof(jobs));
+	test_done_count = 0;
+
+	/* deinit finishes all the jobs and calls their done callbacks */
+	ioloop = io_loop_create();
+	pool = thread_pool_init(2);
+	for (i = 0; i < TEST_JOB_COUNT; i++) {
+		jobs[i].input = i;
+		thread_pool_add_job(pool, test_job_run, test_job_done,
+				    &jobs[i]);
+	}
+	thread_pool_deinit(&pool);
+	test_assert(test_done_count == TEST_JOB_COUNT);
+	for (i = 0; i < TEST_JOB_COUNT; i++)
+		test_assert(jobs[i].done);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+void test_thread_pool(void)
+{
+	test_thread_pool_ioloop();
+	test_thread_pool_deinit();
+}
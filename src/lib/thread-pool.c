@@ -0,0 +1,338 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "fd-close-on-exec.h"
+#include "fd-set-nonblock.h"
+#include "thread-pool.h"
+
+#include <unistd.h>
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#  include <signal.h>
+#endif
+
+/* The jobs are expected to mostly wait for syscalls, so they don't need the
+   default 8 MB stacks, which would count against vsz_limit. */
+#define THREAD_POOL_STACK_SIZE (512*1024)
+
+struct thread_pool_job {
+	struct thread_pool_job *next;
+
+	thread_pool_job_callback_t *job_callback;
+	thread_pool_done_callback_t *done_callback;
+	void *context;
+};
+
+struct thread_pool {
+	unsigned int max_threads;
+	unsigned int pending_count;
+
+	/* jobs whose job_callback has been called, but done_callback not */
+	struct thread_pool_job *done_head, **done_tail;
+
+#ifdef HAVE_PTHREAD
+	/* everything below is protected by the mutex, except the fds and io */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	unsigned int thread_count, idle_count;
+
+	/* jobs that haven't been picked up by a worker yet */
+	struct thread_pool_job *queue_head, **queue_tail;
+	unsigned int queue_count;
+
+	int fd_done[2];
+	struct io *io;
+
+	unsigned int stopping:1;
+#else
+	struct timeout *to;
+#endif
+};
+
+#undef thread_pool_add_job
+
+static void thread_pool_call_done(struct thread_pool *pool,
+				  struct thread_pool_job *job)
+{
+	struct thread_pool_job *next;
+
+	for (; job != NULL; job = next) {
+		next = job->next;
+		i_assert(pool->pending_count > 0);
+		pool->pending_count--;
+		job->done_callback(job->context);
+		i_free(job);
+	}
+}
+
+#ifdef HAVE_PTHREAD
+
+static void
+thread_pool_job_append(struct thread_pool_job ***tail,
+		       struct thread_pool_job *job)
+{
+	job->next = NULL;
+	**tail = job;
+	*tail = &job->next;
+}
+
+static void *thread_pool_worker(void *context)
+{
+	struct thread_pool *pool = context;
+	struct thread_pool_job *job;
+	bool notify;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (pool->queue_head == NULL && !pool->stopping) {
+			pool->idle_count++;
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+			pool->idle_count--;
+		}
+		if (pool->queue_head == NULL)
+			break;
+
+		job = pool->queue_head;
+		pool->queue_head = job->next;
+		if (pool->queue_head == NULL)
+			pool->queue_tail = &pool->queue_head;
+		pool->queue_count--;
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->job_callback(job->context);
+
+		pthread_mutex_lock(&pool->mutex);
+		/* wake up the ioloop only if it isn't already going to
+		   process the done list */
+		notify = pool->done_head == NULL;
+		thread_pool_job_append(&pool->done_tail, job);
+		if (notify) {
+			/* the pipe can't be full, since it's written to only
+			   when the done list becomes non-empty */
+			if (write(pool->fd_done[1], "", 1) < 0) {
+				/* nothing safe to do about it here. the
+				   jobs are handled at deinit at the latest. */
+			}
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+static void thread_pool_handle_done(struct thread_pool *pool)
+{
+	struct thread_pool_job *jobs;
+	char buf[64];
+
+	pthread_mutex_lock(&pool->mutex);
+	if (read(pool->fd_done[0], buf, sizeof(buf)) < 0 && errno != EAGAIN)
+		i_error("read(thread pool pipe) failed: %m");
+	jobs = pool->done_head;
+	pool->done_head = NULL;
+	pool->done_tail = &pool->done_head;
+	pthread_mutex_unlock(&pool->mutex);
+
+	thread_pool_call_done(pool, jobs);
+}
+
+static bool thread_pool_add_thread(struct thread_pool *pool)
+{
+	pthread_attr_t attr;
+	sigset_t set, oldset;
+	int ret;
+
+	if (pthread_attr_init(&attr) != 0)
+		i_fatal_status(FATAL_OUTOFMEM, "pthread_attr_init() failed");
+	(void)pthread_attr_setstacksize(&attr, THREAD_POOL_STACK_SIZE);
+
+	/* signals are handled by the main thread via lib-signals */
+	sigfillset(&set);
+	if (pthread_sigmask(SIG_BLOCK, &set, &oldset) != 0)
+		i_unreached();
+	ret = pthread_create(&pool->threads[pool->thread_count], &attr,
+			     thread_pool_worker, pool);
+	if (pthread_sigmask(SIG_SETMASK, &oldset, NULL) != 0)
+		i_unreached();
+	pthread_attr_destroy(&attr);
+	if (ret != 0) {
+		errno = ret;
+		i_error("pthread_create() failed: %m");
+		/* don't keep retrying with each job */
+		if (pool->thread_count > 0)
+			pool->max_threads = pool->thread_count;
+		return FALSE;
+	}
+	pool->thread_count++;
+	return TRUE;
+}
+
+struct thread_pool *thread_pool_init(unsigned int max_threads)
+{
+	struct thread_pool *pool;
+
+	i_assert(max_threads > 0);
+
+	pool = i_new(struct thread_pool, 1);
+	pool->max_threads = max_threads;
+	pool->threads = i_new(pthread_t, max_threads);
+	pool->queue_tail = &pool->queue_head;
+	pool->done_tail = &pool->done_head;
+	if (pthread_mutex_init(&pool->mutex, NULL) != 0 ||
+	    pthread_cond_init(&pool->cond, NULL) != 0)
+		i_fatal("pthread_mutex/cond_init() failed");
+
+	if (pipe(pool->fd_done) < 0)
+		i_fatal("pipe() failed: %m");
+	fd_set_nonblock(pool->fd_done[0], TRUE);
+	fd_set_nonblock(pool->fd_done[1], TRUE);
+	fd_close_on_exec(pool->fd_done[0], TRUE);
+	fd_close_on_exec(pool->fd_done[1], TRUE);
+	pool->io = io_add(pool->fd_done[0], IO_READ,
+			  thread_pool_handle_done, pool);
+	return pool;
+}
+
+void thread_pool_deinit(struct thread_pool **_pool)
+{
+	struct thread_pool *pool = *_pool;
+	unsigned int i;
+
+	*_pool = NULL;
+
+	/* let the workers finish the queued jobs and exit */
+	pthread_mutex_lock(&pool->mutex);
+	pool->stopping = TRUE;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+	for (i = 0; i < pool->thread_count; i++) {
+		if (pthread_join(pool->threads[i], NULL) != 0)
+			i_unreached();
+	}
+	i_assert(pool->queue_head == NULL);
+
+	thread_pool_call_done(pool, pool->done_head);
+	i_assert(pool->pending_count == 0);
+
+	io_remove(&pool->io);
+	if (close(pool->fd_done[0]) < 0)
+		i_error("close(thread pool pipe) failed: %m");
+	if (close(pool->fd_done[1]) < 0)
+		i_error("close(thread pool pipe) failed: %m");
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+	i_free(pool->threads);
+	i_free(pool);
+}
+
+void thread_pool_add_job(struct thread_pool *pool,
+			 thread_pool_job_callback_t *job_callback,
+			 thread_pool_done_callback_t *done_callback,
+			 void *context)
+{
+	struct thread_pool_job *job;
+	bool need_thread;
+
+	job = i_new(struct thread_pool_job, 1);
+	job->job_callback = job_callback;
+	job->done_callback = done_callback;
+	job->context = context;
+	pool->pending_count++;
+
+	pthread_mutex_lock(&pool->mutex);
+	thread_pool_job_append(&pool->queue_tail, job);
+	pool->queue_count++;
+	/* idle workers that were already signalled may not have woken up
+	   yet, so compare against the whole queue */
+	need_thread = pool->queue_count > pool->idle_count &&
+		pool->thread_count < pool->max_threads;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (need_thread && !thread_pool_add_thread(pool) &&
+	    pool->thread_count == 0) {
+		/* no workers at all - run the job ourself. the done
+		   callback is still called from the ioloop. */
+		pthread_mutex_lock(&pool->mutex);
+		pool->queue_head = job->next;
+		if (pool->queue_head == NULL)
+			pool->queue_tail = &pool->queue_head;
+		pool->queue_count--;
+		pthread_mutex_unlock(&pool->mutex);
+
+		job_callback(context);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (pool->done_head == NULL) {
+			if (write(pool->fd_done[1], "", 1) < 0)
+				i_error("write(thread pool pipe) failed: %m");
+		}
+		thread_pool_job_append(&pool->done_tail, job);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+
+#else
+
+static void thread_pool_timeout(struct thread_pool *pool)
+{
+	struct thread_pool_job *jobs = pool->done_head;
+
+	timeout_remove(&pool->to);
+	pool->done_head = NULL;
+	pool->done_tail = &pool->done_head;
+	thread_pool_call_done(pool, jobs);
+}
+
+struct thread_pool *thread_pool_init(unsigned int max_threads)
+{
+	struct thread_pool *pool;
+
+	i_assert(max_threads > 0);
+
+	pool = i_new(struct thread_pool, 1);
+	pool->max_threads = max_threads;
+	pool->done_tail = &pool->done_head;
+	return pool;
+}
+
+void thread_pool_deinit(struct thread_pool **_pool)
+{
+	struct thread_pool *pool = *_pool;
+
+	*_pool = NULL;
+
+	if (pool->to != NULL)
+		timeout_remove(&pool->to);
+	thread_pool_call_done(pool, pool->done_head);
+	i_assert(pool->pending_count == 0);
+	i_free(pool);
+}
+
+void thread_pool_add_job(struct thread_pool *pool,
+			 thread_pool_job_callback_t *job_callback,
+			 thread_pool_done_callback_t *done_callback,
+			 void *context)
+{
+	struct thread_pool_job *job;
+
+	job = i_new(struct thread_pool_job, 1);
+	job->done_callback = done_callback;
+	job->context = context;
+	pool->pending_count++;
+
+	job_callback(context);
+
+	*pool->done_tail = job;
+	pool->done_tail = &job->next;
+	if (pool->to == NULL)
+		pool->to = timeout_add_short(0, thread_pool_timeout, pool);
+}
+
+#endif
+
+unsigned int thread_pool_get_pending_count(struct thread_pool *pool)
+{
+	return pool->pending_count;
+}
@@ -0,0 +1,43 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/* Thread pool for running blocking operations (fsync(), stat() scans,
+   hashing, compression) without stalling the ioloop. The job callback is
+   run in a worker thread, so it must not use any of the non-thread-safe
+   parts of this library: no data stack, no memory pools, no logging, no
+   ioloop, no istreams/ostreams. It should only do the blocking work and store
+   its results (including errno) into its context. The done callback is then
+   called in the ioloop that was active when the pool was created, where the
+   results can be handled normally.
+
+   If Dovecot is built without thread support, the jobs are run
+   synchronously when they're added, but the done callbacks are still called
+   later from the ioloop. */
+
+typedef void thread_pool_job_callback_t(void *context);
+typedef void thread_pool_done_callback_t(void *context);
+
+/* Create a new thread pool. Worker threads are created lazily up to
+   max_threads when jobs are added while all the existing threads are busy. */
+struct thread_pool *thread_pool_init(unsigned int max_threads);
+/* Wait for all the added jobs to finish, call their done callbacks and free
+   the thread pool. */
+void thread_pool_deinit(struct thread_pool **pool);
+
+/* Add a new job to be run in a worker thread. Jobs are started in the order
+   they were added. */
+void thread_pool_add_job(struct thread_pool *pool,
+			 thread_pool_job_callback_t *job_callback,
+			 thread_pool_done_callback_t *done_callback,
+			 void *context);
+#define thread_pool_add_job(pool, job_callback, done_callback, context) \
+	thread_pool_add_job(((void)( \
+		CALLBACK_TYPECHECK(job_callback, void (*)(typeof(context))) + \
+		CALLBACK_TYPECHECK(done_callback, void (*)(typeof(context)))), \
+		pool), \
+		(thread_pool_job_callback_t *)job_callback, \
+		(thread_pool_done_callback_t *)done_callback, context)
+/* Returns the number of jobs whose done callbacks haven't been called yet. */
+unsigned int thread_pool_get_pending_count(struct thread_pool *pool);
+
+#endif
@@ -0,0 +1,226 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "str.h"
+#include "istream.h"
+#include "ostream.h"
+#include "hostpid.h"
+#include "unlink-directory.h"
+#include "master-service.h"
+#include "mail-storage-service.h"
+#include "lda-settings.h"
+#include "lmtp-settings.h"
+#include "main.h"
+#include "client.h"
+#include "test-bench.h"
+
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#define BENCH_RCPT_COUNT 10
+
+static const char bench_mail[] =
+"From: Sender <sender@example.com>\r\n"
+"To: Recipients <rcpts@example.com>\r\n"
+"Subject: Benchmark message\r\n"
+"Message-ID: <bench@example.com>\r\n"
+"Date: Mon, 1 Aug 2016 12:00:00 +0300\r\n"
+"\r\n"
+"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do\r\n"
+"eiusmod tempor incididunt ut labore et dolore magna aliqua.\r\n";
+
+struct bench_lmtp_ctx {
+	struct client *client;
+	int fd;
+
+	struct istream *input;
+	struct ostream *output;
+	struct io *io;
+	unsigned int replies_left;
+};
+
+const char *dns_client_socket_path, *base_dir;
+struct mail_storage_service_ctx *storage_service;
+struct anvil_client *anvil;
+
+static const char *bench_dir;
+static struct bench_lmtp_ctx bench_ctx;
+
+static void ATTR_FORMAT(2, 0)
+bench_info_handler(const struct failure_context *ctx ATTR_UNUSED,
+		   const char *format ATTR_UNUSED, va_list args ATTR_UNUSED)
+{
+	/* don't mix the delivery logging with the results */
+}
+
+static void bench_lmtp_input(struct bench_lmtp_ctx *ctx)
+{
+	const char *line;
+
+	while ((line = i_stream_read_next_line(ctx->input)) != NULL) {
+		if (strlen(line) > 3 && line[3] == '-')
+			continue;
+		if (line[0] != '2' && line[0] != '3')
+			i_fatal("Unexpected LMTP reply: %s", line);
+		if (--ctx->replies_left == 0) {
+			io_loop_stop(current_ioloop);
+			return;
+		}
+	}
+	if (ctx->input->eof)
+		i_fatal("LMTP client disconnected");
+}
+
+static void
+bench_lmtp_send(struct bench_lmtp_ctx *ctx, const char *cmds,
+		unsigned int reply_count)
+{
+	o_stream_nsend_str(ctx->output, cmds);
+	ctx->replies_left = reply_count;
+	io_loop_run(current_ioloop);
+}
+
+static void bench_lmtp_deliver(struct bench_lmtp_ctx *ctx,
+			       unsigned int iterations)
+{
+	string_t *cmds = t_str_new(1024);
+	unsigned int i, j;
+
+	str_append(cmds, "MAIL FROM:<sender@example.com>\r\n");
+	for (j = 1; j <= BENCH_RCPT_COUNT; j++)
+		str_printfa(cmds, "RCPT TO:<bench%u@example.com>\r\n", j);
+	str_append(cmds, "DATA\r\n");
+	str_append(cmds, bench_mail);
+	str_append(cmds, ".\r\n");
+
+	/* MAIL, RCPTs, DATA and a reply for each recipient */
+	for (i = 0; i < iterations; i++)
+		bench_lmtp_send(ctx, str_c(cmds), 2 + BENCH_RCPT_COUNT*2);
+	test_bench_sink += iterations;
+}
+
+static void bench_lmtp_init(struct bench_lmtp_ctx *ctx)
+{
+	struct master_service_connection conn;
+	int fd[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
+		i_fatal("socketpair() failed: %m");
+
+	memset(ctx, 0, sizeof(*ctx));
+	memset(&conn, 0, sizeof(conn));
+	master_service_client_connection_created(master_service);
+	ctx->client = client_create(fd[0], fd[0], &conn);
+
+	ctx->fd = fd[1];
+	ctx->input = i_stream_create_fd(ctx->fd, (size_t)-1, FALSE);
+	ctx->output = o_stream_create_fd(ctx->fd, (size_t)-1, FALSE);
+	o_stream_set_no_error_handling(ctx->output, TRUE);
+	ctx->io = io_add(ctx->fd, IO_READ, bench_lmtp_input, ctx);
+	/* banner and LHLO */
+	ctx->replies_left = 1;
+	io_loop_run(current_ioloop);
+	bench_lmtp_send(ctx, "LHLO localhost\r\n", 1);
+}
+
+static void bench_lmtp_deinit(struct bench_lmtp_ctx *ctx)
+{
+	client_destroy(ctx->client, NULL, "Benchmark finished");
+	io_remove(&ctx->io);
+	i_stream_destroy(&ctx->input);
+	o_stream_destroy(&ctx->output);
+	i_close_fd(&ctx->fd);
+}
+
+static void bench_lmtp_processes(unsigned int delivery_processes)
+{
+	struct lmtp_settings *lmtp_set;
+
+	/* the settings were read when the client was created */
+	lmtp_set = (struct lmtp_settings *)bench_ctx.client->lmtp_set;
+	lmtp_set->lmtp_delivery_processes = delivery_processes;
+
+	/* the same mail to BENCH_RCPT_COUNT different users, delivered
+	   by the lmtp process itself or by the given number of processes */
+	test_bench(t_strdup_printf("deliver_%u_rcpts_%u_processes",
+				   BENCH_RCPT_COUNT, delivery_processes),
+		   bench_lmtp_deliver, &bench_ctx);
+}
+
+static void bench_lmtp_serial(void)
+{
+	bench_lmtp_processes(1);
+}
+
+static void bench_lmtp_parallel(void)
+{
+	bench_lmtp_processes(4);
+}
+
+static void bench_drop_root(void)
+{
+	struct passwd *pw;
+
+	/* lmtp refuses to deliver mails as root */
+	if (geteuid() != 0)
+		return;
+	if ((pw = getpwnam("nobody")) == NULL)
+		i_fatal("Running as root, but user nobody doesn't exist");
+	if (setgid(pw->pw_gid) < 0)
+		i_fatal("setgid(%s) failed: %m", dec2str(pw->pw_gid));
+	if (setuid(pw->pw_uid) < 0)
+		i_fatal("setuid(%s) failed: %m", dec2str(pw->pw_uid));
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*bench_functions[])(void) = {
+		bench_lmtp_serial,
+		bench_lmtp_parallel,
+		NULL
+	};
+	const struct setting_parser_info *set_roots[] = {
+		&lda_setting_parser_info,
+		&lmtp_setting_parser_info,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("lmtp",
+				MASTER_SERVICE_FLAG_STANDALONE |
+				MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS,
+				&argc, &argv, "");
+	bench_drop_root();
+
+	/* use real files, since the point is to see how well the disk
+	   writes and fsyncs of different users overlap */
+	bench_dir = i_strdup_printf("/tmp/dovecot-bench-lmtp.%s", my_pid);
+	if (mkdir(bench_dir, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", bench_dir);
+	base_dir = bench_dir;
+	(void)master_service_parse_option(master_service, 'o',
+		t_strdup_printf("mail_location=sdbox:%s/%%u", bench_dir));
+	(void)master_service_parse_option(master_service, 'o',
+		"postmaster_address=postmaster@example.com");
+
+	master_service_init_finish(master_service);
+	i_set_info_handler(bench_info_handler);
+	storage_service = mail_storage_service_init(master_service, set_roots,
+				MAIL_STORAGE_SERVICE_FLAG_NO_RESTRICT_ACCESS |
+				MAIL_STORAGE_SERVICE_FLAG_NO_CHDIR |
+				MAIL_STORAGE_SERVICE_FLAG_NO_LOG_INIT |
+				MAIL_STORAGE_SERVICE_FLAG_NO_PLUGINS);
+
+	bench_lmtp_init(&bench_ctx);
+	ret = test_bench_run_initialized(bench_functions);
+	bench_lmtp_deinit(&bench_ctx);
+
+	mail_storage_service_deinit(&storage_service);
+	if (unlink_directory(bench_dir, UNLINK_DIRECTORY_FLAG_RMDIR) < 0)
+		i_error("unlink_directory(%s) failed: %m", bench_dir);
+	master_service_deinit(&master_service);
+	return ret;
+}
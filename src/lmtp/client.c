@@ -368,6 +368,8 @@ void client_state_reset(struct client *client, const char *state_name)
 		mailbox_free(&raw_box);
 	}
 
+	if (client->state.proxy_spool_input != NULL)
+		i_stream_unref(&client->state.proxy_spool_input);
 	if (client->state.mail_data != NULL)
 		buffer_free(&client->state.mail_data);
 	if (client->state.mail_data_output != NULL)
@@ -432,3 +434,16 @@ void clients_destroy(void)
 			"Shutting down");
 	}
 }
+
+void clients_replace_fds(int fd)
+{
+	struct client *client;
+
+	for (client = clients; client != NULL; client = client->next) {
+		if (dup2(fd, client->fd_in) < 0)
+			i_error("dup2(%d) failed: %m", client->fd_in);
+		if (client->fd_out != client->fd_in &&
+		    dup2(fd, client->fd_out) < 0)
+			i_error("dup2(%d) failed: %m", client->fd_out);
+	}
+}
@@ -37,6 +37,15 @@ struct client_state {
 	int mail_data_fd;
 	struct ostream *mail_data_output;
 	const char *added_headers;
+	/* DATA being streamed to proxy destinations, read via this stream
+	   into a seekable spool as it arrives from the client */
+	struct istream *proxy_spool_input;
+
+	/* XHASH=<method> parameter given to MAIL FROM. The hash of the
+	   received DATA is returned along with the successful replies. */
+	const struct hash_method *data_hash_method;
+	void *data_hash_ctx;
+	const char *data_hash;
 
 	struct timeval mail_from_timeval, data_end_timeval;
 
@@ -104,5 +113,8 @@ void client_send_line(struct client *client, const char *fmt, ...)
 bool client_is_trusted(struct client *client);
 
 void clients_destroy(void);
+/* Replace all the client connections' fds with the given fd. Used by forked
+   delivery processes, which must not keep the connections open. */
+void clients_replace_fds(int fd);
 
 #endif
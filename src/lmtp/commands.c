@@ -10,13 +10,20 @@
 #include "istream-concat.h"
 #include "ostream.h"
 #include "istream-dot.h"
+#include "istream-seekable.h"
+#include "hash-method.h"
+#include "hex-binary.h"
 #include "safe-mkstemp.h"
 #include "hex-dec.h"
+#include "hash.h"
+#include "fd-close-on-exec.h"
+#include "fd-set-nonblock.h"
 #include "time-util.h"
 #include "var-expand.h"
 #include "restrict-access.h"
 #include "settings-parser.h"
 #include "anvil-client.h"
+#include "master-interface.h"
 #include "master-service.h"
 #include "master-service-ssl.h"
 #include "iostream-ssl.h"
@@ -34,6 +41,10 @@
 #include "commands.h"
 #include "lmtp-proxy.h"
 
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+
 #define ERRSTR_TEMP_MAILBOX_FAIL "451 4.3.0 <%s> Temporary internal error"
 #define ERRSTR_TEMP_USERDB_FAIL_PREFIX "451 4.3.0 <%s> "
 #define ERRSTR_TEMP_USERDB_FAIL \
@@ -78,8 +89,10 @@ int cmd_lhlo(struct client *client, const char *args)
 	if (master_service_ssl_is_enabled(master_service) &&
 	    client->ssl_iostream == NULL)
 		client_send_line(client, "250-STARTTLS");
-	if (client_is_trusted(client))
+	if (client_is_trusted(client)) {
 		client_send_line(client, "250-XCLIENT ADDR PORT TTL TIMEOUT");
+		client_send_line(client, "250-XHASH");
+	}
 	client_send_line(client, "250-8BITMIME");
 	client_send_line(client, "250-ENHANCEDSTATUSCODES");
 	client_send_line(client, "250 PIPELINING");
@@ -181,6 +194,7 @@ parse_xtext(struct client *client, const char *value)
 
 int cmd_mail(struct client *client, const char *args)
 {
+	const struct hash_method *hash_method;
 	const char *addr, *const *argv;
 
 	if (client->state.mail_from != NULL) {
@@ -200,6 +214,10 @@ int cmd_mail(struct client *client, const char *args)
 			client->state.mail_body_7bit = TRUE;
 		else if (strcasecmp(*argv, "BODY=8BITMIME") == 0)
 			client->state.mail_body_8bitmime = TRUE;
+		else if (strncasecmp(*argv, "XHASH=", 6) == 0 &&
+			 client_is_trusted(client) &&
+			 (hash_method = hash_method_lookup(*argv + 6)) != NULL)
+			client->state.data_hash_method = hash_method;
 		else {
 			client_send_line(client,
 				"501 5.5.4 Unsupported options");
@@ -768,8 +786,9 @@ static bool orcpt_get_valid_rfc822(const char *orcpt, const char **addr_r)
 
 static int
 client_deliver(struct client *client, const struct mail_recipient *rcpt,
-	       struct mail *src_mail, struct mail_deliver_session *session)
+	       struct mail_deliver_session *session)
 {
+	struct mail *src_mail = client->state.raw_mail;
 	struct mail_deliver_context dctx;
 	struct mail_storage *storage;
 	const struct mail_storage_service_input *input;
@@ -842,6 +861,9 @@ client_deliver(struct client *client, const struct mail_recipient *rcpt,
 	dctx.timeout_secs = LDA_SUBMISSION_TIMEOUT_SECS;
 	dctx.session_id = rcpt->session_id;
 	dctx.src_mail = src_mail;
+	/* the message is parsed only once from the raw mail, but the first
+	   saved mail may allow hard linking the files */
+	dctx.copy_src_mail = client->state.first_saved_mail;
 	dctx.src_envelope_sender = client->state.mail_from;
 	dctx.dest_user = client->state.dest_user;
 	dctx.session_time_msecs =
@@ -880,6 +902,10 @@ client_deliver(struct client *client, const struct mail_recipient *rcpt,
 			i_assert(client->state.first_saved_mail == NULL);
 			client->state.first_saved_mail = dctx.dest_mail;
 		}
+		if (client->state.data_hash != NULL) {
+			client_send_line(client, "250-2.0.0 XHASH=%s",
+					 client->state.data_hash);
+		}
 		client_send_line(client, "250 2.0.0 <%s> %s Saved",
 				 rcpt->address, rcpt->session_id);
 		ret = 0;
@@ -911,7 +937,7 @@ client_deliver(struct client *client, const struct mail_recipient *rcpt,
 	return ret;
 }
 
-static bool client_deliver_next(struct client *client, struct mail *src_mail,
+static bool client_deliver_next(struct client *client,
 				struct mail_deliver_session *session)
 {
 	struct mail_recipient *const *rcpts;
@@ -921,7 +947,7 @@ static bool client_deliver_next(struct client *client, struct mail *src_mail,
 	rcpts = array_get(&client->state.rcpt_to, &count);
 	while (client->state.rcpt_idx < count) {
 		ret = client_deliver(client, rcpts[client->state.rcpt_idx],
-				     src_mail, session);
+				     session);
 		client_state_set(client, "DATA", "");
 		i_set_failure_prefix("lmtp(%s): ", my_pid);
 
@@ -1003,33 +1029,50 @@ static int client_open_raw_mail(struct client *client, struct istream *input)
 	return 0;
 }
 
+struct client_deliver_child {
+	struct client_deliver_parallel *ctx;
+	pid_t pid;
+	/* parent's end of the pipe */
+	int fd;
+
+	struct istream *input;
+	struct io *io;
+	/* recipient indexes in the order the child delivers them */
+	ARRAY(unsigned int) rcpt_idxs;
+	unsigned int reply_count;
+	/* continuation lines of a multiline reply */
+	const char *reply_prefix;
+};
+
+struct client_deliver_parallel {
+	struct client *client;
+	struct ioloop *ioloop;
+	struct timeout *to;
+
+	struct client_deliver_child *children;
+	unsigned int children_count, pending_count;
+	/* replies from children, indexed by recipient */
+	const char **replies;
+};
+
 static void
-client_input_data_write_local(struct client *client, struct istream *input)
+client_deliver_all(struct client *client, struct mail_deliver_session *session,
+		   uid_t old_uid)
 {
-	struct mail_deliver_session *session;
-	struct mail *src_mail;
-	uid_t old_uid, first_uid = (uid_t)-1;
-
-	if (client_open_raw_mail(client, input) < 0)
-		return;
+	uid_t first_uid = (uid_t)-1;
 
-	session = mail_deliver_session_init();
-	old_uid = geteuid();
-	src_mail = client->state.raw_mail;
-	while (client_deliver_next(client, src_mail, session)) {
+	while (client_deliver_next(client, session)) {
 		if (client->state.first_saved_mail == NULL ||
-		    client->state.first_saved_mail == src_mail)
+		    first_uid != (uid_t)-1)
 			mail_user_unref(&client->state.dest_user);
 		else {
 			/* use the first saved message to save it elsewhere too.
 			   this might allow hard linking the files. */
 			client->state.dest_user = NULL;
-			src_mail = client->state.first_saved_mail;
 			first_uid = geteuid();
 			i_assert(first_uid != 0);
 		}
 	}
-	mail_deliver_session_deinit(&session);
 
 	if (client->state.first_saved_mail != NULL) {
 		struct mail *mail = client->state.first_saved_mail;
@@ -1050,7 +1093,328 @@ client_input_data_write_local(struct client *client, struct istream *input)
 		mailbox_transaction_rollback(&trans);
 		mailbox_free(&box);
 		mail_user_unref(&user);
+		client->state.first_saved_mail = NULL;
 	}
+}
+
+static bool client_deliver_parallel_wanted(struct client *client)
+{
+	return client->lmtp_set->lmtp_delivery_processes > 1 &&
+		array_count(&client->state.rcpt_to) > 1;
+}
+
+static void
+client_deliver_child_close_fds(struct client_deliver_parallel *ctx,
+			       int keep_fd)
+{
+	unsigned int i, count;
+	int fd, null_fd;
+
+	/* the child only needs the mail and the pipe to the parent. instead
+	   of closing the inherited fds, point them to /dev/null so their
+	   numbers don't get reused while the parent's structures still refer
+	   to them. */
+	null_fd = open("/dev/null", O_RDWR);
+	if (null_fd == -1)
+		i_fatal("open(/dev/null) failed: %m");
+
+	clients_replace_fds(null_fd);
+	if (getenv(MASTER_IS_PARENT_ENV) != NULL) {
+		/* anvil, status and listener fds from master */
+		count = MASTER_LISTEN_FD_FIRST +
+			master_service_get_socket_count(master_service);
+		for (fd = MASTER_ANVIL_FD; fd < (int)count; fd++) {
+			i_assert(fd != keep_fd &&
+				 fd != ctx->client->state.mail_data_fd);
+			if (dup2(null_fd, fd) < 0)
+				i_error("dup2(%d) failed: %m", fd);
+		}
+	}
+	/* pipes to the previously started children */
+	for (i = 0; i < ctx->children_count; i++) {
+		fd = ctx->children[i].fd;
+		if (fd != -1 && dup2(null_fd, fd) < 0)
+			i_error("dup2(%d) failed: %m", fd);
+	}
+	i_close_fd(&null_fd);
+}
+
+static void ATTR_NORETURN
+client_deliver_child_run(struct client_deliver_parallel *ctx,
+			 struct mail_deliver_session *session,
+			 struct client_deliver_child *child, int fd,
+			 uid_t old_uid)
+{
+	struct client *client = ctx->client;
+	struct mail_recipient *const *rcpts =
+		array_idx(&client->state.rcpt_to, 0);
+	struct mail_recipient **child_rcpts;
+	struct ioloop *ioloop;
+	const unsigned int *idxp;
+	unsigned int i, count;
+
+	/* we have forked before delivering to anyone, so the only inherited
+	   state is the process's own. don't touch the parent's ioloop or the
+	   client connection. the replies are written to the parent via the
+	   pipe, one (multiline) reply per recipient. */
+	hostpid_init();
+	i_set_failure_prefix("lmtp(%s): ", my_pid);
+	client_deliver_child_close_fds(ctx, fd);
+	ioloop = io_loop_create();
+	client->output = o_stream_create_fd(fd, (size_t)-1, TRUE);
+	o_stream_set_no_error_handling(client->output, TRUE);
+
+	/* leave only this child's recipients */
+	count = array_count(&child->rcpt_idxs);
+	child_rcpts = t_new(struct mail_recipient *, count);
+	i = 0;
+	array_foreach(&child->rcpt_idxs, idxp)
+		child_rcpts[i++] = rcpts[*idxp];
+	array_clear(&client->state.rcpt_to);
+	array_append(&client->state.rcpt_to, child_rcpts, count);
+	client->state.rcpt_idx = 0;
+
+	/* the output isn't corked, so each reply is written to the parent
+	   as soon as the recipient is handled */
+	client_deliver_all(client, session, old_uid);
+	mail_deliver_session_deinit(&session);
+	o_stream_destroy(&client->output);
+
+	/* deinitialize the storage explicitly, but don't run the parent's
+	   atexit handlers or deinit the master service, which is still
+	   shared with the parent. */
+	client_state_reset(client, "");
+	mail_user_unref(&client->raw_mail_user);
+	mail_storage_service_deinit(&storage_service);
+	io_loop_destroy(&ioloop);
+	_exit(0);
+}
+
+static void client_deliver_child_input(struct client_deliver_child *child)
+{
+	struct client_deliver_parallel *ctx = child->ctx;
+	pool_t pool = ctx->client->state_pool;
+	const unsigned int *idxp;
+	const char *line;
+
+	while ((line = i_stream_read_next_line(child->input)) != NULL) {
+		if (strlen(line) > 3 && line[3] == '-') {
+			child->reply_prefix = child->reply_prefix == NULL ?
+				p_strdup(pool, line) :
+				p_strconcat(pool, child->reply_prefix,
+					    "\r\n", line, NULL);
+			continue;
+		}
+		if (child->reply_prefix != NULL) {
+			line = t_strconcat(child->reply_prefix, "\r\n",
+					   line, NULL);
+			child->reply_prefix = NULL;
+		}
+		if (child->reply_count == array_count(&child->rcpt_idxs)) {
+			i_error("Delivery process %s sent unexpected reply: %s",
+				dec2str(child->pid), line);
+			continue;
+		}
+		idxp = array_idx(&child->rcpt_idxs, child->reply_count++);
+		ctx->replies[*idxp] = p_strdup(pool, line);
+	}
+	if (child->input->eof || child->input->stream_errno != 0) {
+		io_remove(&child->io);
+		if (--ctx->pending_count == 0)
+			io_loop_stop(ctx->ioloop);
+	}
+}
+
+static void
+client_deliver_child_kill(struct client_deliver_parallel *ctx,
+			  struct client_deliver_child *child)
+{
+	int status;
+
+	i_error("Delivery process %s timed out after %u secs "
+		"(%u/%u recipients delivered), killing it",
+		dec2str(child->pid),
+		ctx->client->lmtp_set->lmtp_delivery_process_timeout,
+		child->reply_count, array_count(&child->rcpt_idxs));
+	if (kill(child->pid, SIGKILL) < 0)
+		i_error("kill(%s) failed: %m", dec2str(child->pid));
+	else if (waitpid(child->pid, &status, 0) < 0)
+		i_error("waitpid() failed: %m");
+	else {
+		/* the process is gone now. read the replies it managed to
+		   write, so the recipients that were already delivered don't
+		   get a temporary failure and the mail delivered again. */
+		child->pid = 0;
+		while (child->io != NULL)
+			client_deliver_child_input(child);
+		return;
+	}
+	io_remove(&child->io);
+	ctx->pending_count--;
+}
+
+static void client_deliver_parallel_timeout(struct client_deliver_parallel *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->children_count; i++) {
+		if (ctx->children[i].io != NULL)
+			client_deliver_child_kill(ctx, &ctx->children[i]);
+	}
+	i_assert(ctx->pending_count == 0);
+	io_loop_stop(ctx->ioloop);
+}
+
+static int
+client_deliver_child_start(struct client_deliver_parallel *ctx,
+			   struct mail_deliver_session *session,
+			   struct client_deliver_child *child, uid_t old_uid)
+{
+	int fd[2];
+
+	if (pipe(fd) < 0) {
+		i_error("pipe() failed: %m");
+		return -1;
+	}
+	child->pid = fork();
+	if (child->pid == (pid_t)-1) {
+		i_error("fork() failed: %m");
+		i_close_fd(&fd[0]);
+		i_close_fd(&fd[1]);
+		return -1;
+	}
+	if (child->pid == 0) {
+		i_close_fd(&fd[0]);
+		client_deliver_child_run(ctx, session, child, fd[1], old_uid);
+	}
+	i_close_fd(&fd[1]);
+	fd_close_on_exec(fd[0], TRUE);
+	fd_set_nonblock(fd[0], TRUE);
+	child->fd = fd[0];
+	return 0;
+}
+
+static void
+client_deliver_parallel(struct client *client,
+			struct mail_deliver_session *session, uid_t old_uid)
+{
+	struct client_deliver_parallel ctx;
+	struct client_deliver_child *child;
+	struct mail_recipient *const *rcpts;
+	const struct mail_storage_service_input *input;
+	unsigned int i, count, timeout_secs;
+	int status;
+
+	rcpts = array_get(&client->state.rcpt_to, &count);
+	i_assert(client->state.rcpt_idx == 0);
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.client = client;
+	ctx.children_count = I_MIN(client->lmtp_set->lmtp_delivery_processes,
+				   count);
+	ctx.children = i_new(struct client_deliver_child, ctx.children_count);
+	ctx.replies = i_new(const char *, count);
+
+	/* the same user is always delivered by the same process, so that
+	   duplicate GUID detection within the session keeps working. */
+	for (i = 0; i < ctx.children_count; i++) {
+		ctx.children[i].ctx = &ctx;
+		ctx.children[i].fd = -1;
+		i_array_init(&ctx.children[i].rcpt_idxs, 16);
+	}
+	for (i = 0; i < count; i++) {
+		input = mail_storage_service_user_get_input(rcpts[i]->service_user);
+		child = &ctx.children[str_hash(input->username) %
+				      ctx.children_count];
+		array_append(&child->rcpt_idxs, &i, 1);
+	}
+
+	for (i = 0; i < ctx.children_count; i++) {
+		child = &ctx.children[i];
+		if (array_count(&child->rcpt_idxs) > 0) {
+			(void)client_deliver_child_start(&ctx, session, child,
+							 old_uid);
+		}
+	}
+
+	/* create the ioloop only after all the processes are forked, so they
+	   don't inherit it or each others' pipes' ios */
+	ctx.ioloop = io_loop_create();
+	for (i = 0; i < ctx.children_count; i++) {
+		child = &ctx.children[i];
+		if (child->fd == -1)
+			continue;
+		child->input = i_stream_create_fd(child->fd, (size_t)-1, TRUE);
+		child->io = io_add(child->fd, IO_READ,
+				   client_deliver_child_input, child);
+		ctx.pending_count++;
+	}
+	if (ctx.pending_count > 0) {
+		timeout_secs = client->lmtp_set->lmtp_delivery_process_timeout;
+		if (timeout_secs > 0) {
+			ctx.to = timeout_add(timeout_secs * 1000,
+					     client_deliver_parallel_timeout,
+					     &ctx);
+		}
+		io_loop_run(ctx.ioloop);
+		if (ctx.to != NULL)
+			timeout_remove(&ctx.to);
+	}
+	io_loop_destroy(&ctx.ioloop);
+
+	for (i = 0; i < ctx.children_count; i++) {
+		child = &ctx.children[i];
+		if (child->input != NULL)
+			i_stream_destroy(&child->input);
+		if (child->pid > 0) {
+			if (waitpid(child->pid, &status, 0) < 0)
+				i_error("waitpid() failed: %m");
+			else if (WIFSIGNALED(status)) {
+				i_error("Delivery process %s died with signal %d",
+					dec2str(child->pid), WTERMSIG(status));
+			} else if (!WIFEXITED(status) ||
+				   WEXITSTATUS(status) != 0) {
+				i_error("Delivery process %s exited with status %d",
+					dec2str(child->pid), status);
+			}
+		}
+		array_free(&child->rcpt_idxs);
+	}
+
+	/* send the replies in RCPT order. if a process died before
+	   replying, we don't know if the mail was saved or not. */
+	for (i = 0; i < count; i++) {
+		if (ctx.replies[i] != NULL)
+			client_send_line(client, "%s", ctx.replies[i]);
+		else {
+			client_send_line(client, ERRSTR_TEMP_MAILBOX_FAIL,
+					 rcpts[i]->address);
+		}
+	}
+	client->state.rcpt_idx = count;
+	i_free(ctx.replies);
+	i_free(ctx.children);
+}
+
+static void
+client_input_data_write_local(struct client *client, struct istream *input)
+{
+	struct mail_deliver_session *session;
+	uid_t old_uid;
+
+	if (client_open_raw_mail(client, input) < 0)
+		return;
+
+	session = mail_deliver_session_init();
+	old_uid = geteuid();
+	/* fork the delivery processes before any of the recipients' users
+	   are initialized, so they don't inherit any per-user state. each
+	   process still links the mails it saves between its own users. */
+	if (client_deliver_parallel_wanted(client))
+		client_deliver_parallel(client, session, old_uid);
+	else
+		client_deliver_all(client, session, old_uid);
+	mail_deliver_session_deinit(&session);
 
 	if (old_uid == 0) {
 		/* switch back to running as root, since that's what we're
@@ -1149,6 +1513,15 @@ static void client_input_data_write(struct client *client)
 
 	client->state.data_end_timeval = ioloop_timeval;
 
+	if (client->state.data_hash_method != NULL) {
+		const struct hash_method *method = client->state.data_hash_method;
+		unsigned char *digest = t_malloc(method->digest_size);
+
+		method->result(client->state.data_hash_ctx, digest);
+		client->state.data_hash = p_strdup(client->state_pool,
+			binary_to_hex(digest, method->digest_size));
+	}
+
 	input = client_get_input(client);
 	if (array_count(&client->state.rcpt_to) != 0)
 		client_input_data_write_local(client, input);
@@ -1181,19 +1554,12 @@ static int client_input_add_file(struct client *client,
 	/* move everything to a temporary file. */
 	path = t_str_new(256);
 	mail_user_set_get_temp_prefix(path, client->raw_mail_user->set);
-	fd = safe_mkstemp_hostpid(path, 0600, (uid_t)-1, (gid_t)-1);
+	fd = safe_mkstemp_anon(path, 0600);
 	if (fd == -1) {
 		i_error("Temp file creation to %s failed: %m", str_c(path));
 		return -1;
 	}
 
-	/* we just want the fd, unlink it */
-	if (i_unlink(str_c(path)) < 0) {
-		/* shouldn't happen.. */
-		i_close_fd(&fd);
-		return -1;
-	}
-
 	state->mail_data_fd = fd;
 	state->mail_data_output = o_stream_create_fd_file(fd, 0, FALSE);
 	o_stream_cork(state->mail_data_output);
@@ -1229,6 +1595,10 @@ static void client_input_data_handle(struct client *client)
 
 	while ((ret = i_stream_read(client->dot_input)) > 0 || ret == -2) {
 		data = i_stream_get_data(client->dot_input, &size);
+		if (client->state.data_hash_method != NULL) {
+			client->state.data_hash_method->
+				loop(client->state.data_hash_ctx, data, size);
+		}
 		if (client_input_add(client, data, size) < 0) {
 			client_destroy(client, "451 4.3.0",
 				       "Temporary internal failure");
@@ -1259,6 +1629,79 @@ static void client_input_data(struct client *client)
 	client_input_data_handle(client);
 }
 
+static void client_input_data_proxy_stream(struct client *client)
+{
+	struct istream *input = client->state.proxy_spool_input;
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	if (client_input_read(client) < 0)
+		return;
+
+	/* read everything the client has sent so far into the spool. the
+	   proxy connections read it from there at their own pace. */
+	while ((ret = i_stream_read_data(input, &data, &size, 0)) > 0)
+		i_stream_skip(input, size);
+	if (ret == 0) {
+		lmtp_proxy_data_more(client->proxy, FALSE);
+		return;
+	}
+	if (input->stream_errno == EPIPE) {
+		/* client probably disconnected */
+		client_destroy(client, NULL, NULL);
+		return;
+	}
+	if (input->stream_errno != 0) {
+		i_error("read(%s) failed: %s", i_stream_get_name(input),
+			i_stream_get_error(input));
+		client_destroy(client, "451 4.3.0",
+			       "Temporary internal failure");
+		return;
+	}
+
+	/* the whole DATA is received. stop handling client input until
+	   proxying is finished. */
+	if (client->to_idle != NULL)
+		timeout_remove(&client->to_idle);
+	io_remove(&client->io);
+	client->state.data_end_timeval = ioloop_timeval;
+	lmtp_proxy_data_more(client->proxy, TRUE);
+}
+
+static void client_input_data_proxy_start(struct client *client)
+{
+	struct istream *input, *inputs[3];
+	string_t *path;
+
+	/* there are no local recipients, so there's no need to wait for the
+	   whole DATA before starting to send it. the seekable stream spools
+	   it to memory or a temp file, so each destination can be read at
+	   its own pace. */
+	path = t_str_new(256);
+	mail_user_set_get_temp_prefix(path, client->raw_mail_user->set);
+	inputs[0] = i_stream_create_from_data(client->state.added_headers,
+					      strlen(client->state.added_headers));
+	inputs[1] = i_stream_create_dot(client->input, TRUE);
+	inputs[2] = NULL;
+	input = i_stream_create_seekable_path(inputs,
+		CLIENT_MAIL_DATA_MAX_INMEMORY_SIZE, str_c(path));
+	i_stream_unref(&inputs[0]);
+	i_stream_unref(&inputs[1]);
+	i_stream_set_name(input, "<lmtp DATA>");
+	client->state.proxy_spool_input =
+		i_stream_create_limit(input, (uoff_t)-1);
+
+	client_state_set(client, "DATA", "proxying");
+	lmtp_proxy_start_streaming(client->proxy, input,
+				   client_proxy_finish, client);
+	i_stream_unref(&input);
+
+	client->io = io_add(client->fd_in, IO_READ,
+			    client_input_data_proxy_stream, client);
+	client_input_data_proxy_stream(client);
+}
+
 int cmd_data(struct client *client, const char *args ATTR_UNUSED)
 {
 	if (client->state.mail_from == NULL) {
@@ -1273,16 +1716,28 @@ int cmd_data(struct client *client, const char *args ATTR_UNUSED)
 	client->state.added_headers =
 		p_strdup(client->state_pool, client_get_added_headers(client));
 
+	client_send_line(client, "354 OK");
+	/* send the DATA reply immediately before we start handling any data */
+	o_stream_uncork(client->output);
+	io_remove(&client->io);
+
+	if (array_count(&client->state.rcpt_to) == 0) {
+		client_input_data_proxy_start(client);
+		return -1;
+	}
+
+	if (client->state.data_hash_method != NULL) {
+		client->state.data_hash_ctx = p_malloc(client->state_pool,
+			client->state.data_hash_method->context_size);
+		client->state.data_hash_method->init(client->state.data_hash_ctx);
+	}
+
 	i_assert(client->state.mail_data == NULL);
 	client->state.mail_data = buffer_create_dynamic(default_pool, 1024*64);
 
 	i_assert(client->dot_input == NULL);
 	client->dot_input = i_stream_create_dot(client->input, TRUE);
-	client_send_line(client, "354 OK");
-	/* send the DATA reply immediately before we start handling any data */
-	o_stream_uncork(client->output);
 
-	io_remove(&client->io);
 	client_state_set(client, "DATA", "");
 	client->io = io_add(client->fd_in, IO_READ, client_input_data, client);
 	client_input_data_handle(client);
@@ -12,6 +12,9 @@
 #include "lmtp-proxy.h"
 
 #define LMTP_MAX_LINE_LEN 1024
+/* Ask backends that support it to return this hash of the DATA they
+   received, so corruption between us and them gets noticed. */
+#define LMTP_PROXY_DATA_HASH_METHOD "sha1"
 
 struct lmtp_proxy_recipient {
 	struct lmtp_proxy_connection *conn;
@@ -54,6 +57,8 @@ struct lmtp_proxy {
 	void *finish_context;
 
 	unsigned int finished:1;
+	/* data_input is still being filled by the client */
+	unsigned int data_input_streaming:1;
 };
 
 static void lmtp_conn_finish(void *context);
@@ -143,6 +148,7 @@ lmtp_proxy_get_connection(struct lmtp_proxy *proxy,
 	client_set.source_port = proxy->set.source_port;
 	client_set.proxy_ttl = proxy->set.proxy_ttl;
 	client_set.proxy_timeout_secs = set->timeout_msecs/1000;
+	client_set.data_hash_method = LMTP_PROXY_DATA_HASH_METHOD;
 
 	conn = p_new(proxy->pool, struct lmtp_proxy_connection, 1);
 	conn->proxy = proxy;
@@ -195,6 +201,11 @@ static void lmtp_proxy_try_finish(struct lmtp_proxy *proxy)
 		/* DATA command hasn't been sent yet */
 		return;
 	}
+	if (proxy->data_input_streaming) {
+		/* client is still sending DATA. the replies can't be sent
+		   before it's finished. */
+		return;
+	}
 	if (!lmtp_proxy_send_data_replies(proxy)) {
 		/* we can't received reply from all clients yet */
 		return;
@@ -318,11 +329,24 @@ static void lmtp_proxy_conn_timeout(struct lmtp_proxy_connection *conn)
 	lmtp_client_fail(conn->client, line);
 }
 
-void lmtp_proxy_start(struct lmtp_proxy *proxy, struct istream *data_input,
+static void lmtp_proxy_conn_data_output(void *context)
+{
+	struct lmtp_proxy_connection *conn = context;
+
+	/* while streaming, the DATA input arrives at the client's pace.
+	   don't count that against the backend as long as it's progressing. */
+	if (conn->to != NULL)
+		timeout_reset(conn->to);
+}
+
+static void
+lmtp_proxy_start_full(struct lmtp_proxy *proxy, struct istream *data_input,
+		      bool streaming,
 		      lmtp_proxy_finish_callback_t *callback, void *context)
 {
 	struct lmtp_proxy_connection *const *conns;
 	uoff_t size;
+	int ret;
 
 	i_assert(data_input->seekable);
 	i_assert(proxy->data_input == NULL);
@@ -330,10 +354,15 @@ void lmtp_proxy_start(struct lmtp_proxy *proxy, struct istream *data_input,
 	proxy->finish_callback = callback;
 	proxy->finish_context = context;
 	proxy->data_input = data_input;
+	proxy->data_input_streaming = streaming;
 	i_stream_ref(proxy->data_input);
-	if (i_stream_get_size(proxy->data_input, TRUE, &size) < 0) {
-		i_error("i_stream_get_size(data_input) failed: %s",
-			i_stream_get_error(proxy->data_input));
+	if (streaming)
+		size = (uoff_t)-1;
+	else if ((ret = i_stream_get_size(proxy->data_input, TRUE, &size)) <= 0) {
+		if (ret < 0) {
+			i_error("i_stream_get_size(data_input) failed: %s",
+				i_stream_get_error(proxy->data_input));
+		}
 		size = (uoff_t)-1;
 	}
 
@@ -348,6 +377,10 @@ void lmtp_proxy_start(struct lmtp_proxy *proxy, struct istream *data_input,
 
 		conn->to = timeout_add(proxy->max_timeout_msecs,
 				       lmtp_proxy_conn_timeout, conn);
+		if (streaming) {
+			lmtp_client_set_data_output_callback(conn->client,
+				lmtp_proxy_conn_data_output, conn);
+		}
 		if (size == (uoff_t)-1)
 			conn->data_input = i_stream_create_limit(data_input, (uoff_t)-1);
 		else
@@ -367,3 +400,35 @@ void lmtp_proxy_start(struct lmtp_proxy *proxy, struct istream *data_input,
 	/* finish if all of the connections have already failed */
 	lmtp_proxy_try_finish(proxy);
 }
+
+void lmtp_proxy_start(struct lmtp_proxy *proxy, struct istream *data_input,
+		      lmtp_proxy_finish_callback_t *callback, void *context)
+{
+	lmtp_proxy_start_full(proxy, data_input, FALSE, callback, context);
+}
+
+void lmtp_proxy_start_streaming(struct lmtp_proxy *proxy,
+				struct istream *data_input,
+				lmtp_proxy_finish_callback_t *callback,
+				void *context)
+{
+	lmtp_proxy_start_full(proxy, data_input, TRUE, callback, context);
+}
+
+void lmtp_proxy_data_more(struct lmtp_proxy *proxy, bool eof)
+{
+	struct lmtp_proxy_connection *const *conns;
+
+	i_assert(proxy->data_input_streaming);
+
+	array_foreach(&proxy->connections, conns) {
+		struct lmtp_proxy_connection *conn = *conns;
+
+		if (conn->data_input != NULL)
+			lmtp_client_send_more(conn->client);
+	}
+	if (eof) {
+		proxy->data_input_streaming = FALSE;
+		lmtp_proxy_try_finish(proxy);
+	}
+}
@@ -42,5 +42,14 @@ int lmtp_proxy_add_rcpt(struct lmtp_proxy *proxy, const char *address,
 void lmtp_proxy_start(struct lmtp_proxy *proxy, struct istream *data_input,
 		      lmtp_proxy_finish_callback_t *callback, void *context)
 	ATTR_NULL(3);
+/* Start proxying while data_input is still being received from the client.
+   The data is forwarded to the backends as soon as it can be read.
+   lmtp_proxy_data_more() must be called whenever more of data_input may
+   have become readable, with eof=TRUE once all of it has been received. */
+void lmtp_proxy_start_streaming(struct lmtp_proxy *proxy,
+				struct istream *data_input,
+				lmtp_proxy_finish_callback_t *callback,
+				void *context) ATTR_NULL(3);
+void lmtp_proxy_data_more(struct lmtp_proxy *proxy, bool eof);
 
 #endif
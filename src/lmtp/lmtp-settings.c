@@ -63,6 +63,8 @@ static const struct setting_define lmtp_setting_defines[] = {
 	DEF(SET_BOOL, lmtp_save_to_detail_mailbox),
 	DEF(SET_BOOL, lmtp_rcpt_check_quota),
 	DEF(SET_UINT, lmtp_user_concurrency_limit),
+	DEF(SET_UINT, lmtp_delivery_processes),
+	DEF(SET_TIME, lmtp_delivery_process_timeout),
 	DEF(SET_STR, lmtp_address_translate),
 	DEF(SET_ENUM, lmtp_hdr_delivery_address),
 	DEF(SET_STR_VARS, login_greeting),
@@ -76,6 +78,8 @@ static const struct lmtp_settings lmtp_default_settings = {
 	.lmtp_save_to_detail_mailbox = FALSE,
 	.lmtp_rcpt_check_quota = FALSE,
 	.lmtp_user_concurrency_limit = 0,
+	.lmtp_delivery_processes = 1,
+	.lmtp_delivery_process_timeout = 5*60,
 	.lmtp_address_translate = "",
 	.lmtp_hdr_delivery_address = "final:none:original",
 	.login_greeting = PACKAGE_NAME" ready.",
@@ -121,6 +125,12 @@ static bool lmtp_settings_check(void *_set, pool_t pool ATTR_UNUSED,
 					   set->lmtp_hdr_delivery_address);
 		return FALSE;
 	}
+	if (set->lmtp_delivery_processes > LMTP_DELIVERY_PROCESSES_MAX) {
+		*error_r = t_strdup_printf(
+			"lmtp_delivery_processes must not be higher than %u",
+			LMTP_DELIVERY_PROCESSES_MAX);
+		return FALSE;
+	}
 	return TRUE;
 }
 /* </settings checks> */
@@ -5,6 +5,8 @@ struct lda_settings;
 struct lmtp_settings;
 
 /* <settings checks> */
+#define LMTP_DELIVERY_PROCESSES_MAX 16
+
 enum lmtp_hdr_delivery_address {
 	LMTP_HDR_DELIVERY_ADDRESS_NONE,
 	LMTP_HDR_DELIVERY_ADDRESS_FINAL,
@@ -17,6 +19,8 @@ struct lmtp_settings {
 	bool lmtp_save_to_detail_mailbox;
 	bool lmtp_rcpt_check_quota;
 	unsigned int lmtp_user_concurrency_limit;
+	unsigned int lmtp_delivery_processes;
+	unsigned int lmtp_delivery_process_timeout;
 	const char *lmtp_address_translate;
 	const char *lmtp_hdr_delivery_address;
 	const char *login_greeting;
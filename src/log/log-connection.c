@@ -53,6 +53,8 @@ static struct log_connection *log_connections = NULL;
 static ARRAY(struct log_connection *) logs_by_fd;
 static unsigned int global_pending_count;
 static struct log_connection *last_pending_log;
+static time_t log_tm_secs = (time_t)-1;
+static struct tm log_tm;
 
 static void log_connection_destroy(struct log_connection *log);
 
@@ -123,6 +125,7 @@ client_log_ctx(struct log_connection *log,
 	       const struct timeval *log_time,
 	       const char *prefix, const char *text)
 {
+	struct failure_context log_ctx;
 	struct log_error err;
 
 	switch (ctx->type) {
@@ -143,9 +146,9 @@ client_log_ctx(struct log_connection *log,
 		log_error_buffer_add(log->errorbuf, &err);
 		break;
 	}
-	i_set_failure_prefix("%s", prefix);
-	i_log_type(ctx, "%s", text);
-	i_set_failure_prefix("log: ");
+	log_ctx = *ctx;
+	log_ctx.log_prefix = prefix;
+	i_log_type(&log_ctx, "%s", text);
 }
 
 static void
@@ -328,7 +331,6 @@ static void log_connection_input(struct log_connection *log)
 	const char *line;
 	ssize_t ret;
 	struct timeval now, start_timeval;
-	struct tm tm;
 	bool too_much = FALSE;
 
 	if (!log->handshaked) {
@@ -340,19 +342,26 @@ static void log_connection_input(struct log_connection *log)
 
 	io_loop_time_refresh();
 	start_timeval = ioloop_timeval;
+	/* write all the lines read here to the log files at once */
+	i_set_failure_buffering(TRUE);
 	while ((ret = i_stream_read(log->input)) > 0 || ret == -2) {
-		/* get new timestamps for every read() */
+		/* get new timestamps for every read(). localtime() is
+		   needed only when the second changes. */
 		now = ioloop_timeval;
-		tm = *localtime(&now.tv_sec);
+		if (now.tv_sec != log_tm_secs) {
+			log_tm = *localtime(&now.tv_sec);
+			log_tm_secs = now.tv_sec;
+		}
 
 		while ((line = i_stream_next_line(log->input)) != NULL)
-			log_it(log, line, &now, &tm);
+			log_it(log, line, &now, &log_tm);
 		io_loop_time_refresh();
 		if (timeval_diff_msecs(&ioloop_timeval, &start_timeval) > MAX_MSECS_PER_CONNECTION) {
 			too_much = TRUE;
 			break;
 		}
 	}
+	i_set_failure_buffering(FALSE);
 
 	if (log->input->eof) {
 		if (log->input->stream_errno != 0)
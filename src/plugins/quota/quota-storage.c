@@ -7,7 +7,7 @@
 #include "mail-storage-private.h"
 #include "mailbox-list-private.h"
 #include "maildir-storage.h"
-#include "index-mailbox-size.h"
+#include "index-storage.h"
 #include "quota-private.h"
 #include "quota-plugin.h"
 
@@ -313,29 +313,15 @@ static void quota_mailbox_sync_commit(struct quota_mailbox *qbox)
 	qbox->recalculate = FALSE;
 }
 
-static void quota_mailbox_sync_notify(struct mailbox *box, uint32_t uid,
-				      enum mailbox_sync_type sync_type)
+static void quota_mailbox_sync_expunge(struct mailbox *box, uint32_t uid)
 {
 	struct quota_mailbox *qbox = QUOTA_CONTEXT(box);
-	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
 	struct quota_user *quser = QUOTA_USER_CONTEXT(box->storage->user);
 	const uint32_t *uids;
 	const uoff_t *sizep;
 	unsigned int i, count;
 	uoff_t size;
 
-	if (qbox->module_ctx.super.sync_notify != NULL)
-		qbox->module_ctx.super.sync_notify(box, uid, sync_type);
-
-	if (sync_type != MAILBOX_SYNC_TYPE_EXPUNGE || qbox->recalculate) {
-		if (uid == 0) {
-			/* free the transaction before view syncing begins,
-			   otherwise it'll crash. */
-			quota_mailbox_sync_cleanup(qbox);
-		}
-		return;
-	}
-
 	/* we're in the middle of syncing the mailbox, so it's a bad idea to
 	   try and get the message sizes at this point. Rely on sizes that
 	   we saved earlier, or recalculate the whole quota if we don't know
@@ -360,25 +346,21 @@ static void quota_mailbox_sync_notify(struct mailbox *box, uint32_t uid,
 		/* we already know the size */
 		sizep = array_idx(&qbox->expunge_sizes, i);
 		quota_free_bytes(qbox->expunge_qt, *sizep);
-		/* FIXME: it's not ideal that we do the vsize update here, but
-		   this is the easiest place for it for now.. maybe the mail
-		   size checking code could be moved to lib-storage */
-		if (ibox->vsize_update != NULL && quser->quota->set->vsizes)
-			index_mailbox_vsize_hdr_expunge(ibox->vsize_update, uid, *sizep);
+		if (quser->quota->set->vsizes) {
+			/* let the vsize header use it also */
+			index_storage_sync_notify_expunge_vsize(box, uid,
+								*sizep);
+		}
 		return;
 	}
 
 	/* try to look up the size. this works only if it's cached. */
 	if (qbox->expunge_qt->tmp_mail == NULL) {
-		/* FIXME: ugly kludge to open the transaction for sync_view.
-		   box->view may not have all the new messages that
+		/* box->view may not have all the new messages that
 		   sync_notify() notifies about, and those messages would
 		   cause a quota recalculation. */
-		struct mail_index_view *box_view = box->view;
-		if (box->tmp_sync_view != NULL)
-			box->view = box->tmp_sync_view;
-		qbox->expunge_trans = mailbox_transaction_begin(box, 0);
-		box->view = box_view;
+		qbox->expunge_trans = mailbox_transaction_begin(box,
+					MAILBOX_TRANSACTION_FLAG_SYNC_VIEW);
 		qbox->expunge_qt->tmp_mail =
 			mail_alloc(qbox->expunge_trans,
 				   MAIL_FETCH_PHYSICAL_SIZE, NULL);
@@ -392,8 +374,7 @@ static void quota_mailbox_sync_notify(struct mailbox *box, uint32_t uid,
 		}
 	} else if (mail_get_virtual_size(qbox->expunge_qt->tmp_mail, &size) == 0) {
 		quota_free_bytes(qbox->expunge_qt, size);
-		if (ibox->vsize_update != NULL)
-			index_mailbox_vsize_hdr_expunge(ibox->vsize_update, uid, size);
+		index_storage_sync_notify_expunge_vsize(box, uid, size);
 	} else {
 		/* there's no way to get the size. recalculate the quota. */
 		quota_recalculate(qbox->expunge_qt);
@@ -401,6 +382,29 @@ static void quota_mailbox_sync_notify(struct mailbox *box, uint32_t uid,
 	}
 }
 
+static void quota_mailbox_sync_notify(struct mailbox *box, uint32_t uid,
+				      enum mailbox_sync_type sync_type)
+{
+	struct quota_mailbox *qbox = QUOTA_CONTEXT(box);
+
+	if (sync_type != MAILBOX_SYNC_TYPE_EXPUNGE || qbox->recalculate) {
+		if (qbox->module_ctx.super.sync_notify != NULL)
+			qbox->module_ctx.super.sync_notify(box, uid, sync_type);
+		if (uid == 0) {
+			/* free the transaction before view syncing begins,
+			   otherwise it'll crash. */
+			quota_mailbox_sync_cleanup(qbox);
+		}
+		return;
+	}
+
+	/* look up the size first, so the vsize header update done by the
+	   storage doesn't need to look it up again */
+	quota_mailbox_sync_expunge(box, uid);
+	if (qbox->module_ctx.super.sync_notify != NULL)
+		qbox->module_ctx.super.sync_notify(box, uid, sync_type);
+}
+
 static int quota_mailbox_sync_deinit(struct mailbox_sync_context *ctx,
 				     struct mailbox_sync_status *status_r)
 {
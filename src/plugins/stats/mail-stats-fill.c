@@ -108,8 +108,9 @@ user_trans_stats_get(struct stats_user *suser, struct mail_stats *dest_r)
 		mail_stats_add_transaction(dest_r, &strans->trans->stats);
 }
 
-void mail_stats_fill(struct stats_user *suser, struct mail_stats *stats_r)
+void mail_stats_fill(struct mail_user *user, struct mail_stats *stats_r)
 {
+	struct stats_user *suser = STATS_USER_CONTEXT(user);
 	struct rusage usage;
 
 	memset(stats_r, 0, sizeof(*stats_r));
@@ -127,4 +128,5 @@ void mail_stats_fill(struct stats_user *suser, struct mail_stats *stats_r)
 	(void)gettimeofday(&stats_r->clock_time, NULL);
 	process_read_io_stats(stats_r);
 	user_trans_stats_get(suser, stats_r);
+	stats_r->mailbox_opens_avoided = user->mailbox_opens_avoided;
 }
@@ -31,7 +31,8 @@ static struct stats_parser_field mail_stats_fields[] = {
 	EN("mail_lookup_attr", trans_lookup_attr),
 	EN("mail_read_count", trans_files_read_count),
 	EN("mail_read_bytes", trans_files_read_bytes),
-	EN("mail_cache_hits", trans_cache_hit_count)
+	EN("mail_cache_hits", trans_cache_hit_count),
+	EN("mailbox_opens_avoided", mailbox_opens_avoided)
 };
 
 static size_t mail_stats_alloc_size(void)
@@ -86,7 +87,8 @@ mail_stats_have_changed(const struct stats *_prev, const struct stats *_cur)
 	    cur->trans_lookup_attr != prev->trans_lookup_attr ||
 	    cur->trans_files_read_count != prev->trans_files_read_count ||
 	    cur->trans_files_read_bytes != prev->trans_files_read_bytes ||
-	    cur->trans_cache_hit_count != prev->trans_cache_hit_count)
+	    cur->trans_cache_hit_count != prev->trans_cache_hit_count ||
+	    cur->mailbox_opens_avoided != prev->mailbox_opens_avoided)
 		return TRUE;
 
 	/* allow a tiny bit of changes that are caused by this
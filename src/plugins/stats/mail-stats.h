@@ -27,11 +27,14 @@ struct mail_stats {
 	uint32_t trans_files_read_count;
 	uint64_t trans_files_read_bytes;
 	uint64_t trans_cache_hit_count;
+
+	/* mailboxes whose STATUS came from the mailbox list index */
+	uint32_t mailbox_opens_avoided;
 };
 
 extern const struct stats_vfuncs mail_stats_vfuncs;
 
-void mail_stats_fill(struct stats_user *suser, struct mail_stats *mail_stats);
+void mail_stats_fill(struct mail_user *user, struct mail_stats *mail_stats);
 void mail_stats_add_transaction(struct mail_stats *stats,
 				const struct mailbox_transaction_stats *trans_stats);
 
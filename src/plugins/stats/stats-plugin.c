@@ -308,7 +308,7 @@ static void stats_user_stats_fill(struct mail_user *user, struct stats *stats)
 	struct mail_stats *mail_stats;
 
 	mail_stats = stats_fill_ptr(stats, mail_stats_item);
-	mail_stats_fill(suser, mail_stats);
+	mail_stats_fill(user, mail_stats);
 
 	suser->module_ctx.super.stats_fill(user, stats);
 }
@@ -24,8 +24,12 @@ struct trash_mailbox {
 	int priority; /* lower number = higher priority */
 
 	struct mail_namespace *ns;
+	/* another trash mailbox has the same priority, so the mails need to
+	   be ordered by their received dates */
+	bool shared_priority;
 
 	/* temporarily set while cleaning: */
+	bool empty;
 	struct mailbox *box;
 	struct mailbox_transaction_context *trans;
 	struct mail_search_context *search_ctx;
@@ -49,10 +53,17 @@ static int (*trash_next_quota_test_alloc)(struct quota_transaction_context *,
 static int trash_clean_mailbox_open(struct trash_mailbox *trash)
 {
 	struct mail_search_args *search_args;
+	struct mailbox_status status;
+	enum mail_fetch_field wanted_fields = MAIL_FETCH_PHYSICAL_SIZE;
 
 	trash->box = mailbox_alloc(trash->ns->list, trash->name, 0);
-	if (mailbox_open(trash->box) < 0) {
+	/* with mailbox list index the message count is usually known without
+	   opening the mailbox, so empty trash mailboxes don't need to be
+	   synced and searched. */
+	if (mailbox_get_status(trash->box, STATUS_MESSAGES, &status) < 0 ||
+	    status.messages == 0 || mailbox_open(trash->box) < 0) {
 		mailbox_free(&trash->box);
+		trash->empty = TRUE;
 		return 0;
 	}
 
@@ -61,38 +72,27 @@ static int trash_clean_mailbox_open(struct trash_mailbox *trash)
 
 	trash->trans = mailbox_transaction_begin(trash->box, 0);
 
+	if (trash->shared_priority)
+		wanted_fields |= MAIL_FETCH_RECEIVED_DATE;
 	search_args = mail_search_build_init();
 	mail_search_build_add_all(search_args);
 	trash->search_ctx = mailbox_search_init(trash->trans,
 						search_args, NULL,
-						MAIL_FETCH_PHYSICAL_SIZE |
-						MAIL_FETCH_RECEIVED_DATE, NULL);
+						wanted_fields, NULL);
 	mail_search_args_unref(&search_args);
 
 	return mailbox_search_next(trash->search_ctx, &trash->mail) ? 1 : 0;
 }
 
-static int trash_clean_mailbox_get_next(struct trash_mailbox *trash,
-					time_t *received_time_r)
+static int trash_clean_mailbox_get_next(struct trash_mailbox *trash)
 {
-	int ret;
-
-	if (trash->mail == NULL) {
-		if (trash->box == NULL)
-			ret = trash_clean_mailbox_open(trash);
-		else {
-			ret = mailbox_search_next(trash->search_ctx,
-						  &trash->mail) ? 1 : 0;
-		}
-		if (ret <= 0) {
-			*received_time_r = 0;
-			return ret;
-		}
-	}
-
-	if (mail_get_received_date(trash->mail, received_time_r) < 0)
-		return -1;
-	return 1;
+	if (trash->mail != NULL)
+		return 1;
+	if (trash->empty)
+		return 0;
+	if (trash->box == NULL)
+		return trash_clean_mailbox_open(trash);
+	return mailbox_search_next(trash->search_ctx, &trash->mail) ? 1 : 0;
 }
 
 static int trash_try_clean_mails(struct quota_transaction_context *ctx,
@@ -117,15 +117,31 @@ static int trash_try_clean_mails(struct quota_transaction_context *ctx,
 			if (trashes[j].priority != trashes[i].priority)
 				break;
 
-			ret = trash_clean_mailbox_get_next(&trashes[j],
-							   &received);
+			ret = trash_clean_mailbox_get_next(&trashes[j]);
 			if (ret < 0)
 				goto err;
-			if (ret > 0) {
-				if (oldest == (time_t)-1 || received < oldest) {
-					oldest = received;
-					oldest_idx = j;
-				}
+			if (ret == 0)
+				continue;
+			if (oldest_idx == count) {
+				/* received dates are needed only if more than
+				   one mailbox has mails left */
+				oldest_idx = j;
+				continue;
+			}
+			if (oldest == (time_t)-1 &&
+			    mail_get_received_date(trashes[oldest_idx].mail,
+						   &oldest) < 0) {
+				ret = -1;
+				goto err;
+			}
+			if (mail_get_received_date(trashes[j].mail,
+						   &received) < 0) {
+				ret = -1;
+				goto err;
+			}
+			if (received < oldest) {
+				oldest = received;
+				oldest_idx = j;
 			}
 		}
 
@@ -154,6 +170,7 @@ err:
 	for (i = 0; i < count; i++) {
 		struct trash_mailbox *trash = &trashes[i];
 
+		trash->empty = FALSE;
 		if (trash->box == NULL)
 			continue;
 
@@ -281,7 +298,8 @@ static int read_configuration(struct mail_user *user, const char *path)
 	struct trash_user *tuser = TRASH_USER_CONTEXT(user);
 	struct istream *input;
 	const char *line, *name;
-	struct trash_mailbox *trash;
+	struct trash_mailbox *trash, *trashes;
+	unsigned int i, count;
 	int fd, ret = 0;
 
 	fd = open(path, O_RDONLY);
@@ -329,6 +347,13 @@ static int read_configuration(struct mail_user *user, const char *path)
 	i_close_fd(&fd);
 
 	array_sort(&tuser->trash_boxes, trash_mailbox_priority_cmp);
+	trashes = array_get_modifiable(&tuser->trash_boxes, &count);
+	for (i = 1; i < count; i++) {
+		if (trashes[i-1].priority == trashes[i].priority) {
+			trashes[i-1].shared_priority = TRUE;
+			trashes[i].shared_priority = TRUE;
+		}
+	}
 	return ret;
 }
 
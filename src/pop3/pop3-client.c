@@ -17,6 +17,7 @@
 #include "mail-storage.h"
 #include "mail-storage-service.h"
 #include "pop3-commands.h"
+#include "pop3-listing.h"
 #include "mail-search-build.h"
 #include "mail-namespace.h"
 
@@ -82,10 +83,12 @@ static void client_idle_timeout(struct client *client)
 }
 
 static int
-pop3_mail_get_size(struct client *client, struct mail *mail, uoff_t *size_r)
+pop3_mail_get_size(struct client *client, struct mail *mail, uoff_t *size_r,
+		   bool *exact_r)
 {
 	int ret;
 
+	*exact_r = TRUE;
 	if (!client->set->pop3_fast_size_lookups)
 		return mail_get_virtual_size(mail, size_r);
 
@@ -104,8 +107,10 @@ pop3_mail_get_size(struct client *client, struct mail *mail, uoff_t *size_r)
 	mail->lookup_abort = MAIL_LOOKUP_ABORT_READ_MAIL;
 	ret = mail_get_physical_size(mail, size_r);
 	mail->lookup_abort = MAIL_LOOKUP_ABORT_NEVER;
-	if (ret == 0)
+	if (ret == 0) {
+		*exact_r = FALSE;
 		return 0;
+	}
 
 	if (mailbox_get_last_mail_error(mail->box) != MAIL_ERROR_NOTPOSSIBLE)
 		return -1;
@@ -136,6 +141,33 @@ msgnum_to_seq_map_add(ARRAY_TYPE(uint32_t) *msgnum_to_seq_map,
 	array_append(msgnum_to_seq_map, &mail->seq, 1);
 }
 
+static int
+pop3_mail_get_listing_size(struct client *client, struct pop3_listing *listing,
+			   struct mail *mail, uoff_t *size_r)
+{
+	const char *pop3_order;
+	bool have_size, exact;
+
+	if (pop3_listing_lookup(listing, mail->seq, &have_size, size_r)) {
+		if (have_size)
+			return 0;
+		return pop3_mail_get_size(client, mail, size_r, &exact);
+	}
+
+	/* a new message. if it has a POP3 order, the messages need to be
+	   sorted and the listing can't be used anymore. */
+	if (mail_get_special(mail, MAIL_FETCH_POP3_ORDER, &pop3_order) < 0)
+		return -1;
+	if (*pop3_order != '\0') {
+		pop3_listing_set_have_pop3_order(listing);
+		return 0;
+	}
+	if (pop3_mail_get_size(client, mail, size_r, &exact) < 0)
+		return -1;
+	pop3_listing_add(listing, mail->seq, *size_r, exact);
+	return 0;
+}
+
 static int read_mailbox(struct client *client, uint32_t *failed_uid_r)
 {
         struct mailbox_status status;
@@ -144,10 +176,13 @@ static int read_mailbox(struct client *client, uint32_t *failed_uid_r)
 	struct mail_search_arg *sarg;
 	struct mail_search_context *ctx;
 	struct mail *mail;
+	struct pop3_listing *listing = NULL;
 	uoff_t size;
 	ARRAY(uoff_t) message_sizes;
 	ARRAY_TYPE(uint32_t) msgnum_to_seq_map = ARRAY_INIT;
+	enum mail_fetch_field wanted_fields;
 	unsigned int msgnum;
+	bool exact;
 	int ret = 1;
 
 	*failed_uid_r = 0;
@@ -170,9 +205,21 @@ static int read_mailbox(struct client *client, uint32_t *failed_uid_r)
 	}
 	mail_search_args_init(search_args, client->mailbox, TRUE, NULL);
 
-	ctx = mailbox_search_init(t, search_args, pop3_sort_program,
-				  client->set->pop3_fast_size_lookups ? 0 :
-				  MAIL_FETCH_VIRTUAL_SIZE, NULL);
+	if (client->set->pop3_listing_index) {
+		listing = pop3_listing_init(t);
+		if (!pop3_listing_is_usable(listing))
+			pop3_listing_deinit(&listing);
+	}
+	wanted_fields = client->set->pop3_fast_size_lookups ? 0 :
+		MAIL_FETCH_VIRTUAL_SIZE;
+	if (listing == NULL) {
+		ctx = mailbox_search_init(t, search_args, pop3_sort_program,
+					  wanted_fields, NULL);
+	} else {
+		/* the listing has no POP3 orders, so the messages are in
+		   UID order. the sizes are looked up only for new messages. */
+		ctx = mailbox_search_init(t, search_args, NULL, 0, NULL);
+	}
 	mail_search_args_unref(&search_args);
 
 	client->last_seen_pop3_msn = 0;
@@ -181,11 +228,22 @@ static int read_mailbox(struct client *client, uint32_t *failed_uid_r)
 
 	msgnum = 0;
 	while (mailbox_search_next(ctx, &mail)) {
-		if (pop3_mail_get_size(client, mail, &size) < 0) {
+		if (listing == NULL)
+			ret = pop3_mail_get_size(client, mail, &size, &exact);
+		else {
+			ret = pop3_mail_get_listing_size(client, listing,
+							 mail, &size);
+			if (ret == 0 && !pop3_listing_is_usable(listing)) {
+				/* try again with sorting */
+				break;
+			}
+		}
+		if (ret < 0) {
 			ret = mail->expunged ? 0 : -1;
 			*failed_uid_r = mail->uid;
 			break;
 		}
+		ret = 1;
 		if (array_is_created(&client->all_seqs))
 			seq_range_array_add(&client->all_seqs, mail->seq);
 		msgnum_to_seq_map_add(&msgnum_to_seq_map, client, mail, msgnum);
@@ -202,6 +260,8 @@ static int read_mailbox(struct client *client, uint32_t *failed_uid_r)
 
 	if (mailbox_search_deinit(&ctx) < 0)
 		ret = -1;
+	if (listing != NULL)
+		pop3_listing_deinit(&listing);
 
 	if (ret <= 0) {
 		/* commit the transaction instead of rollbacking to make sure
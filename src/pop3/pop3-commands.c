@@ -318,7 +318,7 @@ struct fetch_context {
 	uoff_t byte_counter_offset;
 
 	unsigned char last;
-	bool cr_skipped, in_body;
+	bool cr_skipped, in_body, wire_ready;
 };
 
 static void fetch_deinit(struct fetch_context *ctx)
@@ -327,6 +327,64 @@ static void fetch_deinit(struct fetch_context *ctx)
 	i_free(ctx);
 }
 
+static bool fetch_is_wire_ready(struct client *client,
+				struct fetch_context *ctx)
+{
+	struct mail *mail = ctx->mail;
+	const unsigned char *data;
+	size_t size;
+	uoff_t physical_size, virtual_size;
+	bool ends_with_lf;
+	int ret;
+
+	/* the message can be sent as-is if it's already known to have only
+	   CRLF linefeeds, no lines beginning with '.' and if it ends with
+	   LF. don't read the whole message to find these out. */
+	if (!mail->has_no_dot_lines ||
+	    (client->set->parsed_workarounds & WORKAROUND_OE_NS_EOH) != 0)
+		return FALSE;
+	if (!mail->has_no_nuls &&
+	    (client->set->parsed_workarounds & WORKAROUND_OUTLOOK_NO_NULS) != 0)
+		return FALSE;
+
+	if (i_stream_get_size(ctx->stream, TRUE, &physical_size) <= 0 ||
+	    physical_size == 0)
+		return FALSE;
+	mail->lookup_abort = MAIL_LOOKUP_ABORT_READ_MAIL;
+	ret = mail_get_virtual_size(mail, &virtual_size);
+	mail->lookup_abort = MAIL_LOOKUP_ABORT_NEVER;
+	if (ret < 0 || virtual_size != physical_size)
+		return FALSE;
+
+	i_stream_seek(ctx->stream, physical_size - 1);
+	ends_with_lf = i_stream_read_data(ctx->stream, &data, &size, 0) > 0 &&
+		data[0] == '\n';
+	i_stream_seek(ctx->stream, 0);
+	return ends_with_lf;
+}
+
+static bool fetch_send_wire_ready(struct client *client,
+				  struct fetch_context *ctx)
+{
+	off_t ret;
+
+	/* this can use sendfile() if the stream is a plain file */
+	o_stream_set_max_buffer_size(client->output, 0);
+	ret = o_stream_send_istream(client->output, ctx->stream);
+	o_stream_set_max_buffer_size(client->output, (size_t)-1);
+
+	if (ret >= 0 && i_stream_have_bytes_left(ctx->stream)) {
+		/* continue later */
+		o_stream_set_flush_pending(client->output, TRUE);
+		return FALSE;
+	}
+	if (ret >= 0 && ctx->stream->stream_errno == 0) {
+		ctx->last = '\n';
+		ctx->in_body = TRUE;
+	}
+	return TRUE;
+}
+
 static void fetch_callback(struct client *client)
 {
 	struct fetch_context *ctx = client->cmd_context;
@@ -335,6 +393,12 @@ static void fetch_callback(struct client *client)
 	size_t i, size;
 	int ret;
 
+	if (ctx->wire_ready) {
+		if (!fetch_send_wire_ready(client, ctx))
+			return;
+		/* the stream is at EOF now unless it failed */
+	}
+
 	while ((ctx->body_lines > 0 || !ctx->in_body) &&
 	       i_stream_read_data(ctx->stream, &data, &size, 0) > 0) {
 		if (size > 4096)
@@ -448,7 +512,8 @@ static int fetch(struct client *client, unsigned int msgnum, uoff_t body_lines,
 	ctx->byte_counter_offset = client->output->offset;
 	ctx->mail = mail_alloc(client->trans,
 			       MAIL_FETCH_STREAM_HEADER |
-			       MAIL_FETCH_STREAM_BODY, NULL);
+			       MAIL_FETCH_STREAM_BODY |
+			       MAIL_FETCH_NUL_STATE, NULL);
 	mail_set_seq(ctx->mail, msgnum_to_seq(client, msgnum));
 
 	if (mail_get_stream(ctx->mail, NULL, NULL, &ctx->stream) < 0) {
@@ -468,6 +533,7 @@ static int fetch(struct client *client, unsigned int msgnum, uoff_t body_lines,
 
 	ctx->body_lines = body_lines;
 	if (body_lines == (uoff_t)-1) {
+		ctx->wire_ready = fetch_is_wire_ready(client, ctx);
 		client_send_line(client, "+OK %"PRIuUOFF_T" octets",
 				 client->message_sizes[msgnum]);
 	} else {
@@ -0,0 +1,110 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "pop3-common.h"
+#include "mail-index.h"
+#include "mail-storage-private.h"
+#include "pop3-listing.h"
+
+/* The listing consists of a mail index header extension and a record
+   extension for each message. Expunged messages' records disappear from the
+   index along with the messages. New messages are added to the listing when
+   a POP3 session sees them the first time. */
+#define POP3_LISTING_EXT_NAME "pop3-listing"
+
+enum pop3_listing_header_flags {
+	/* Some message has a POP3 order. The listing's order can't be used. */
+	POP3_LISTING_HEADER_FLAG_HAVE_POP3_ORDER	= 0x01
+};
+
+struct pop3_listing_header {
+	uint32_t flags;
+};
+
+struct pop3_listing_record {
+	/* message's POP3 size + 1. 0 = message isn't in the listing,
+	   (uint32_t)-1 = size isn't known exactly. */
+	uint32_t size1;
+};
+
+struct pop3_listing {
+	struct mailbox_transaction_context *t;
+	uint32_t ext_id;
+	struct pop3_listing_header hdr;
+
+	unsigned int hdr_changed:1;
+};
+
+struct pop3_listing *
+pop3_listing_init(struct mailbox_transaction_context *t)
+{
+	struct pop3_listing *listing;
+	const void *data;
+	size_t size;
+
+	listing = i_new(struct pop3_listing, 1);
+	listing->t = t;
+	listing->ext_id = mail_index_ext_register(t->box->index,
+		POP3_LISTING_EXT_NAME, sizeof(struct pop3_listing_header),
+		sizeof(struct pop3_listing_record), sizeof(uint32_t));
+
+	mail_index_get_header_ext(t->view, listing->ext_id, &data, &size);
+	if (size >= sizeof(listing->hdr))
+		memcpy(&listing->hdr, data, sizeof(listing->hdr));
+	return listing;
+}
+
+void pop3_listing_deinit(struct pop3_listing **_listing)
+{
+	struct pop3_listing *listing = *_listing;
+
+	*_listing = NULL;
+	if (listing->hdr_changed) {
+		mail_index_update_header_ext(listing->t->itrans,
+					     listing->ext_id, 0, &listing->hdr,
+					     sizeof(listing->hdr));
+	}
+	i_free(listing);
+}
+
+bool pop3_listing_is_usable(struct pop3_listing *listing)
+{
+	return (listing->hdr.flags &
+		POP3_LISTING_HEADER_FLAG_HAVE_POP3_ORDER) == 0;
+}
+
+void pop3_listing_set_have_pop3_order(struct pop3_listing *listing)
+{
+	listing->hdr.flags |= POP3_LISTING_HEADER_FLAG_HAVE_POP3_ORDER;
+	listing->hdr_changed = TRUE;
+}
+
+bool pop3_listing_lookup(struct pop3_listing *listing, uint32_t seq,
+			 bool *have_size_r, uoff_t *size_r)
+{
+	const struct pop3_listing_record *rec;
+	const void *data;
+	bool expunged;
+
+	mail_index_lookup_ext(listing->t->view, seq, listing->ext_id,
+			      &data, &expunged);
+	rec = data;
+	if (rec == NULL || rec->size1 == 0)
+		return FALSE;
+
+	*have_size_r = rec->size1 != (uint32_t)-1;
+	*size_r = rec->size1 - 1;
+	return TRUE;
+}
+
+void pop3_listing_add(struct pop3_listing *listing, uint32_t seq,
+		      uoff_t size, bool size_exact)
+{
+	struct pop3_listing_record rec;
+
+	if (size_exact && size < (uint32_t)-1 - 1)
+		rec.size1 = size + 1;
+	else
+		rec.size1 = (uint32_t)-1;
+	mail_index_update_ext(listing->t->itrans, seq, listing->ext_id,
+			      &rec, NULL);
+}
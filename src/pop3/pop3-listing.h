@@ -0,0 +1,28 @@
+#ifndef POP3_LISTING_H
+#define POP3_LISTING_H
+
+struct mailbox_transaction_context;
+
+/* Persistent POP3 listing of a mailbox, stored in the mail index. It
+   contains the POP3 size of each message, so that the listing can be built
+   at session start without looking up each message's size separately. */
+
+struct pop3_listing *
+pop3_listing_init(struct mailbox_transaction_context *t);
+void pop3_listing_deinit(struct pop3_listing **listing);
+
+/* Returns TRUE if the listing can be used. It can't if some messages have
+   a POP3 order, because their order doesn't then match the UID order. */
+bool pop3_listing_is_usable(struct pop3_listing *listing);
+/* Mark the listing unusable, because the given message has POP3 order. */
+void pop3_listing_set_have_pop3_order(struct pop3_listing *listing);
+/* Returns TRUE if the message is already in the listing. Its size is
+   returned only if it was known exactly (the listing may have been
+   written with pop3_fast_size_lookups=yes). */
+bool pop3_listing_lookup(struct pop3_listing *listing, uint32_t seq,
+			 bool *have_size_r, uoff_t *size_r);
+/* Add a new message to the listing. size_exact=FALSE means the size
+   couldn't be looked up exactly and isn't stored. */
+void pop3_listing_add(struct pop3_listing *listing, uint32_t seq,
+		      uoff_t size, bool size_exact);
+#endif
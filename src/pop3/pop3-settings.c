@@ -67,6 +67,7 @@ static const struct setting_define pop3_setting_defines[] = {
 	DEF(SET_BOOL, pop3_save_uidl),
 	DEF(SET_BOOL, pop3_lock_session),
 	DEF(SET_BOOL, pop3_fast_size_lookups),
+	DEF(SET_BOOL, pop3_listing_index),
 	DEF(SET_STR, pop3_client_workarounds),
 	DEF(SET_STR, pop3_logout_format),
 	DEF(SET_ENUM, pop3_uidl_duplicates),
@@ -85,6 +86,7 @@ static const struct pop3_settings pop3_default_settings = {
 	.pop3_save_uidl = FALSE,
 	.pop3_lock_session = FALSE,
 	.pop3_fast_size_lookups = FALSE,
+	.pop3_listing_index = TRUE,
 	.pop3_client_workarounds = "",
 	.pop3_logout_format = "top=%t/%p, retr=%r/%b, del=%d/%m, size=%s",
 	.pop3_uidl_duplicates = "allow:rename",